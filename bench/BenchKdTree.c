@@ -0,0 +1,253 @@
+// ==================================================================
+// BenchKdTree.c
+// ==================================================================
+// Compares the time taken to build kd-trees by KdTree_create with
+// that of the original qsort-based builder, on the candidate sets
+// that Scanner would build for a list of templates and targets.
+//
+// Usage: BenchKdTree <template-list> <target-list> [repeats]
+// ==================================================================
+
+#include "KdTree.h"
+#include "Molecule.h"
+#include "TessTemplate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// ==================================================================
+// The original builder (one calloc per node, qsort at every level)
+// ==================================================================
+
+typedef struct _OldNode OldNode;
+
+struct _OldNode
+{
+	int type;
+	int index;
+	OldNode *left;
+	OldNode *right;
+	double *min;
+	double *max;
+	int depth;
+};
+
+static double **Old_data;
+static int Old_index;
+
+static int Old_compare(const void *pa, const void *pb)
+{
+	double c = Old_data[*((const int*)pa)][Old_index];
+	double d = Old_data[*((const int*)pb)][Old_index];
+
+	return c<d ? -1 : c>d ? 1 : 0;
+}
+
+static OldNode *OldNode_create(int *idx,int n,int type,double **u,int dim)
+{
+	OldNode *N;
+	int split,i;
+
+	if(n<=0) return NULL;
+
+	N = (OldNode*)calloc(1,sizeof(OldNode)+dim*2*sizeof(double));
+	N->min=(double*)&N[1];
+	N->max=&N->min[dim];
+
+	if(n==1)
+	{
+		N->type=-1;
+		N->index=idx[0];
+		N->depth=1;
+		memcpy(N->min,u[idx[0]],sizeof(double)*dim);
+		memcpy(N->max,u[idx[0]],sizeof(double)*dim);
+		return N;
+	}
+
+	Old_data=u;
+	Old_index=type;
+	qsort(idx,n,sizeof(int),Old_compare);
+
+	split = n/2;
+	N->index=idx[split-1];
+	while(split<n-1 && u[split+1][type]==u[split][type]) split++;
+	N->type=type;
+
+	type = (type+1)%dim;
+	N->left = OldNode_create(idx,split,type,u,dim);
+	N->right = OldNode_create(&idx[split],n-split,type,u,dim);
+	N->depth = (N->left->depth>N->right->depth ? N->left->depth:N->right->depth)+1;
+
+	for(i=0; i<dim; i++)
+	{
+		N->min[i]=N->left->min[i]<N->right->min[i] ? N->left->min[i]:N->right->min[i];
+		N->max[i]=N->left->max[i]>N->right->max[i] ? N->left->max[i]:N->right->max[i];
+	}
+
+	return N;
+}
+
+static void OldNode_free(OldNode *N)
+{
+	if(N)
+	{
+		OldNode_free(N->left);
+		OldNode_free(N->right);
+		free(N);
+	}
+}
+
+static void Old_build(double **u, int n)
+{
+	int *tmp;
+	int i;
+
+	tmp = (int*)calloc(n,sizeof(int));
+	for(i=0; i<n; i++) tmp[i]=i;
+	OldNode_free(OldNode_create(tmp,n,0,u,3));
+	free(tmp);
+}
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static int readList(const char *filename, char ***list)
+{
+	FILE *file;
+	char buf[0x200];
+	char *s;
+	int k,n=0,size=16;
+
+	if(!(file=fopen(filename,"r")))
+	{
+		perror(filename);
+		exit(1);
+	}
+
+	*list=(char**)malloc(size*sizeof(char*));
+	while(fgets(buf,sizeof(buf),file))
+	{
+		for(s=buf; isspace(*s); s++);
+		for(k=strlen(s); k>0 && isspace(s[k-1]); k--);
+		s[k]=0;
+		if(!*s) continue;
+		if(n==size) *list=(char**)realloc(*list,(size*=2)*sizeof(char*));
+		(*list)[n++]=strdup(s);
+	}
+
+	fclose(file);
+	return n;
+}
+
+// ==================================================================
+// Entry point
+// ==================================================================
+
+int main(int argc, char **argv)
+{
+	char **tname,**mname;
+	Template **T;
+	Molecule *M;
+	FILE *file;
+	double ***set;
+	int *size;
+	int nt,nm,nset,i,j,k,m,n,r,repeats;
+	long points=0;
+	double t0,tOld=0.0,tNew=0.0;
+
+	if(argc<3)
+	{
+		fprintf(stderr,"usage: %s <template-list> <target-list> [repeats]\n",argv[0]);
+		return 1;
+	}
+
+	repeats = argc>3 ? atoi(argv[3]):10;
+
+	nt=readList(argv[1],&tname);
+	T=(Template**)calloc(nt,sizeof(Template*));
+	for(i=0; i<nt; i++)
+	{
+		if(!(file=fopen(tname[i],"r")) || !(T[i]=TessTemplate_create(file,tname[i])))
+		{
+			fprintf(stderr,"%s: bad template\n",tname[i]);
+			return 1;
+		}
+		fclose(file);
+	}
+
+	nm=readList(argv[2],&mname);
+	nset=0;
+
+	for(j=0; j<nm; j++)
+	{
+		if(!(file=fopen(mname[j],"r"))) continue;
+		M=Molecule_create(file,0);
+		fclose(file);
+		if(!M) continue;
+
+		// Collect the candidate sets for every atom of
+		// every template, exactly as Scanner does...
+
+		for(n=0,i=0; i<nt; i++) n+=T[i]->count(T[i]);
+		set=(double***)calloc(n,sizeof(double**));
+		size=(int*)calloc(n,sizeof(int));
+
+		for(n=0,i=0; i<nt; i++)
+		{
+			for(k=0; k<T[i]->count(T[i]); k++,n++)
+			{
+				set[n]=(double**)malloc(Molecule_count(M)*sizeof(double*));
+				for(m=0; m<Molecule_count(M); m++)
+				{
+					if(T[i]->match(T[i],k,Molecule_atom(M,m)))
+					{
+						set[n][size[n]++]=(double*)Molecule_atom(M,m)->x;
+					}
+				}
+			}
+		}
+
+		// ...and time building trees on them both ways.
+
+		for(r=0; r<repeats; r++)
+		{
+			t0=now();
+			for(k=0; k<n; k++) if(size[k]>0) Old_build(set[k],size[k]);
+			tOld+=now()-t0;
+
+			t0=now();
+			for(k=0; k<n; k++) if(size[k]>0) KdTree_free(KdTree_create(set[k],size[k],3));
+			tNew+=now()-t0;
+		}
+
+		for(k=0; k<n; k++)
+		{
+			points+=size[k];
+			free(set[k]);
+		}
+
+		nset+=n;
+		free(set);
+		free(size);
+		Molecule_free(M);
+	}
+
+	printf("candidate sets: %i (%ld points, %i repeats)\n",nset,points,repeats);
+	printf("qsort builder:  %8.3f s\n",tOld);
+	printf("KdTree_create:  %8.3f s\n",tNew);
+	printf("speed-up:       %8.2fx\n",tNew>0.0 ? tOld/tNew:0.0);
+
+	return 0;
+}
+
+// ==================================================================
@@ -0,0 +1,321 @@
+// ==================================================================
+// BenchParse.c
+// ==================================================================
+// Measures the throughput (MB/s and atoms/s) of reading targets with
+// Molecule_create, against that of the original PDB reader (fgets
+// into a cleared buffer, atof/atoi/strncpy on every field, one
+// calloc per atom), over one or more lists of targets. Lists of the
+// same structures as PDB, mmCIF and BinaryCIF (or gzipped) compare
+// the formats. An archive written by jess --pack may be given in
+// place of a list, to time taking its molecules with Archive_molecule.
+//
+// Usage: BenchParse [-r repeats] <target-list or archive>...
+// ==================================================================
+
+#include "Molecule.h"
+#include "Archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// ==================================================================
+// The original reader
+// ==================================================================
+
+typedef struct _OldAtom OldAtom;
+
+struct _OldAtom
+{
+	int serial;
+	char name[5];
+	char altLoc;
+	char resName[4];
+	char chainID1;
+	char chainID2;
+	int resSeq;
+	char iCode;
+	double x[3];
+	double occupancy;
+	double tempFactor;
+	char segID[4];
+	char element[3];
+	int charge;
+	OldAtom *next;
+};
+
+static void Old_copyToken(char *d,const char *s,int n)
+{
+	int i;
+
+	strncpy(d,s,n);
+	d[n]=0;
+	for(i=0; i<n; i++)
+	{
+		if(isspace(d[i])) d[i]='_';
+	}
+}
+
+static int Old_parse(OldAtom *A, const char *s)
+{
+	int n;
+
+	if(strncmp(s,"ATOM",4) && strncmp(s,"HETATM",6)!=0) return 0;
+
+	n = strlen(s);
+	memset(A,0,sizeof(OldAtom));
+
+	if(n>6)  A->serial = atoi(&s[6]); else return 1;
+	if(n>12) Old_copyToken(A->name,&s[12],4); else return 1;
+	if(n>16) A->altLoc = s[16]; else return 1;
+	if(n>17) Old_copyToken(A->resName,&s[17],3); else return 1;
+	if(n>20) A->chainID1 = s[20]; else return 1;
+	if(n>21) A->chainID2 = isspace(s[21]) ? '0':s[21]; else return 1;
+	if(n>22) A->resSeq = atoi(&s[22]); else return 1;
+	if(n>26) A->iCode = s[26]; else return 1;
+	if(n>30) A->x[0] = atof(&s[30]); else return 1;
+	if(n>38) A->x[1] = atof(&s[38]); else return 1;
+	if(n>46) A->x[2] = atof(&s[46]); else return 1;
+	if(n>54) A->occupancy = atof(&s[54]); else return 1;
+	if(n>60) A->tempFactor = atof(&s[60]); else return 1;
+	if(n>72) Old_copyToken(A->segID,&s[72],4); else return 1;
+	if(n>76) Old_copyToken(A->element,&s[76],2); else return 1;
+	if(n>78) A->charge = atoi(&s[78]); else return 1;
+
+	return 1;
+}
+
+static int Old_read(FILE *file)
+{
+	OldAtom *head=NULL;
+	OldAtom A,*pA;
+	char buf[0x100];
+	int count=0;
+
+	memset(buf,0,0x100);
+	while(fgets(buf,0x100,file))
+	{
+		if(strncmp(buf,"ENDMDL",6)==0) break;
+
+		if(Old_parse(&A,buf))
+		{
+			pA = (OldAtom*)calloc(1,sizeof(OldAtom));
+			memcpy(pA,&A,sizeof(OldAtom));
+			pA->next=head;
+			head=pA;
+			count++;
+		}
+
+		memset(buf,0,0x100);
+	}
+
+	while(head)
+	{
+		pA=head->next;
+		free(head);
+		head=pA;
+	}
+
+	return count;
+}
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static int readList(const char *filename, char ***list)
+{
+	FILE *file;
+	char buf[0x200];
+	char *s;
+	int k,n=0,size=16;
+
+	if(!(file=fopen(filename,"r")))
+	{
+		perror(filename);
+		exit(1);
+	}
+
+	*list=(char**)malloc(size*sizeof(char*));
+	while(fgets(buf,sizeof(buf),file))
+	{
+		for(s=buf; isspace(*s); s++);
+		for(k=strlen(s); k>0 && isspace(s[k-1]); k--);
+		s[k]=0;
+		if(!*s) continue;
+		if(n==size) *list=(char**)realloc(*list,(size*=2)*sizeof(char*));
+		(*list)[n++]=strdup(s);
+	}
+
+	fclose(file);
+	return n;
+}
+
+static int isPdb(FILE *file)
+{
+	char buf[5];
+	int n;
+
+	// Neither mmCIF (which begins with "data_"), BinaryCIF
+	// (which begins with a MessagePack map) nor gzip.
+
+	n=fread(buf,1,5,file);
+	rewind(file);
+
+	return n>0 && (unsigned char)buf[0]<0x80 && buf[0]!=0x1f && !(n==5 && strncmp(buf,"data_",5)==0);
+}
+
+static void report(const char *what, double t, double bytes, double atoms)
+{
+	printf("%-28s %8.3f s %8.1f MB/s %10.0f atoms/s\n",
+		what,t,t>0.0 ? bytes/t/1e6:0.0,t>0.0 ? atoms/t:0.0);
+}
+
+static void archive(Archive *A, const char *filename, int repeats)
+{
+	Molecule *M;
+	double bytes=0.0,atoms=0.0,t,t0;
+	long k,n=Archive_count(A);
+	int r;
+
+	t=0.0;
+	for(r=0; r<repeats; r++)
+	{
+		for(k=0; k<n; k++)
+		{
+			t0=now();
+			M=Archive_molecule(A,k);
+			t+=now()-t0;
+			if(!M) continue;
+
+			if(r==0)
+			{
+				bytes+=Archive_size(A,k);
+				atoms+=Molecule_count(M);
+			}
+
+			Molecule_free(M);
+		}
+	}
+
+	printf("%s: archive of %li molecules (%.1f MB, %.0f atoms, %i repeats)\n",filename,n,bytes/1e6,atoms,repeats);
+	report("Archive_molecule",t,bytes*repeats,atoms*repeats);
+}
+
+// ==================================================================
+// Entry point
+// ==================================================================
+
+int main(int argc, char **argv)
+{
+	char **mname;
+	Archive *A;
+	Molecule *M;
+	FILE *file;
+	struct stat st;
+	int nm,i,j,l,r,repeats=5,files;
+	double bytes,atoms,oldAtoms;
+	double t0,tOld,tNew,tTree;
+
+	if(argc>2 && strcmp(argv[1],"-r")==0)
+	{
+		repeats=atoi(argv[2]);
+		argv+=2;
+		argc-=2;
+	}
+
+	if(argc<2)
+	{
+		fprintf(stderr,"usage: %s [-r repeats] <target-list>...\n",argv[0]);
+		return 1;
+	}
+
+	for(l=1; l<argc; l++)
+	{
+		// An archive is given in place of a list.
+
+		if((file=fopen(argv[l],"r")))
+		{
+			i=Archive_check(file);
+			fclose(file);
+		}
+
+		if(file && i && (A=Archive_open(argv[l])))
+		{
+			archive(A,argv[l],repeats);
+			Archive_close(A);
+			continue;
+		}
+
+		nm=readList(argv[l],&mname);
+		files=0;
+		bytes=atoms=oldAtoms=0.0;
+		tOld=tNew=tTree=0.0;
+
+		for(r=0; r<repeats; r++)
+		{
+			for(j=0; j<nm; j++)
+			{
+				if(stat(mname[j],&st) || !S_ISREG(st.st_mode)) continue;
+
+				// The original reader (of PDB files only)...
+
+				if(!(file=fopen(mname[j],"r"))) continue;
+				if(isPdb(file))
+				{
+					t0=now();
+					i=Old_read(file);
+					tOld+=now()-t0;
+					if(r==0) oldAtoms+=i;
+				}
+				fclose(file);
+
+				// ...and Molecule_create, then the molecule's
+				// kd-tree, which is only built once a search
+				// asks for it.
+
+				if(!(file=fopen(mname[j],"r"))) continue;
+				t0=now();
+				M=Molecule_create(file,0);
+				tNew+=now()-t0;
+				fclose(file);
+				if(!M) continue;
+
+				t0=now();
+				Molecule_tree(M);
+				tTree+=now()-t0;
+
+				if(r==0)
+				{
+					files++;
+					bytes+=st.st_size;
+					atoms+=Molecule_count(M);
+				}
+
+				Molecule_free(M);
+			}
+		}
+
+		for(j=0; j<nm; j++) free(mname[j]);
+		free(mname);
+
+		printf("%s: %i files (%.1f MB, %.0f atoms, %i repeats)\n",argv[l],files,bytes/1e6,atoms,repeats);
+		if(oldAtoms>0.0) report("original reader",tOld,bytes*repeats,oldAtoms*repeats);
+		report("Molecule_create",tNew,bytes*repeats,atoms*repeats);
+		report("Molecule_create and tree",tNew+tTree,bytes*repeats,atoms*repeats);
+	}
+
+	return 0;
+}
+
+// ==================================================================
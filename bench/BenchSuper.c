@@ -0,0 +1,600 @@
+// ==================================================================
+// BenchSuper.c
+// ==================================================================
+// Compares Superposition (the quaternion method, with the largest
+// eigenvalue found as in QCP) with the original superposition (a
+// Jacobi diagonalisation of X^T.X with a trig call per rotation),
+// for time and accuracy. Random sets of n points are superposed on
+// rotated, shifted and perturbed copies of themselves: the time per
+// superposition is given for the original, for Superposition with
+// the rotation, and for the RMSD alone (as when a hit is rejected),
+// one Superposition being reset and reused for them all.
+// Accuracy is compared on random sets, exact copies, sets on a plane
+// and sets on a line (a fifth of each being of 3 points, which are
+// always on a plane), as the largest difference in RMSD between the
+// two, and for each the count of rotations which are not proper
+// rotations (to 1e-6) and the largest difference between the RMSD
+// given and that of the rotation given, over the others.
+//
+// Usage: BenchSuper [-r repeats] [count]
+// ==================================================================
+
+#include "Super.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// ==================================================================
+// The original superposition (from arrays of centred points)
+// ==================================================================
+
+static double min(double a, double b)
+{
+	return a<b ? a:b;
+}
+
+static double max(double a, double b)
+{
+	return a>b ? a:b;
+}
+
+static const double PRECISION = 1e-12;
+
+static void rotate(double *W, double *P, int ip, int iq)
+{
+	// Here we sacrifice some speed/precision in
+	// favour of simplicity. I dislike heuristic
+	// optimistations - and distrust them too.
+
+	double c,s;
+	double pp,qq,pq;
+	double t;
+	int k;
+
+	double colWp[3];
+	double colWq[3];
+	double colPp[3];
+	double colPq[3];
+
+	// Here we must "rotate" element (ip,iq).
+	// Rather than follow the formula given
+	// in NR/C, I'll do my own - probably
+	// very slow in comparison since it uses
+	// a trig function. But I understand it
+	// so that's all that matters...
+
+	// Thus, W -> R^T W R and P -> P R where
+	// R is an (ip,iq) rotation matrix.
+	// Below, c and s are the cosine and sine
+	// of the angle of rotation theta.
+
+	// Calculate the cos and sin required
+	// The new W(ip,iq) is given by...
+	//
+	//  W(ip,iq) -> (c*c-s*s)W(ip,iq)-sc(W(ip,ip)-W(iq,iq))
+	//
+	// so this is the thing we want to zero.
+	// Put A = W(ip,iq), B = (W(ip,ip)-W(iq,iq)),
+	// c = cos(t), s = sin(t) and we have
+	//
+	//  2cos(2t)A = sin(2t)B
+	//
+	// Now we can solve for 2t using atan2.
+
+	t = atan2(2*W[3*ip+iq],W[3*iq+iq]-W[3*ip+ip])/(double)2;
+
+	c = cos(t);
+	s = sin(t);
+
+	// So now we have c and s. We need to calculate
+	// the new values of the iqth and ipth columns of
+	// both W and of P.
+
+	for(k=0; k<3; k++)
+	{
+		colWp[k] = c*W[3*k+ip] - s*W[3*k+iq];
+		colWq[k] = c*W[3*k+iq] + s*W[3*k+ip];
+		colPp[k] = c*P[3*k+ip] - s*P[3*k+iq];
+		colPq[k] = s*P[3*k+ip] + c*P[3*k+iq];
+	}
+
+	// Some of the above are not correct. In particular
+	// whenever k=ip or k=iq we need a correction for
+	// the W matrix...
+    // Element 	W(ip,ip)
+
+	pp = c*c*W[3*ip+ip]+s*s*W[3*iq+iq]-(double)2*s*c*W[3*ip+iq];
+
+	// Element W(iq,iq)
+
+	qq = s*s*W[3*ip+ip]+c*c*W[3*iq+iq]+(double)2*s*c*W[3*ip+iq];
+
+	// Element W(ip,iq)
+
+	pq = (double)0; // = (c*c-s*s)*W(ip,iq) + s*c*(W(ip,ip)-W(iq,iq))  ;-)
+
+	// Put the new values into W and into P...
+
+	for(k=0; k<3; k++)
+	{
+		W[3*k+ip] = colWp[k];
+		W[3*ip+k] = colWp[k];
+    	W[3*k+iq] = colWq[k];
+		W[3*iq+k] = colWq[k];
+
+		P[3*k+ip] = colPp[k];
+		P[3*k+iq] = colPq[k];
+	}
+
+	W[3*ip+ip] = pp;
+	W[3*iq+iq] = qq;
+	W[3*ip+iq] = pq;
+	W[3*iq+ip] = pq;
+
+	// We're done, and ready for the next pass
+}
+
+static int jacobi(double *M, double *P, double *v)
+{
+	double W[9];
+	int iterationCount=0;
+	int done=0;
+	int i,j;
+	double sum;
+
+	// W is a copy of M to be diagonlised, P is initially the
+	// identity matrix...
+
+	memcpy(W,M,sizeof(W));
+	memset(P,0,sizeof(W));
+	P[0]=P[4]=P[8]=(double)1;
+
+	// Loop until finished...
+
+	while(!done)
+	{
+		iterationCount++;
+
+		// Sum the absolute values of the off-diagonal
+		// elements of the working matrix...
+
+		sum=(double)0;
+
+		for(i=0; i<2; i++)
+		{
+			for(j=i+1; j<3; j++)
+			{
+				sum += fabs(W[3*i+j]);
+			}
+		}
+
+		// If the sum is small enough we are done. If
+		// not, we need to rotate all the off-diagonal
+		// elements...
+
+		if(sum<PRECISION)
+		{
+			done=1;
+		}
+  		else
+		{
+			// "Rotate" all the off-diagonal elements
+			// of the working matrix in conjunction with
+			// P. This is the guts of the algorithm.
+
+			for(i=0; i<2; i++)
+			{
+				for(j=i+1; j<3; j++)
+				{
+					rotate(W,P,i,j);
+				}
+			}
+		}
+	}
+
+	// Finally, copy the diagonal values of W to the
+	// vector of eigenvalues...
+
+	for(i=0; i<3; i++)
+	{
+		v[i]=W[4*i];
+	}
+
+
+	return iterationCount;
+}
+
+
+static double superpose(double *a,double *b, int n, double *M)
+{
+	double sumA=(double)0;
+	double sumB=(double)0;
+	double sumE=(double)0;
+	double detX;
+	double X[9];
+	double XX[9];
+	double P[9];
+	double T[9];
+	double e[3];
+	double rmsd;
+	double factor;
+	int i,j,k;
+	int flag;
+
+	// Compute sum-of squares
+
+	for(i=0; i<3*n; i++)
+	{
+		sumA += a[i]*a[i];
+		sumB += b[i]*b[i];
+	}
+
+	// Compute the "covariances" X
+
+	memset(X,0,sizeof(X));
+	memset(XX,0,sizeof(XX));
+
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			for(k=0; k<3; k++)
+			{
+				X[3*j+k] += a[3*i+j]*b[3*i+k];
+			}
+		}
+	}
+
+	// And compute det(X)...
+
+	detX =
+		+ X[0]*(X[4]*X[8]-X[5]*X[7])
+		- X[1]*(X[3]*X[8]-X[5]*X[6])
+		+ X[2]*(X[3]*X[7]-X[4]*X[6]);
+
+	// Compute X^T.X (XX)
+
+	for(i=0; i<3; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			for(k=0; k<3; k++)
+			{
+				XX[3*i+j] += X[3*k+i]*X[3*k+j];
+			}
+		}
+	}
+
+	// Compute the diagonalisation of XX using
+	// the Jacobi algorithm...
+
+	jacobi(XX,P,e);
+
+	e[0]=max(e[0],0);
+	e[1]=max(e[1],0);
+	e[2]=max(e[2],0);
+
+
+	sumE = sqrt(e[0]) + sqrt(e[1]) + sqrt(e[2]);
+
+	if(detX<1e-8)
+	{
+		sumE -= (double)2*sqrt(min(e[0],min(e[1],e[2])));
+		flag=1;
+	}
+	else
+	{
+		flag=0;
+	}
+
+	rmsd = sumA + sumB - (double)2*sumE;
+	rmsd = sqrt(max(rmsd,0)/(double)n);
+
+	// Compute the transform and return the rmsd.
+	// This will fail if XX has rank<3. I need to
+	// fix this...
+
+	for(i=0; i<3; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			factor = sqrt(e[j]);
+			if(flag && j==0)
+			{
+				factor = -factor;
+			}
+
+			T[3*i+j]=0.0;
+			for(k=0; k<3; k++)
+			{
+				T[3*i+j] += X[3*i+k]*P[3*k+j]/factor;
+			}
+		}
+	}
+
+	for(i=0; i<3; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			M[3*i+j]=0.0;
+			for(k=0; k<3; k++)
+			{
+				M[3*i+j] += P[3*i+k]*T[3*j+k];
+			}
+		}
+	}
+
+	return rmsd;
+}
+
+
+static double Old_superpose(const double *x, const double *y, int n, double *M, double *c)
+{
+	double *a,*b;
+	double rmsd;
+	int i,j;
+
+	// As Superposition_compute did: centre copies of both
+	// sets on their centroids (c[0..2] and c[3..5]).
+
+	a=(double*)malloc(3*n*sizeof(double));
+	b=(double*)malloc(3*n*sizeof(double));
+	memset(c,0,6*sizeof(double));
+
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			c[j]+=x[3*i+j]/n;
+			c[3+j]+=y[3*i+j]/n;
+		}
+	}
+
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			a[3*i+j]=x[3*i+j]-c[j];
+			b[3*i+j]=y[3*i+j]-c[3+j];
+		}
+	}
+
+	rmsd=superpose(a,b,n,M);
+
+	free(a);
+	free(b);
+
+	return rmsd;
+}
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static unsigned long seed = 88172645463325252UL;
+
+static double uniform(void)
+{
+	seed^=seed<<13;
+	seed^=seed>>7;
+	seed^=seed<<17;
+	return (seed>>11)*(1.0/9007199254740992.0);
+}
+
+static double gauss(void)
+{
+	double u=uniform(),v=uniform();
+
+	return sqrt(-2.0*log(u>0.0 ? u:1e-300))*cos(2.0*M_PI*v);
+}
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static void make(double *x, double *y, int n, int shape, double noise)
+{
+	double q[4],R[9],t[3],d;
+	int i,j,k;
+
+	// x: n points in a 20A box (shape 1: on a plane, shape
+	// 2: on a line); y: x rotated, shifted and perturbed.
+
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++) x[3*i+j]=20.0*uniform();
+		if(shape==1) x[3*i+2]=0.3*x[3*i]+0.2*x[3*i+1];
+		if(shape==2) x[3*i+1]=x[3*i+2]=0.5*x[3*i];
+	}
+
+	for(d=0.0,k=0; k<4; k++)
+	{
+		q[k]=gauss();
+		d+=q[k]*q[k];
+	}
+
+	for(d=sqrt(d),k=0; k<4; k++) q[k]/=d;
+
+	R[0]=q[0]*q[0]+q[1]*q[1]-q[2]*q[2]-q[3]*q[3];
+	R[1]=2*(q[1]*q[2]-q[0]*q[3]);
+	R[2]=2*(q[1]*q[3]+q[0]*q[2]);
+	R[3]=2*(q[1]*q[2]+q[0]*q[3]);
+	R[4]=q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3];
+	R[5]=2*(q[2]*q[3]-q[0]*q[1]);
+	R[6]=2*(q[1]*q[3]-q[0]*q[2]);
+	R[7]=2*(q[2]*q[3]+q[0]*q[1]);
+	R[8]=q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3];
+
+	for(j=0; j<3; j++) t[j]=100.0*(uniform()-0.5);
+
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			y[3*i+j]=t[j]+noise*gauss();
+			for(k=0; k<3; k++) y[3*i+j]+=R[3*j+k]*x[3*i+k];
+		}
+	}
+}
+
+static void check(const double *x, const double *y, int n, const double *M,
+	const double *c0, const double *c1, double rmsd, double *worst)
+{
+	double e,s,d,w;
+	int i,j,k;
+
+	// worst[0]: count of rotations with |det M - 1| or
+	// |M^T.M - I| over 1e-6 (or not a number); [1]: largest
+	// |rmsd given - rmsd of M| of the others.
+
+	d = M[0]*(M[4]*M[8]-M[5]*M[7])-M[1]*(M[3]*M[8]-M[5]*M[6])+M[2]*(M[3]*M[7]-M[4]*M[6]);
+	w=fabs(d-1.0);
+
+	for(i=0; i<3; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			for(s=0.0,k=0; k<3; k++) s+=M[3*k+i]*M[3*k+j];
+			w=max(w,fabs(s-(i==j)));
+		}
+	}
+
+	if(!(w<=1e-6))
+	{
+		worst[0]++;
+		return;
+	}
+
+	for(s=0.0,i=0; i<n; i++)
+	{
+		for(j=0; j<3; j++)
+		{
+			for(e=c1[j]-y[3*i+j],k=0; k<3; k++) e+=M[3*j+k]*(x[3*i+k]-c0[k]);
+			s+=e*e;
+		}
+	}
+
+	worst[1]=max(worst[1],fabs(sqrt(s/n)-rmsd));
+}
+
+// ==================================================================
+// Entry point
+// ==================================================================
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 3,4,6,8,12 };
+	static const char *shapes[] = { "random","exact","plane","line" };
+	Superposition *S;
+	double x[3*12],y[3*12],M[9],c[6];
+	double t0,tOld,tNew,tRmsd,sink=0.0;
+	double rmsd,dr,old[2],new[2];
+	const double *P;
+	int i,k,n,r,shape,repeats=5,count=20000;
+
+	if(argc>2 && strcmp(argv[1],"-r")==0)
+	{
+		repeats=atoi(argv[2]);
+		argv+=2;
+		argc-=2;
+	}
+
+	if(argc>1) count=atoi(argv[1]);
+
+	if(argc>2 || count<1 || repeats<1)
+	{
+		fprintf(stderr,"usage: %s [-r repeats] [count]\n",argv[0]);
+		return 1;
+	}
+
+	S=Superposition_create();
+
+	printf("%i superpositions of each size, %i repeats (microseconds each)\n",count,repeats);
+	printf("%4s %10s %10s %10s\n","n","original","QCP","QCP rmsd");
+
+	for(k=0; k<sizeof(sizes)/sizeof(int); k++)
+	{
+		n=sizes[k];
+		tOld=tNew=tRmsd=0.0;
+
+		for(r=0; r<repeats; r++)
+		{
+			seed=88172645463325252UL+k;
+			t0=now();
+			for(i=0; i<count; i++)
+			{
+				make(x,y,n,0,0.5);
+				sink+=Old_superpose(x,y,n,M,c)+M[0];
+			}
+			tOld+=now()-t0;
+
+			seed=88172645463325252UL+k;
+			t0=now();
+			for(i=0; i<count; i++)
+			{
+				make(x,y,n,0,0.5);
+				Superposition_reset(S);
+				Superposition_alignAll(S,x,y,n);
+				sink+=Superposition_rmsd(S)+Superposition_rotation(S)[0];
+			}
+			tNew+=now()-t0;
+
+			seed=88172645463325252UL+k;
+			t0=now();
+			for(i=0; i<count; i++)
+			{
+				make(x,y,n,0,0.5);
+				Superposition_reset(S);
+				Superposition_alignAll(S,x,y,n);
+				sink+=Superposition_rmsd(S);
+			}
+			tRmsd+=now()-t0;
+		}
+
+		// (The time to make the sets is included in each.)
+
+		printf("%4i %10.3f %10.3f %10.3f\n",n,
+			1e6*tOld/count/repeats,1e6*tNew/count/repeats,1e6*tRmsd/count/repeats);
+	}
+
+	printf("\n%-7s %10s %10s %10s %10s %10s\n","sets","d(rmsd)","bad R","rmsd-R","bad R","rmsd-R");
+	printf("%-7s %10s %21s %21s\n","","","(original)","(QCP)");
+
+	for(shape=0; shape<4; shape++)
+	{
+		dr=0.0;
+		memset(old,0,sizeof(old));
+		memset(new,0,sizeof(new));
+		seed=88172645463325252UL;
+
+		for(i=0; i<count; i++)
+		{
+			n=sizes[i%(sizeof(sizes)/sizeof(int))];
+			make(x,y,n,shape==3 ? 2:shape==2 ? 1:0,shape==1 ? 0.0:0.5);
+
+			Superposition_reset(S);
+			Superposition_alignAll(S,x,y,n);
+			P=Superposition_rotation(S);
+
+			rmsd=Old_superpose(x,y,n,M,c);
+			if(rmsd==rmsd) dr=max(dr,fabs(rmsd-Superposition_rmsd(S)));
+
+			check(x,y,n,M,c,&c[3],rmsd,old);
+			check(x,y,n,P,Superposition_centroid(S,0),Superposition_centroid(S,1),Superposition_rmsd(S),new);
+		}
+
+		printf("%-7s %10.1e %10.0f %10.1e %10.0f %10.1e\n",shapes[shape],dr,old[0],old[1],new[0],new[1]);
+	}
+
+	Superposition_free(S);
+
+	return sink==0.123 ? 1:0;
+}
+
+// ==================================================================
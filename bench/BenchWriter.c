@@ -0,0 +1,239 @@
+// ==================================================================
+// BenchWriter.c
+// ==================================================================
+// Measures the throughput (MB/s and records/s) of writing hits with
+// a Writer, against that of the original writer (strncpy of the
+// names then one fprintf per ATOM record). Every atom of every
+// target in the list is written as an ATOM record of a hit, with a
+// REMARK and ENDMDL per target, to /dev/null. Both are first written
+// to memory and compared, to check the output is the same.
+//
+// Usage: BenchWriter [-r repeats] <target-list>
+// ==================================================================
+
+#include "Molecule.h"
+#include "Writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// ==================================================================
+// The original writer
+// ==================================================================
+
+static const char *atomFormat =
+	"ATOM  %5i%5s%c%-3s%c%c%4i%-4c%8.3f%8.3f%8.3f%6.2f%6.2f\n";
+
+static void Old_output(FILE *out, const Atom *A)
+{
+	const AtomInfo *I = A->info;
+	char name[5];
+	char resName[4];
+	int i;
+
+	strncpy(name,I->name,4);
+	strncpy(resName,I->resName,3);
+	name[4]=0;
+	resName[3]=0;
+	for(i=0; i<3; i++)
+	{
+		if(resName[i]=='_') resName[i]=' ';
+	}
+	for(i=0; i<4; i++)
+	{
+		if(name[i]=='_') name[i]=' ';
+	}
+
+	fprintf(
+		out,
+		atomFormat,
+		I->serial,
+		name,
+		I->altLoc,
+		resName,
+		A->chainID1,
+		A->chainID2,
+		A->resSeq,
+		I->iCode,
+		A->x[0],A->x[1],A->x[2],
+		I->occupancy,
+		I->tempFactor
+		);
+}
+
+static void Old_write(FILE *out, const Molecule *M)
+{
+	int k,n=Molecule_count(M);
+
+	fprintf(out,"REMARK %s ",Molecule_id(M) ? Molecule_id(M):"-");
+	fprintf(out,"%.3f ",0.5);
+	fprintf(out,"%s Det= %.1f log(E)~ %.2f\n","template",1.0,-2.5);
+	for(k=0; k<n; k++) Old_output(out,Molecule_atom(M,k));
+	fprintf(out,"ENDMDL\n\n");
+}
+
+// ==================================================================
+// The Writer (as in Main.c)
+// ==================================================================
+
+static void New_output(Writer *out, const Atom *A)
+{
+	const AtomInfo *I = A->info;
+	char name[5];
+	char resName[4];
+	int i;
+
+	for(i=0; i<4 && I->name[i]; i++) name[i] = I->name[i]=='_' ? ' ':I->name[i];
+	name[i]=0;
+	for(i=0; i<3 && I->resName[i]; i++) resName[i] = I->resName[i]=='_' ? ' ':I->resName[i];
+	resName[i]=0;
+
+	Writer_string(out,"ATOM  ");
+	Writer_integer(out,I->serial,5);
+	Writer_field(out,name,5,0);
+	Writer_character(out,I->altLoc);
+	Writer_field(out,resName,3,1);
+	Writer_character(out,A->chainID1);
+	Writer_character(out,A->chainID2);
+	Writer_integer(out,A->resSeq,4);
+	Writer_character(out,I->iCode);
+	Writer_string(out,"   ");
+	for(i=0; i<3; i++) Writer_fixed(out,A->x[i],8,3);
+	Writer_fixed(out,I->occupancy,6,2);
+	Writer_fixed(out,I->tempFactor,6,2);
+	Writer_character(out,'\n');
+}
+
+static void New_write(Writer *out, const Molecule *M)
+{
+	int k,n=Molecule_count(M);
+
+	Writer_string(out,"REMARK ");
+	Writer_string(out,Molecule_id(M) ? Molecule_id(M):"-");
+	Writer_character(out,' ');
+	Writer_fixed(out,0.5,0,3);
+	Writer_string(out," template Det= ");
+	Writer_fixed(out,1.0,0,1);
+	Writer_string(out," log(E)~ ");
+	Writer_fixed(out,-2.5,0,2);
+	Writer_character(out,'\n');
+	for(k=0; k<n; k++) New_output(out,Molecule_atom(M,k));
+	Writer_string(out,"ENDMDL\n\n");
+}
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static void report(const char *what, double t, double bytes, double records)
+{
+	printf("%-28s %8.3f s %8.1f MB/s %10.0f records/s\n",
+		what,t,t>0.0 ? bytes/t/1e6:0.0,t>0.0 ? records/t:0.0);
+}
+
+// ==================================================================
+// Entry point
+// ==================================================================
+
+int main(int argc, char **argv)
+{
+	FILE *list,*file,*null;
+	Molecule **M;
+	Writer *W;
+	char buf[0x200],*s,*a,*b;
+	size_t na,nb;
+	int k,n=0,size=16,r,repeats=5;
+	double records=0.0,t0,tOld,tNew;
+
+	if(argc>2 && strcmp(argv[1],"-r")==0)
+	{
+		repeats=atoi(argv[2]);
+		argv+=2;
+		argc-=2;
+	}
+
+	if(argc!=2)
+	{
+		fprintf(stderr,"usage: %s [-r repeats] <target-list>\n",argv[0]);
+		return 1;
+	}
+
+	if(!(list=fopen(argv[1],"r")) || !(null=fopen("/dev/null","w")))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	// Read the targets first, so only writing is timed.
+
+	M=(Molecule**)malloc(size*sizeof(Molecule*));
+	while(fgets(buf,sizeof(buf),list))
+	{
+		for(s=buf; isspace(*s); s++);
+		for(k=strlen(s); k>0 && isspace(s[k-1]); k--);
+		s[k]=0;
+		if(!*s || !(file=fopen(s,"r"))) continue;
+		if(n==size) M=(Molecule**)realloc(M,(size*=2)*sizeof(Molecule*));
+		if((M[n]=Molecule_create(file,0)))
+		{
+			records+=Molecule_count(M[n])+2;
+			n++;
+		}
+		fclose(file);
+	}
+	fclose(list);
+
+	// Check the output is the same.
+
+	a=NULL;
+	file=open_memstream(&a,&na);
+	for(k=0; k<n; k++) Old_write(file,M[k]);
+	fclose(file);
+
+	W=Writer_create(NULL);
+	for(k=0; k<n; k++) New_write(W,M[k]);
+	b=Writer_take(W,&nb);
+	Writer_free(W);
+
+	printf("%s: %i targets (%.1f MB of hits, %.0f records, %i repeats)\n",argv[1],n,na/1e6,records,repeats);
+	if(na!=nb || memcmp(a,b,na)) printf("OUTPUT DIFFERS\n");
+	free(a);
+	free(b);
+
+	tOld=tNew=0.0;
+	for(r=0; r<repeats; r++)
+	{
+		t0=now();
+		for(k=0; k<n; k++) Old_write(null,M[k]);
+		fflush(null);
+		tOld+=now()-t0;
+
+		t0=now();
+		W=Writer_create(null);
+		for(k=0; k<n; k++) New_write(W,M[k]);
+		Writer_free(W);
+		fflush(null);
+		tNew+=now()-t0;
+	}
+
+	report("original writer",tOld,(double)na*repeats,records*repeats);
+	report("Writer",tNew,(double)na*repeats,records*repeats);
+
+	for(k=0; k<n; k++) Molecule_free(M[k]);
+	free(M);
+	fclose(null);
+
+	return 0;
+}
+
+// ==================================================================
@@ -0,0 +1,353 @@
+// ==================================================================
+// Archive.c
+// ==================================================================
+// Implementation of type Archive.
+// ==================================================================
+
+#include "Archive.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ==================================================================
+// Forward declarations of local types
+// ==================================================================
+// Header				The start of an archive
+// Entry				The entry of a molecule in the index
+// ==================================================================
+
+typedef struct _Header Header;
+typedef struct _Entry Entry;
+
+// ==================================================================
+// Local type Header
+// ==================================================================
+// magic				ARCHIVE_MAGIC
+// version				ARCHIVE_VERSION
+// check				ARCHIVE_CHECK (as a test of the byte order)
+// count				Number of molecules
+// index				Offset of the index: count Entries, then the
+//						names of the molecules (each ending in a zero)
+// names				Size of the names (in bytes)
+// ==================================================================
+
+struct _Header
+{
+	char magic[8];
+	int version;
+	int check;
+	long count;
+	long index;
+	long names;
+};
+
+// ==================================================================
+// Local type Entry
+// ==================================================================
+// offset				Offset of the molecule (see Molecule_write)
+// size					Its size (in bytes)
+// name					Offset of its name among the names
+// ==================================================================
+
+struct _Entry
+{
+	long offset;
+	long size;
+	long name;
+};
+
+// ==================================================================
+// ARCHIVE_MAGIC		The first 8 bytes of an archive
+// ARCHIVE_VERSION		Version of the layout of an archive
+// ARCHIVE_CHECK		See Header
+// ARCHIVE_ALIGN		Each molecule starts at a multiple of this
+// ==================================================================
+
+#define ARCHIVE_MAGIC "JESSPACK"
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_CHECK 0x01020304
+#define ARCHIVE_ALIGN 64
+
+// ==================================================================
+// type Archive
+// ==================================================================
+// file					The file being written (NULL if reading)
+// filename				Its name
+// trees				Whether to write the trees of the molecules
+// data,size			The file (when reading, mapped into memory)
+// header				The header of the file
+// entry[k]				The entry of the kth molecule
+// names				The names of the molecules
+// room					Number of entries there is room for (writing)
+// space				Number of bytes of names there is room for
+// offset				Size of the file so far (writing)
+// ==================================================================
+
+struct _Archive
+{
+	FILE *file;
+	char *filename;
+	int trees;
+	char *data;
+	long size;
+	Header header;
+	Entry *entry;
+	char *names;
+	long room;
+	long space;
+	long offset;
+};
+
+// ==================================================================
+// Private methods of type Archive
+// ==================================================================
+// pad(A,n)				Write zeros up to the next multiple of n bytes
+// bad(A)				Whether the archive being read is corrupt (if
+//						not, this sets up entry and names)
+// ==================================================================
+
+static int Archive_pad(Archive*,long);
+static int Archive_bad(Archive*);
+
+// ==================================================================
+// Methods of type Archive
+// ==================================================================
+
+Archive *Archive_create(const char *filename, int trees)
+{
+	Archive *A;
+
+	A = (Archive*)calloc(1,sizeof(Archive));
+	A->filename=strdup(filename);
+	A->trees=trees;
+
+	// Leave room for the header, which is written last
+	// when the index is in place.
+
+	if(!(A->file=fopen(filename,"wb"))
+		|| fwrite(&A->header,sizeof(Header),1,A->file)!=1)
+	{
+		perror(filename);
+		if(A->file) fclose(A->file);
+		free(A->filename);
+		free(A);
+		return NULL;
+	}
+
+	A->offset=sizeof(Header);
+
+	return A;
+}
+
+int Archive_add(Archive *A, const char *name, const Molecule *M)
+{
+	Entry *E;
+	long n,size;
+
+	if(!Archive_pad(A,ARCHIVE_ALIGN)) return 0;
+	if((size=Molecule_write(M,A->file,A->trees))<0) return 0;
+
+	if(A->header.count==A->room)
+	{
+		A->room = A->room ? 2*A->room:256;
+		A->entry=(Entry*)realloc(A->entry,A->room*sizeof(Entry));
+	}
+
+	n=strlen(name)+1;
+	if(A->header.names+n>A->space)
+	{
+		for(A->space = A->space ? A->space:0x1000; A->header.names+n>A->space; A->space*=2);
+		A->names=(char*)realloc(A->names,A->space);
+	}
+
+	E=&A->entry[A->header.count++];
+	E->offset=A->offset;
+	E->size=size;
+	E->name=A->header.names;
+
+	memcpy(&A->names[A->header.names],name,n);
+	A->header.names+=n;
+	A->offset+=size;
+
+	return 1;
+}
+
+int Archive_check(FILE *file)
+{
+	struct stat st;
+	char magic[8];
+	int is;
+
+	// Only a regular file can be an archive (and only such
+	// a file can be read again from the start).
+
+	if(fstat(fileno(file),&st) || !S_ISREG(st.st_mode)) return 0;
+
+	is = fread(magic,1,8,file)==8 && memcmp(magic,ARCHIVE_MAGIC,8)==0;
+	rewind(file);
+
+	return is;
+}
+
+Archive *Archive_open(const char *filename)
+{
+	Archive *A;
+	struct stat st;
+	char *data;
+	int fd;
+
+	if((fd=open(filename,O_RDONLY))<0) return NULL;
+
+	// Map the whole file (shared, so that the pages are
+	// those of the page cache) if it is an archive.
+
+	data=MAP_FAILED;
+	if(fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size>=sizeof(Header))
+	{
+		data=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	}
+	close(fd);
+
+	if(data==MAP_FAILED) return NULL;
+
+	if(memcmp(data,ARCHIVE_MAGIC,8))
+	{
+		munmap(data,st.st_size);
+		return NULL;
+	}
+
+	A = (Archive*)calloc(1,sizeof(Archive));
+	A->filename=strdup(filename);
+	A->data=data;
+	A->size=st.st_size;
+	memcpy(&A->header,data,sizeof(Header));
+
+	if(A->header.version!=ARCHIVE_VERSION || A->header.check!=ARCHIVE_CHECK)
+	{
+		fprintf(stderr,"%s: archive written by another build of Jess\n",filename);
+		exit(1);
+	}
+
+	if(Archive_bad(A))
+	{
+		fprintf(stderr,"%s: corrupt archive\n",filename);
+		exit(1);
+	}
+
+	return A;
+}
+
+int Archive_close(Archive *A)
+{
+	int ok=1;
+
+	if(!A) return 1;
+
+	if(A->file)
+	{
+		// Write the index and names, then the header.
+
+		memcpy(A->header.magic,ARCHIVE_MAGIC,8);
+		A->header.version=ARCHIVE_VERSION;
+		A->header.check=ARCHIVE_CHECK;
+
+		ok = Archive_pad(A,8);
+		A->header.index=A->offset;
+
+		ok = ok
+			&& fwrite(A->entry,sizeof(Entry),A->header.count,A->file)==A->header.count
+			&& fwrite(A->names,1,A->header.names,A->file)==A->header.names
+			&& fseek(A->file,0,SEEK_SET)==0
+			&& fwrite(&A->header,sizeof(Header),1,A->file)==1;
+
+		if(fclose(A->file)) ok=0;
+		if(!ok) perror(A->filename);
+
+		free(A->entry);
+		free(A->names);
+	}
+	else munmap(A->data,A->size);
+
+	free(A->filename);
+	free(A);
+
+	return ok;
+}
+
+long Archive_count(const Archive *A)
+{
+	return A->header.count;
+}
+
+const char *Archive_name(const Archive *A, long k)
+{
+	return &A->names[A->entry[k].name];
+}
+
+long Archive_size(const Archive *A, long k)
+{
+	return A->entry[k].size;
+}
+
+Molecule *Archive_molecule(const Archive *A, long k)
+{
+	const Entry *E = &A->entry[k];
+	long page = sysconf(_SC_PAGESIZE);
+	long a = E->offset-E->offset%page;
+
+	// Ask for all of the molecule to be read in at once
+	// (rather than a page at a time as it is touched).
+
+	madvise(&A->data[a],E->offset+E->size-a,MADV_WILLNEED);
+
+	return Molecule_map(&A->data[E->offset],E->size);
+}
+
+// ==================================================================
+// Private methods of type Archive
+// ==================================================================
+
+static int Archive_pad(Archive *A, long n)
+{
+	static const char zero[ARCHIVE_ALIGN];
+	long m = (n-A->offset%n)%n;
+
+	if(fwrite(zero,1,m,A->file)!=m) return 0;
+	A->offset+=m;
+	return 1;
+}
+
+static int Archive_bad(Archive *A)
+{
+	const Header *H = &A->header;
+	const Entry *E;
+	long k;
+
+	// The index and names must fit after the molecules, the
+	// names must end in a zero and each molecule must lie
+	// (aligned) between the header and the index. Once that
+	// is known, point A at them.
+
+	if(H->count<0 || H->names<0 || H->index<sizeof(Header) || H->index%8 || H->index>A->size) return 1;
+	if(H->count>(A->size-H->index)/sizeof(Entry)) return 1;
+	if(H->names>A->size-H->index-H->count*sizeof(Entry)) return 1;
+
+	A->entry=(Entry*)&A->data[H->index];
+	A->names=&A->data[H->index+H->count*sizeof(Entry)];
+
+	if(H->names>0 && A->names[H->names-1]) return 1;
+
+	for(k=0; k<H->count; k++)
+	{
+		E=&A->entry[k];
+		if(E->offset<sizeof(Header) || E->offset%8 || E->size<0) return 1;
+		if(E->size>H->index-E->offset || E->name<0 || E->name>=H->names) return 1;
+	}
+
+	return 0;
+}
+
+// ==================================================================
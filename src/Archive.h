@@ -0,0 +1,59 @@
+// ==================================================================
+// Archive.h
+// ==================================================================
+// Declaration of type Archive and its methods (a file of molecules
+// read once and kept as they are held in memory).
+// ==================================================================
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "Molecule.h"
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Archive				An archive being written or searched
+// ==================================================================
+
+typedef struct _Archive Archive;
+
+// ==================================================================
+// Methods of type Archive
+// ==================================================================
+// create(f,t)			Begin writing the archive f (with the tree of
+//						each molecule if t)
+// add(A,s,M)			Add molecule M to A, named s; true=>success
+// check(f)				Whether the open file f is an archive (reading
+//						its first bytes, then going back to the start,
+//						if it is a regular file)
+// open(f)				Open the archive f to read it (NULL if f is not
+//						an archive)
+// close(A)				Finish writing A, or reading it, and free A;
+//						true=>success
+// count(A)				Number of molecules in A
+// name(A,k)			Name of the kth molecule
+// size(A,k)			Size of the kth molecule in the file (in bytes)
+// molecule(A,k)		Create the kth molecule (see Molecule_map)
+// ==================================================================
+// An archive is mapped into memory (shared, read-only) when opened,
+// so that every process reading the same archive shares one copy of
+// it in the page cache, and molecule() reads nothing but the index:
+// see Molecule_map. A molecule must be freed before A is closed.
+// An archive is only read by builds of Jess with the same byte order
+// as the one that wrote it; open() gives up on any other.
+// ==================================================================
+
+extern Archive *Archive_create(const char*,int);
+extern int Archive_add(Archive*,const char*,const Molecule*);
+extern int Archive_check(FILE*);
+extern Archive *Archive_open(const char*);
+extern int Archive_close(Archive*);
+extern long Archive_count(const Archive*);
+extern const char *Archive_name(const Archive*,long);
+extern long Archive_size(const Archive*,long);
+extern Molecule *Archive_molecule(const Archive*,long);
+
+// ==================================================================
+
+#endif
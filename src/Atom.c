@@ -9,67 +9,257 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
+
+// ==================================================================
+// Ids of the main-chain atom names (see Atom_id)
+// ==================================================================
+
+#define NAME_ID(a,b,c,d) ((a)|(b)<<8|(c)<<16|(unsigned int)(d)<<24)
+
+static const unsigned int idCA = NAME_ID('_','C','A','_');
+static const unsigned int idN = NAME_ID('_','N','_','_');
+static const unsigned int idO = NAME_ID('_','O','_','_');
 
 // ==================================================================
 // Methods of type Atom
 // ==================================================================
 
-static void Atom_copyToken(char *d,const char *s,int n)
+static void Atom_copyToken(char *d,const char *s,int n,int m)
 {
 	int i;
 
 	// Copy string from s to d replacing blanks by the
-	// underscore where appropriate.
+	// underscore where appropriate. Only m chars of s
+	// are there to be read.
+
+	for(i=0; i<n && i<m && s[i]; i++) d[i]=isspace(s[i]) ? '_':s[i];
+	for(; i<=n; i++) d[i]=0;
+}
+
+static void Atom_copyField(char *d,int n,const char *s,int m,int pad)
+{
+	int i,j;
+
+	// Fill the n-char field d with the m chars of s after
+	// pad blanks, then blanks, all blanks as underscores.
 
-	strncpy(d,s,n);
-	d[n]=0;
 	for(i=0; i<n; i++)
 	{
-		if(isspace(d[i])) d[i]='_';
+		j=i-pad;
+		d[i] = j<0 || j>=m || isspace(s[j]) ? '_':s[j];
 	}
+	d[n]=0;
+}
+
+static int Atom_int(const char *s, int n)
+{
+	int i=0,x=0,sign=1;
+
+	// As atoi() but reading no more than n chars.
+
+	while(i<n && isspace(s[i])) i++;
+	if(i<n && (s[i]=='-' || s[i]=='+')) sign = s[i++]=='-' ? -1:1;
+	while(i<n && isdigit(s[i])) x = 10*x+(s[i++]-'0');
+
+	return sign*x;
 }
 
-int Atom_parse(Atom *A, const char *s)
+static double Atom_real(const char *s, int n)
 {
-	int n;
+	static const double scale[16] =
+	{
+		1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,
+		1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15
+	};
+	char buf[0x100];
+	long long m=0;
+	int i=0,digits=0,places=0;
+	int negative=0;
 
+	// As atof() but reading no more than n chars. Fields such
+	// as " -12.345" are read by hand: the digits make an exact
+	// integer which is divided by an exact power of ten, and
+	// that (being rounded once) is exactly what atof() gives.
+	// Anything else is handed to atof() itself.
+
+	while(i<n && isspace(s[i])) i++;
+	if(i<n && (s[i]=='-' || s[i]=='+')) negative = s[i++]=='-';
+	for(; i<n && isdigit(s[i]); i++, digits++)
+	{
+		if(digits<18) m = 10*m+(s[i]-'0');
+	}
+
+	if(i<n && s[i]=='.')
+	{
+		for(i++; i<n && isdigit(s[i]); i++, places++, digits++)
+		{
+			if(digits<18) m = 10*m+(s[i]-'0');
+		}
+	}
+
+	if(digits>0 && digits<=15 && (i>=n || (s[i]!='e' && s[i]!='E')))
+	{
+		return negative ? -(m/scale[places]):m/scale[places];
+	}
+
+	if(i>=n && digits==0) return 0.0;
+
+	if(n>0xff) n=0xff;
+	memcpy(buf,s,n);
+	buf[n]=0;
+
+	return atof(buf);
+}
+
+int Atom_parse(Atom *A, AtomInfo *I, const char *s)
+{
+	return Atom_read(A,I,s,strlen(s));
+}
+
+int Atom_read(Atom *A, AtomInfo *I, const char *s, int n)
+{
 	// Check the record type...
 
-	if(strncmp(s,"ATOM",4) && strncmp(s,"HETATM",6)!=0)
+	if(n<4 || (strncmp(s,"ATOM",4) && (n<6 || strncmp(s,"HETATM",6)!=0)))
 	{
 		return 0;
 	}
 
-	// Get string length and zero the atom structure
+	// Zero the atom structures
 
-	n = strlen(s);
 	memset(A,0,sizeof(Atom));
+	memset(I,0,sizeof(AtomInfo));
+	A->info=I;
 
 	// Get the extant fields...
 
-	if(n>6)  A->serial = atoi(&s[6]); else return 1;
-	if(n>12) Atom_copyToken(A->name,&s[12],4); else return 1;
-	if(n>16) A->altLoc = s[16]; else return 1;
-	if(n>17) Atom_copyToken(A->resName,&s[17],3); else return 1;
+	if(n>6)  I->serial = Atom_int(&s[6],n-6); else return 1;
+	if(n>12) Atom_copyToken(I->name,&s[12],4,n-12); else return 1;
+	A->name = Atom_id(I->name,4);
+	A->flags = Atom_flags(A->name);
+	if(n>16) I->altLoc = s[16]; else return 1;
+	if(n>17) Atom_copyToken(I->resName,&s[17],3,n-17); else return 1;
+	A->resName = Atom_id(I->resName,3);
 	//Riziotis edit
 	if(n>20) A->chainID1 = s[20]; else return 1;
 	if(n>21) A->chainID2 = isspace(s[21]) ? '0':s[21]; else return 1;
 	//if(n>21) A->chainID = isspace(s[21]) ? '0':s[21]; else return 1;
-	if(n>22) A->resSeq = atoi(&s[22]); else return 1;
-	if(n>26) A->iCode = s[26]; else return 1;
-	if(n>30) A->x[0] = atof(&s[30]); else return 1;
-	if(n>38) A->x[1] = atof(&s[38]); else return 1;
-	if(n>46) A->x[2] = atof(&s[46]); else return 1;
-	if(n>54) A->occupancy = atof(&s[54]); else return 1;
-	if(n>60) A->tempFactor = atof(&s[60]); else return 1;
-	if(n>72) Atom_copyToken(A->segID,&s[72],4); else return 1;
-	if(n>76) Atom_copyToken(A->element,&s[76],2); else return 1;
-	if(n>78) A->charge = atoi(&s[78]); else return 1;
+	if(n>22) A->resSeq = Atom_int(&s[22],n-22); else return 1;
+	if(n>26) I->iCode = s[26]; else return 1;
+	if(n>30) A->x[0] = Atom_real(&s[30],n-30); else return 1;
+	if(n>38) A->x[1] = Atom_real(&s[38],n-38); else return 1;
+	if(n>46) A->x[2] = Atom_real(&s[46],n-46); else return 1;
+	if(n>54) I->occupancy = Atom_real(&s[54],n-54); else return 1;
+	if(n>60) I->tempFactor = Atom_real(&s[60],n-60); else return 1;
+	if(n>72) Atom_copyToken(I->segID,&s[72],4,n-72); else return 1;
+	if(n>76) Atom_copyToken(I->element,&s[76],2,n-76); else return 1;
+	if(n>78) I->charge = Atom_int(&s[78],n-78); else return 1;
 
 	// All's well :-)
 
 	return 1;
 }
 
-// ==================================================================
+int Atom_readSite(Atom *A, AtomInfo *I, const char *const *v, const int *n)
+{
+	const char *s;
+	int m,f;
+
+	// Check the record type...
 
+	m=n[ATOM_SITE_GROUP];
+	s=v[ATOM_SITE_GROUP];
+	if(m>0 && !(m==4 && strncmp(s,"ATOM",4)==0) && !(m==6 && strncmp(s,"HETATM",6)==0))
+	{
+		return 0;
+	}
+
+	memset(A,0,sizeof(Atom));
+	memset(I,0,sizeof(AtomInfo));
+	A->info=I;
+
+	I->serial = Atom_int(v[ATOM_SITE_ID],n[ATOM_SITE_ID]);
+
+	// The element is right justified. So is the atom name,
+	// by one blank, unless it is 4 chars long or begins
+	// with a 2-char element symbol (as does CA for calcium).
+
+	m=n[ATOM_SITE_TYPE];
+	Atom_copyField(I->element,2,v[ATOM_SITE_TYPE],m>2 ? 2:m,m<2 ? 2-m:0);
+
+	f = n[ATOM_SITE_NAME]>0 ? ATOM_SITE_NAME:ATOM_SITE_LABEL_NAME;
+	m=n[f];
+	s=v[f];
+	Atom_copyField(I->name,4,s,m,m<4 && !(n[ATOM_SITE_TYPE]==2 && m>=2 && strncasecmp(s,v[ATOM_SITE_TYPE],2)==0));
+	A->name = Atom_id(I->name,4);
+	A->flags = Atom_flags(A->name);
+
+	I->altLoc = n[ATOM_SITE_ALT]>0 ? v[ATOM_SITE_ALT][0]:' ';
+
+	f = n[ATOM_SITE_RES]>0 ? ATOM_SITE_RES:ATOM_SITE_LABEL_RES;
+	m=n[f];
+	Atom_copyField(I->resName,3,v[f],m,m<3 ? 3-m:0);
+	A->resName = Atom_id(I->resName,3);
+
+	// A chain of one char is the PDB chain (column 22) and
+	// one of two fills columns 21 and 22. Any more are lost.
+
+	f = n[ATOM_SITE_CHAIN]>0 ? ATOM_SITE_CHAIN:ATOM_SITE_LABEL_CHAIN;
+	m=n[f];
+	s=v[f];
+	A->chainID1 = m>1 ? s[0]:' ';
+	A->chainID2 = m>1 ? s[1]:m>0 ? s[0]:'0';
+
+	f = n[ATOM_SITE_SEQ]>0 ? ATOM_SITE_SEQ:ATOM_SITE_LABEL_SEQ;
+	A->resSeq = Atom_int(v[f],n[f]);
+	I->iCode = n[ATOM_SITE_ICODE]>0 ? v[ATOM_SITE_ICODE][0]:' ';
+
+	A->x[0] = Atom_real(v[ATOM_SITE_X],n[ATOM_SITE_X]);
+	A->x[1] = Atom_real(v[ATOM_SITE_Y],n[ATOM_SITE_Y]);
+	A->x[2] = Atom_real(v[ATOM_SITE_Z],n[ATOM_SITE_Z]);
+	I->occupancy = Atom_real(v[ATOM_SITE_OCC],n[ATOM_SITE_OCC]);
+	I->tempFactor = Atom_real(v[ATOM_SITE_B],n[ATOM_SITE_B]);
+	I->charge = Atom_int(v[ATOM_SITE_CHARGE],n[ATOM_SITE_CHARGE]);
+
+	return 1;
+}
+
+unsigned int Atom_id(const char *s, int n)
+{
+	unsigned int id=0;
+	int i;
+
+	for(i=0; i<n && s[i]; i++)
+	{
+		id |= (unsigned int)(unsigned char)toupper(s[i])<<(8*i);
+	}
+
+	return id;
+}
+
+char Atom_char(unsigned int id, int i)
+{
+	return (char)(id>>(8*i)&0xff);
+}
+
+unsigned char Atom_flags(unsigned int id)
+{
+	unsigned char flags=0;
+
+	if(Atom_char(id,0)=='_')
+	{
+		flags |= ATOM_BLANK;
+		if(Atom_char(id,1)=='C') flags |= ATOM_CARBON;
+		if(Atom_char(id,1)=='H') flags |= ATOM_HYDROGEN;
+	}
+
+	if(id==idCA || id==idN || id==idO)
+	{
+		flags |= ATOM_MAINCHAIN;
+	}
+
+	return flags;
+}
+
+// ==================================================================
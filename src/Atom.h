@@ -11,34 +11,118 @@
 // ==================================================================
 // Forward declarations
 // ==================================================================
-// Atom					A PDB ATOM record
+// Atom					The fields of a PDB ATOM record used in a search
+// AtomInfo				The rest of the record (only used for output)
 // ==================================================================
 
 typedef struct _Atom Atom;
+typedef struct _AtomInfo AtomInfo;
 
 // ==================================================================
 // type Atom
 // ==================================================================
-// The fields correspond more or less exactly to those found in the
-// PDB ATOM record spec. Notable exceptions are the chainID field
-// which is set to '0' if it is blank (cf CATH) and the coordinate
-// fields which are merged into an array Atom::x[3]. Finally, all
-// text fields have blanks replaced by underscores.
+// x[3]					The coordinates
+// info					The rest of the record
+// name					Id of the atom name (see Atom_id())
+// resName				Id of the residue name
+// chainID1,chainID2	The chain fields (chainID2 is '0' if blank)
+// resSeq				The residue sequence number
+// flags				The classes the atom falls in (see below)
+// ==================================================================
+// Searches match and compare atoms on these fields alone, which are
+// kept in a small record of their own so that a molecule's atoms are
+// packed close together in memory.
 // ==================================================================
 
 struct _Atom
 {
-	int serial;
-	char name[5];
-	char altLoc;
-	char resName[4];
+	double x[3];
+	const AtomInfo *info;
+	unsigned int name;
+	unsigned int resName;
+	int resSeq;
 	//Riziotis edit
 	char chainID1;
 	char chainID2;
 	//char chainID;
-	int resSeq;
+	unsigned char flags;
+};
+
+// ==================================================================
+// Atom classes (Atom::flags)
+// ==================================================================
+// ATOM_BLANK			The name starts with a blank (underscore)
+// ATOM_CARBON			A carbon (the name starts with _C)
+// ATOM_HYDROGEN		A hydrogen (the name starts with _H)
+// ATOM_MAINCHAIN		A main-chain atom (CA, N or O)
+// ==================================================================
+
+#define ATOM_BLANK 1
+#define ATOM_CARBON 2
+#define ATOM_HYDROGEN 4
+#define ATOM_MAINCHAIN 8
+
+// ==================================================================
+// Fields of an mmCIF _atom_site row (see Atom_readSite)
+// ==================================================================
+// ATOM_SITE_GROUP		group_PDB (ATOM or HETATM)
+// ATOM_SITE_ID			id (the serial number)
+// ATOM_SITE_TYPE		type_symbol (the element)
+// ATOM_SITE_NAME		auth_atom_id, or failing that...
+// ATOM_SITE_LABEL_NAME	...label_atom_id
+// ATOM_SITE_ALT		label_alt_id
+// ATOM_SITE_RES		auth_comp_id, or failing that...
+// ATOM_SITE_LABEL_RES	...label_comp_id
+// ATOM_SITE_CHAIN		auth_asym_id, or failing that...
+// ATOM_SITE_LABEL_CHAIN	...label_asym_id
+// ATOM_SITE_SEQ		auth_seq_id, or failing that...
+// ATOM_SITE_LABEL_SEQ	...label_seq_id
+// ATOM_SITE_ICODE		pdbx_PDB_ins_code
+// ATOM_SITE_X,_Y,_Z	Cartn_x, Cartn_y and Cartn_z
+// ATOM_SITE_OCC		occupancy
+// ATOM_SITE_B			B_iso_or_equiv
+// ATOM_SITE_CHARGE		pdbx_formal_charge
+// ATOM_SITE_MODEL		pdbx_PDB_model_num
+// ATOM_SITE_FIELDS		Number of the above
+// ==================================================================
+
+#define ATOM_SITE_GROUP 0
+#define ATOM_SITE_ID 1
+#define ATOM_SITE_TYPE 2
+#define ATOM_SITE_NAME 3
+#define ATOM_SITE_LABEL_NAME 4
+#define ATOM_SITE_ALT 5
+#define ATOM_SITE_RES 6
+#define ATOM_SITE_LABEL_RES 7
+#define ATOM_SITE_CHAIN 8
+#define ATOM_SITE_LABEL_CHAIN 9
+#define ATOM_SITE_SEQ 10
+#define ATOM_SITE_LABEL_SEQ 11
+#define ATOM_SITE_ICODE 12
+#define ATOM_SITE_X 13
+#define ATOM_SITE_Y 14
+#define ATOM_SITE_Z 15
+#define ATOM_SITE_OCC 16
+#define ATOM_SITE_B 17
+#define ATOM_SITE_CHARGE 18
+#define ATOM_SITE_MODEL 19
+#define ATOM_SITE_FIELDS 20
+
+// ==================================================================
+// type AtomInfo
+// ==================================================================
+// The fields correspond more or less exactly to those found in the
+// PDB ATOM record spec. All text fields have blanks replaced by
+// underscores.
+// ==================================================================
+
+struct _AtomInfo
+{
+	int serial;
+	char name[5];
+	char altLoc;
+	char resName[4];
 	char iCode;
-	double x[3];
 	double occupancy;
 	double tempFactor;
 	char segID[4];
@@ -49,13 +133,32 @@ struct _Atom
 // ==================================================================
 // Methods of type Atom
 // ==================================================================
-// parse(A,s)			Parse string s as a PDB ATOM; true=>success
+// parse(A,I,s)			Parse string s as a PDB ATOM; true=>success
+// read(A,I,s,n)		As parse() but s is the n chars s[0..n-1]
+// readSite(A,I,v,n)	Read an mmCIF _atom_site row whose fields (see
+//						above) are v[f][0..n[f]-1]; true=>success
+// id(s,n)				Id of the name in s[0],...,s[n-1] (n<=4)
+// char(id,i)			ith character of the name with the given id
+// flags(id)			Classes (ATOM_*) of an atom with the given name id
+// ==================================================================
+// readSite() fills in the same fields that parse() would from the
+// equivalent PDB record, so that names are aligned as in a PDB file
+// (" CA " for an alpha carbon, "CA  " for calcium). Fields of the row
+// which are missing or null ('.' or '?') have n[f]==0.
+// ==================================================================
+// The id of a name is its characters, upper cased, packed into an
+// int; so ids are equal just when names are equal but for case, and
+// are the same in every molecule and template without need of any
+// table of names.
 // ==================================================================
 
-extern int Atom_parse(Atom*,const char*);
+extern int Atom_parse(Atom*,AtomInfo*,const char*);
+extern int Atom_read(Atom*,AtomInfo*,const char*,int);
+extern int Atom_readSite(Atom*,AtomInfo*,const char *const*,const int*);
+extern unsigned int Atom_id(const char*,int);
+extern char Atom_char(unsigned int,int);
+extern unsigned char Atom_flags(unsigned int);
 
 // ==================================================================
 
 #endif
-
-
@@ -0,0 +1,692 @@
+// ==================================================================
+// BinaryCif.c
+// ==================================================================
+// Implementation of types BinaryCif and BinaryCifColumn.
+// ==================================================================
+
+#include "BinaryCif.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ==================================================================
+// Forward declarations of local types
+// ==================================================================
+// Pack					A MessagePack value
+// Array				A column part way through being decoded
+// ==================================================================
+
+typedef struct _Pack Pack;
+typedef struct _Array Array;
+
+// ==================================================================
+// Local type Pack
+// ==================================================================
+// type					One of the PACK_* below
+// number				Value of a PACK_INT or PACK_REAL
+// data					Bytes of a PACK_STR or PACK_BIN, or first item
+//						of a PACK_ARRAY or PACK_MAP
+// size					Number of bytes, items or key-value pairs
+// end					End of the file the value lies in
+// ==================================================================
+
+struct _Pack
+{
+	int type;
+	double number;
+	const unsigned char *data;
+	unsigned int size;
+	const unsigned char *end;
+};
+
+#define PACK_NIL 0
+#define PACK_BOOL 1
+#define PACK_INT 2
+#define PACK_REAL 3
+#define PACK_STR 4
+#define PACK_BIN 5
+#define PACK_ARRAY 6
+#define PACK_MAP 7
+#define PACK_EXT 8
+
+// ==================================================================
+// Local type Array
+// ==================================================================
+// type					ARRAY_BYTES, ARRAY_INT or ARRAY_REAL
+// count				Number of values
+// byte					The bytes (which lie in the file)
+// i[k],r[k]			The values
+// ==================================================================
+
+struct _Array
+{
+	int type;
+	int count;
+	const unsigned char *byte;
+	int *i;
+	double *r;
+};
+
+#define ARRAY_BYTES 0
+#define ARRAY_INT 1
+#define ARRAY_REAL 2
+
+// ==================================================================
+// type BinaryCif
+// ==================================================================
+// rows					Number of rows in the category
+// id					Header of the data block
+// columns				The columns of the category (a PACK_ARRAY)
+// ==================================================================
+
+struct _BinaryCif
+{
+	int rows;
+	char id[0x20];
+	Pack columns;
+};
+
+// ==================================================================
+// Declaration of methods of local types
+// ==================================================================
+// Pack_read(p,e,v)		Read the value at p (<e) into v; returns the
+//						end of v, or its first item if it is a
+//						container (NULL if it runs past e)
+// Pack_skip(p,e)		Returns the end of the value at p
+// Pack_get(m,k,v)		Read the value of key k in map m into v
+// Pack_is(v,s)			Whether v is the string s
+// Pack_number(m,k,x)	The number under key k in map m (x if none)
+// Pack_count(m,k,x,n)	As Pack_number() but an integer in 0..n (or -1)
+// Array_decode(A,d,e)	Decode A by the encodings e (a PACK_ARRAY)
+//						of the data d (a PACK_BIN)
+// Array_free(A)		Free the values of A
+// ==================================================================
+
+static const unsigned char *Pack_read(const unsigned char*,const unsigned char*,Pack*);
+static const unsigned char *Pack_skip(const unsigned char*,const unsigned char*);
+static int Pack_get(const Pack*,const char*,Pack*);
+static int Pack_is(const Pack*,const char*);
+static double Pack_number(const Pack*,const char*,double);
+static int Pack_count(const Pack*,const char*,int,int);
+static int Array_decode(Array*,const Pack*,const Pack*);
+static void Array_free(Array*);
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static unsigned long long bigEndian(const unsigned char *p, int n)
+{
+	unsigned long long x=0;
+	int i;
+
+	for(i=0; i<n; i++) x = x<<8|p[i];
+	return x;
+}
+
+static unsigned long long littleEndian(const unsigned char *p, int n)
+{
+	unsigned long long x=0;
+	int i;
+
+	for(i=n-1; i>=0; i--) x = x<<8|p[i];
+	return x;
+}
+
+// ==================================================================
+// Methods of local type Pack
+// ==================================================================
+
+static const unsigned char *Pack_read(const unsigned char *p, const unsigned char *end, Pack *v)
+{
+	static const unsigned char extSize[5] = { 1,2,4,8,16 };
+	unsigned int c;
+	int n=0;
+	float f;
+	double d;
+	unsigned long long u;
+
+	memset(v,0,sizeof(Pack));
+	v->end=end;
+
+	if(!p || p>=end) return NULL;
+	c = *p++;
+
+	// Work out the type of the value, and how many bytes
+	// follow its first to give its size (n)...
+
+	if(c<=0x7f) { v->type=PACK_INT; v->number=c; return p; }
+	if(c>=0xe0) { v->type=PACK_INT; v->number=(int)c-0x100; return p; }
+	if(c>=0xa0 && c<=0xbf) { v->type=PACK_STR; v->size=c&0x1f; }
+	else if(c>=0x90 && c<=0x9f) { v->type=PACK_ARRAY; v->size=c&0x0f; }
+	else if(c>=0x80 && c<=0x8f) { v->type=PACK_MAP; v->size=c&0x0f; }
+	else switch(c)
+	{
+		case 0xc0: v->type=PACK_NIL; return p;
+		case 0xc2: case 0xc3: v->type=PACK_BOOL; v->number=c-0xc2; return p;
+		case 0xc4: case 0xc5: case 0xc6: v->type=PACK_BIN; n=1<<(c-0xc4); break;
+		case 0xc7: case 0xc8: case 0xc9: v->type=PACK_EXT; n=1<<(c-0xc7); break;
+		case 0xca: case 0xcb: v->type=PACK_REAL; n=c==0xca ? 4:8; break;
+		case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		case 0xd0: case 0xd1: case 0xd2: case 0xd3: v->type=PACK_INT; n=1<<(c&3); break;
+		case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8: v->type=PACK_EXT; v->size=extSize[c-0xd4]; break;
+		case 0xd9: case 0xda: case 0xdb: v->type=PACK_STR; n=1<<(c-0xd9); break;
+		case 0xdc: case 0xdd: v->type=PACK_ARRAY; n=2<<(c-0xdc); break;
+		case 0xde: case 0xdf: v->type=PACK_MAP; n=2<<(c-0xde); break;
+		default: return NULL;
+	}
+
+	if(end-p<n) return NULL;
+
+	// ...then read it.
+
+	if(v->type==PACK_INT || v->type==PACK_REAL)
+	{
+		u = bigEndian(p,n);
+		p+=n;
+
+		if(c==0xca)
+		{
+			unsigned int w=(unsigned int)u;
+			memcpy(&f,&w,4);
+			v->number=f;
+		}
+		else if(c==0xcb)
+		{
+			memcpy(&d,&u,8);
+			v->number=d;
+		}
+		else if(c>=0xd0)
+		{
+			// Sign extend n bytes
+			v->number = n<8 ? (double)((long long)(u<<(64-8*n))>>(64-8*n)):(double)(long long)u;
+		}
+		else
+		{
+			v->number=(double)u;
+		}
+
+		return p;
+	}
+
+	if(n>0)
+	{
+		v->size=(unsigned int)bigEndian(p,n);
+		p+=n;
+	}
+
+	if(v->type==PACK_EXT) v->size++;
+	v->data=p;
+
+	if(v->type==PACK_ARRAY || v->type==PACK_MAP) return p;
+	if((unsigned long)(end-p)<v->size) return NULL;
+
+	return p+v->size;
+}
+
+static const unsigned char *Pack_skip(const unsigned char *p, const unsigned char *end)
+{
+	Pack v;
+	unsigned long n=1;
+
+	// Skip values until none are left, counting in the items
+	// of each container as it is read rather than recursing
+	// into it, so that however deeply a (bad) file nests them
+	// the stack does not grow. Every item takes a byte, so a
+	// count beyond the data runs past its end.
+
+	while(n>0 && p)
+	{
+		p=Pack_read(p,end,&v);
+		n--;
+		if(p && v.type==PACK_ARRAY) n+=v.size;
+		if(p && v.type==PACK_MAP) n+=2*(unsigned long)v.size;
+	}
+
+	return p;
+}
+
+static int Pack_get(const Pack *map, const char *key, Pack *v)
+{
+	const unsigned char *p;
+	Pack k;
+	unsigned int i;
+
+	if(map->type!=PACK_MAP) return 0;
+
+	for(p=map->data, i=0; i<map->size && p; i++)
+	{
+		p=Pack_read(p,map->end,&k);
+		if(Pack_is(&k,key)) return Pack_read(p,map->end,v)!=NULL;
+		p=Pack_skip(p,map->end);
+	}
+
+	return 0;
+}
+
+static int Pack_is(const Pack *v, const char *s)
+{
+	return v->type==PACK_STR && strlen(s)==v->size && memcmp(v->data,s,v->size)==0;
+}
+
+static double Pack_number(const Pack *map, const char *key, double x)
+{
+	Pack v;
+
+	if(Pack_get(map,key,&v) && (v.type==PACK_INT || v.type==PACK_REAL)) return v.number;
+	return x;
+}
+
+static int Pack_count(const Pack *map, const char *key, int x, int n)
+{
+	double y = Pack_number(map,key,x);
+
+	return y>=0 && y<=n && y==(int)y ? (int)y:-1;
+}
+
+// ==================================================================
+// Methods of local type Array
+// ==================================================================
+
+static int Array_decode(Array *A, const Pack *data, const Pack *encoding)
+{
+	const unsigned char *at[0x10],*p,*b;
+	unsigned long long u;
+	unsigned int w;
+	float f4;
+	Pack E,kind;
+	Array B;
+	int e,k,j,n,t,type,size;
+	double factor,min,step;
+	long upper,lower,x;
+
+	memset(A,0,sizeof(Array));
+	if(data->type!=PACK_BIN || encoding->type!=PACK_ARRAY) return 0;
+
+	A->type=ARRAY_BYTES;
+	A->count=data->size;
+	A->byte=data->data;
+
+	// List the encodings, which are undone last first.
+
+	if(encoding->size>sizeof(at)/sizeof(at[0])) return 0;
+	for(p=encoding->data, e=0; e<(int)encoding->size && p; e++)
+	{
+		at[e]=p;
+		p=Pack_skip(p,encoding->end);
+	}
+	if(!p) return 0;
+
+	for(e=encoding->size-1; e>=0; e--)
+	{
+		if(!Pack_read(at[e],encoding->end,&E) || !Pack_get(&E,"kind",&kind)) break;
+		memset(&B,0,sizeof(Array));
+
+		if(Pack_is(&kind,"ByteArray") && A->type==ARRAY_BYTES)
+		{
+			// Little-endian numbers of the given type:
+			// (u)int8,16,32 are 1..6, float32,64 32,33.
+
+			type=Pack_count(&E,"type",0,33);
+			size = type>=1 && type<=6 ? 1<<((type-1)%3):type==32 ? 4:type==33 ? 8:0;
+			if(size==0 || A->count%size) break;
+
+			B.count=A->count/size;
+			b=A->byte;
+
+			if(type>=32)
+			{
+				B.type=ARRAY_REAL;
+				B.r=(double*)malloc((B.count+1)*sizeof(double));
+				for(k=0; k<B.count; k++)
+				{
+					u=littleEndian(&b[size*k],size);
+					if(type==32)
+					{
+						w=(unsigned int)u;
+						memcpy(&f4,&w,4);
+						B.r[k]=f4;
+					}
+					else
+					{
+						memcpy(&B.r[k],&u,8);
+					}
+				}
+			}
+			else
+			{
+				B.type=ARRAY_INT;
+				B.i=(int*)malloc((B.count+1)*sizeof(int));
+				switch(type)
+				{
+					case 1: for(k=0; k<B.count; k++) B.i[k]=(signed char)b[k]; break;
+					case 4: for(k=0; k<B.count; k++) B.i[k]=b[k]; break;
+					case 2: for(k=0; k<B.count; k++) B.i[k]=(short)(b[2*k]|b[2*k+1]<<8); break;
+					case 5: for(k=0; k<B.count; k++) B.i[k]=b[2*k]|b[2*k+1]<<8; break;
+					default: for(k=0; k<B.count; k++) B.i[k]=(int)littleEndian(&b[4*k],4); break;
+				}
+			}
+		}
+		else if(Pack_is(&kind,"IntegerPacking") && A->type==ARRAY_INT)
+		{
+			// Values outside the range of the packed type
+			// are sums of runs of its limits. Done in place
+			// (as every value takes at least one).
+
+			size=Pack_count(&E,"byteCount",1,2);
+			n=Pack_count(&E,"srcSize",0,A->count);
+			if(size<1 || n<0) break;
+			if(Pack_number(&E,"isUnsigned",0)!=0.0)
+			{
+				upper = size==1 ? 0xff:0xffff;
+				lower = -1;
+			}
+			else
+			{
+				upper = size==1 ? 0x7f:0x7fff;
+				lower = -upper-1;
+			}
+
+			for(j=0, k=0; k<n; k++)
+			{
+				for(x=0; j<A->count && (A->i[j]==upper || A->i[j]==lower); j++) x+=A->i[j];
+				if(j<A->count) x+=A->i[j++];
+				A->i[k]=(int)x;
+			}
+			A->count=n;
+			continue;
+		}
+		else if(Pack_is(&kind,"RunLength") && A->type==ARRAY_INT)
+		{
+			// (value,count) pairs
+
+			for(x=0, j=0; j+1<A->count; j+=2) if(A->i[j+1]>0) x+=A->i[j+1];
+			n=Pack_count(&E,"srcSize",0,x<0x40000000 ? (int)x:0x40000000);
+			if(n<0) break;
+
+			B.type=ARRAY_INT;
+			B.count=n;
+			B.i=(int*)malloc((n+1)*sizeof(int));
+			for(j=0, k=0; j+1<A->count; j+=2)
+			{
+				for(t=0; t<A->i[j+1] && k<n; t++) B.i[k++]=A->i[j];
+			}
+			while(k<n) B.i[k++]=0;
+		}
+		else if(Pack_is(&kind,"Delta") && A->type==ARRAY_INT)
+		{
+			// Differences from the previous value (the first
+			// from the origin). Done in place.
+
+			factor=Pack_number(&E,"origin",0);
+			if(!(factor>-0x80000000L && factor<0x80000000L)) break;
+			x=(long)factor;
+			for(k=0; k<A->count; k++) A->i[k] = (int)(x+=A->i[k]);
+			continue;
+		}
+		else if(Pack_is(&kind,"FixedPoint") && A->type==ARRAY_INT)
+		{
+			factor=Pack_number(&E,"factor",1);
+			B.type=ARRAY_REAL;
+			B.count=A->count;
+			B.r=(double*)malloc((B.count+1)*sizeof(double));
+			for(k=0; k<B.count; k++) B.r[k]=A->i[k]/factor;
+		}
+		else if(Pack_is(&kind,"IntervalQuantization") && A->type==ARRAY_INT)
+		{
+			min=Pack_number(&E,"min",0);
+			n=Pack_count(&E,"numSteps",2,0x7fffffff);
+			step=n>1 ? (Pack_number(&E,"max",0)-min)/(n-1):0.0;
+			B.type=ARRAY_REAL;
+			B.count=A->count;
+			B.r=(double*)malloc((B.count+1)*sizeof(double));
+			for(k=0; k<B.count; k++) B.r[k]=min+step*A->i[k];
+		}
+		else
+		{
+			break;
+		}
+
+		Array_free(A);
+		*A=B;
+	}
+
+	if(e>=0)
+	{
+		Array_free(A);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void Array_free(Array *A)
+{
+	if(A->i) free(A->i);
+	if(A->r) free(A->r);
+	memset(A,0,sizeof(Array));
+}
+
+// ==================================================================
+// Methods of type BinaryCif
+// ==================================================================
+
+BinaryCif *BinaryCif_create(const void *data, long size, const char *category)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	const unsigned char *end = &p[size];
+	BinaryCif *B;
+	Pack file,blocks,block,categories,C,v;
+	unsigned int k,n;
+
+	// The file is a map whose dataBlocks are maps with a
+	// header and a list of categories, each a map with a
+	// name, a rowCount and a list of columns.
+
+	if(!BinaryCif_test(data,size) || !Pack_read(p,end,&file)) return NULL;
+	if(!Pack_get(&file,"dataBlocks",&blocks) || blocks.type!=PACK_ARRAY || blocks.size<1) return NULL;
+	if(!Pack_read(blocks.data,end,&block)) return NULL;
+	if(!Pack_get(&block,"categories",&categories) || categories.type!=PACK_ARRAY) return NULL;
+
+	// (Category names may or may not start with '_'.)
+
+	if(category[0]=='_') category++;
+	n=strlen(category);
+
+	for(p=categories.data, k=0; k<categories.size && p; k++, p=Pack_skip(p,end))
+	{
+		if(!Pack_read(p,end,&C) || !Pack_get(&C,"name",&v) || v.type!=PACK_STR) continue;
+		if(v.size>0 && v.data[0]=='_') { v.data++; v.size--; }
+		if(v.size!=n || memcmp(v.data,category,n)) continue;
+
+		B = (BinaryCif*)calloc(1,sizeof(BinaryCif));
+		B->rows=Pack_count(&C,"rowCount",0,0x7fffffff);
+		if(B->rows<0) B->rows=0;
+		if(!Pack_get(&C,"columns",&B->columns) || B->columns.type!=PACK_ARRAY)
+		{
+			free(B);
+			return NULL;
+		}
+
+		if(Pack_get(&block,"header",&v) && v.type==PACK_STR)
+		{
+			n = v.size<sizeof(B->id) ? v.size:sizeof(B->id)-1;
+			memcpy(B->id,v.data,n);
+		}
+
+		return B;
+	}
+
+	return NULL;
+}
+
+void BinaryCif_free(BinaryCif *B)
+{
+	if(B) free(B);
+}
+
+int BinaryCif_test(const void *data, long size)
+{
+	const unsigned char *p = (const unsigned char*)data;
+
+	// The file must be a MessagePack map.
+
+	return size>0 && ((p[0]>=0x80 && p[0]<=0x8f) || p[0]==0xde || p[0]==0xdf);
+}
+
+int BinaryCif_rows(const BinaryCif *B)
+{
+	return B->rows;
+}
+
+const char *BinaryCif_id(const BinaryCif *B)
+{
+	return B->id;
+}
+
+BinaryCifColumn *BinaryCif_column(const BinaryCif *B, const char *name)
+{
+	const unsigned char *p;
+	const unsigned char *end = B->columns.end;
+	BinaryCifColumn *C;
+	Pack column,v,data,encoding,E,kind,s;
+	Array A;
+	unsigned int k;
+
+	// Find the column...
+
+	for(p=B->columns.data, k=0; k<B->columns.size && p; k++, p=Pack_skip(p,end))
+	{
+		if(Pack_read(p,end,&column) && Pack_get(&column,"name",&v) && Pack_is(&v,name)) break;
+	}
+
+	if(k==B->columns.size || !p) return NULL;
+	if(!Pack_get(&column,"data",&v) || !Pack_get(&v,"data",&data) || !Pack_get(&v,"encoding",&encoding)) return NULL;
+	if(encoding.type!=PACK_ARRAY || encoding.size<1) return NULL;
+
+	C = (BinaryCifColumn*)calloc(1,sizeof(BinaryCifColumn));
+
+	// ...and decode it. A column of strings is encoded by
+	// StringArray alone: its data are indices (into a list
+	// of offsets into one string of all the values) which
+	// have encodings of their own, as do the offsets.
+
+	// (Whatever A holds when a decoding fails, such as an
+	// array of reals where indices were wanted, is freed.)
+
+	memset(&A,0,sizeof(Array));
+	Pack_read(encoding.data,end,&E);
+	if(Pack_get(&E,"kind",&kind) && Pack_is(&kind,"StringArray"))
+	{
+		if(!Pack_get(&E,"stringData",&s) || s.type!=PACK_STR
+			|| !Pack_get(&E,"dataEncoding",&encoding) || !Array_decode(&A,&data,&encoding) || A.type!=ARRAY_INT)
+		{
+			Array_free(&A);
+			BinaryCifColumn_free(C);
+			return NULL;
+		}
+
+		C->text=(const char*)s.data;
+		C->index=A.i;
+		C->count=A.count;
+		memset(&A,0,sizeof(Array));
+
+		if(!Pack_get(&E,"offsets",&data) || !Pack_get(&E,"offsetEncoding",&encoding)
+			|| !Array_decode(&A,&data,&encoding) || A.type!=ARRAY_INT)
+		{
+			Array_free(&A);
+			BinaryCifColumn_free(C);
+			return NULL;
+		}
+
+		// Check the strings all lie within stringData.
+
+		C->offset=A.i;
+		for(k=0; k<(unsigned int)C->count; k++)
+		{
+			if(C->index[k]>=A.count-1) C->index[k]=-1;
+		}
+		for(k=0; k<(unsigned int)A.count; k++)
+		{
+			if(A.i[k]<0 || (unsigned int)A.i[k]>s.size) A.i[k]=0;
+		}
+	}
+	else
+	{
+		if(!Array_decode(&A,&data,&encoding) || A.type==ARRAY_BYTES)
+		{
+			Array_free(&A);
+			BinaryCifColumn_free(C);
+			return NULL;
+		}
+
+		C->count=A.count;
+		C->i=A.i;
+		C->r=A.r;
+	}
+
+	// The mask (if any) says which rows are null or unknown.
+
+	if(Pack_get(&column,"mask",&v) && v.type==PACK_MAP
+		&& Pack_get(&v,"data",&data) && Pack_get(&v,"encoding",&encoding))
+	{
+		if(Array_decode(&A,&data,&encoding) && A.type==ARRAY_INT && A.count==C->count)
+		{
+			C->mask=A.i;
+		}
+		else
+		{
+			Array_free(&A);
+		}
+	}
+
+	// Rows short of the rowCount are taken to be missing.
+
+	if(C->count<B->rows)
+	{
+		BinaryCifColumn_free(C);
+		return NULL;
+	}
+
+	return C;
+}
+
+// ==================================================================
+// Methods of type BinaryCifColumn
+// ==================================================================
+
+void BinaryCifColumn_free(BinaryCifColumn *C)
+{
+	if(C)
+	{
+		if(C->i) free(C->i);
+		if(C->r) free(C->r);
+		if(C->offset) free(C->offset);
+		if(C->index) free(C->index);
+		if(C->mask) free(C->mask);
+		free(C);
+	}
+}
+
+int BinaryCifColumn_present(const BinaryCifColumn *C, int k)
+{
+	return C && (!C->mask || C->mask[k]==0) && (!C->text || C->index[k]>=0);
+}
+
+int BinaryCifColumn_string(const BinaryCifColumn *C, int k, const char **s)
+{
+	int j;
+
+	if(!BinaryCifColumn_present(C,k) || !C->text) return 0;
+
+	j=C->index[k];
+	*s=&C->text[C->offset[j]];
+	return C->offset[j+1]>C->offset[j] ? C->offset[j+1]-C->offset[j]:0;
+}
+
+double BinaryCifColumn_number(const BinaryCifColumn *C, int k)
+{
+	if(!BinaryCifColumn_present(C,k)) return 0.0;
+	return C->i ? C->i[k]:C->r ? C->r[k]:0.0;
+}
+
+// ==================================================================
@@ -0,0 +1,88 @@
+// ==================================================================
+// BinaryCif.h
+// ==================================================================
+// Declaration of types BinaryCif, BinaryCifColumn and their methods
+// (a reader of BinaryCIF files).
+// ==================================================================
+
+#ifndef BINARYCIF_H
+#define BINARYCIF_H
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// BinaryCif			A category of a BinaryCIF file
+// BinaryCifColumn		A decoded column of a category
+// ==================================================================
+
+typedef struct _BinaryCif BinaryCif;
+typedef struct _BinaryCifColumn BinaryCifColumn;
+
+// ==================================================================
+// type BinaryCifColumn
+// ==================================================================
+// count				Number of rows
+// i[k]					Value in row k of a column of integers...
+// r[k]					...of a column of reals...
+// text,offset,index	...or of a column of strings (see below)
+// mask[k]				0 if row k has a value, 1 if null ('.') and 2 if
+//						unknown ('?'), or NULL if every row has a value
+// ==================================================================
+// Just one of i, r and text is set. The string in row k is the
+// offset[index[k]+1]-offset[index[k]] chars at text[offset[index[k]]]
+// (not terminated), or none if index[k]<0. The text lies in the data
+// of the file, which must last as long as the column.
+// ==================================================================
+
+struct _BinaryCifColumn
+{
+	int count;
+	int *i;
+	double *r;
+	const char *text;
+	int *offset;
+	int *index;
+	int *mask;
+};
+
+// ==================================================================
+// Methods of type BinaryCif
+// ==================================================================
+// create(d,n,c)		Find category c (e.g. "_atom_site") in the first
+//						data block of the BinaryCIF file d[0..n-1]
+// free(B)				Free B (but not the data it was found in)
+// test(d,n)			Whether d[0..n-1] may be a BinaryCIF file
+// rows(B)				Number of rows in the category
+// id(B)				The header (name) of the data block
+// column(B,s)			Decode the column named s (NULL if missing)
+// ==================================================================
+// create() returns NULL if the file is not BinaryCIF or has no such
+// category. Columns are decoded straight from their binary encodings
+// (ByteArray, IntegerPacking, Delta, RunLength, FixedPoint,
+// IntervalQuantization and StringArray) without making any text.
+// ==================================================================
+
+extern BinaryCif *BinaryCif_create(const void*,long,const char*);
+extern void BinaryCif_free(BinaryCif*);
+extern int BinaryCif_test(const void*,long);
+extern int BinaryCif_rows(const BinaryCif*);
+extern const char *BinaryCif_id(const BinaryCif*);
+extern BinaryCifColumn *BinaryCif_column(const BinaryCif*,const char*);
+
+// ==================================================================
+// Methods of type BinaryCifColumn
+// ==================================================================
+// free(C)				Free the column
+// present(C,k)			Whether row k has a value
+// string(C,k,s)		Point s at the string in row k; returns its length
+// number(C,k)			The number in row k (0 if none)
+// ==================================================================
+
+extern void BinaryCifColumn_free(BinaryCifColumn*);
+extern int BinaryCifColumn_present(const BinaryCifColumn*,int);
+extern int BinaryCifColumn_string(const BinaryCifColumn*,int,const char**);
+extern double BinaryCifColumn_number(const BinaryCifColumn*,int);
+
+// ==================================================================
+
+#endif
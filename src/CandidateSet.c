@@ -0,0 +1,244 @@
+// ==================================================================
+// CandidateSet.c
+// ==================================================================
+// Implementation of types CandidateSet and CandidateCache.
+// ==================================================================
+
+#include "CandidateSet.h"
+#include "KdTree.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// ==================================================================
+// Local type Entry
+// ==================================================================
+// key					The match rule of the atoms in the set
+// set					The candidate set
+// next					Next entry in the same bucket
+// ==================================================================
+
+typedef struct _Entry Entry;
+
+struct _Entry
+{
+	char *key;
+	CandidateSet *set;
+	Entry *next;
+};
+
+// ==================================================================
+// type CandidateCache
+// ==================================================================
+// molecule				The molecule the candidates are drawn from
+// tree					The tree of the molecule (NULL until built)
+// lock					Guards the table and the tree
+// bucket[h]			Entries whose keys hash to h
+// ==================================================================
+
+struct _CandidateCache
+{
+	Molecule *molecule;
+	KdTree *tree;
+	pthread_mutex_t lock;
+	Entry *bucket[0];
+};
+
+// ==================================================================
+// cacheSize			Number of buckets in a cache
+// ==================================================================
+
+static const int cacheSize = 256;
+
+// ==================================================================
+// Declaration of methods of local type CandidateSet
+// ==================================================================
+// create(M,T,k)		Create from molecule M, atom k of T
+// free(S)				Free candidate set
+// ==================================================================
+
+static CandidateSet *CandidateSet_create(Molecule*,Template*,int);
+static void CandidateSet_free(CandidateSet*);
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static unsigned int hash(const char *s)
+{
+	unsigned int h=2166136261u;
+
+	while(*s) h=(h^(unsigned char)*s++)*16777619u;
+	return h;
+}
+
+static int compareRank(const void *a, const void *b)
+{
+	return *(const int*)a-*(const int*)b;
+}
+
+// ==================================================================
+// Methods of type CandidateCache
+// ==================================================================
+
+CandidateCache *CandidateCache_create(Molecule *M, KdTree *K)
+{
+	CandidateCache *C;
+
+	C=(CandidateCache*)calloc(1,sizeof(CandidateCache)+cacheSize*sizeof(Entry*));
+	C->molecule=M;
+	C->tree=K;
+	pthread_mutex_init(&C->lock,NULL);
+
+	return C;
+}
+
+void CandidateCache_free(CandidateCache *C)
+{
+	Entry *E;
+	int h;
+
+	if(C)
+	{
+		for(h=0; h<cacheSize; h++)
+		{
+			while((E=C->bucket[h]))
+			{
+				C->bucket[h]=E->next;
+				CandidateSet_free(E->set);
+				free(E->key);
+				free(E);
+			}
+		}
+
+		KdTree_free(C->tree);
+		pthread_mutex_destroy(&C->lock);
+		free(C);
+	}
+}
+
+const CandidateSet *CandidateCache_get(CandidateCache *C, Template *T, int k)
+{
+	const char *key = T->key(T,k);
+	int h = hash(key)%cacheSize;
+	CandidateSet *S;
+	Entry *E;
+
+	// Look for the set...
+
+	pthread_mutex_lock(&C->lock);
+	for(E=C->bucket[h]; E && strcmp(E->key,key); E=E->next);
+	pthread_mutex_unlock(&C->lock);
+
+	if(E) return E->set;
+
+	// It isn't there so build it (without holding the lock,
+	// so other threads may use the cache meanwhile). Then
+	// add it unless another thread got there first, in which
+	// case the two sets are the same and we use theirs.
+
+	S=CandidateSet_create(C->molecule,T,k);
+
+	pthread_mutex_lock(&C->lock);
+	for(E=C->bucket[h]; E && strcmp(E->key,key); E=E->next);
+	if(!E)
+	{
+		E=(Entry*)calloc(1,sizeof(Entry));
+		E->key=strdup(key);
+		E->set=S;
+		E->next=C->bucket[h];
+		C->bucket[h]=E;
+		S=NULL;
+	}
+	pthread_mutex_unlock(&C->lock);
+
+	CandidateSet_free(S);
+	return E->set;
+}
+
+KdTree *CandidateCache_tree(CandidateCache *C)
+{
+	const double *x[3];
+	KdTree *K;
+	int i;
+
+	// The first thread to ask builds the tree while the
+	// others wait for it.
+
+	pthread_mutex_lock(&C->lock);
+
+	if(!C->tree)
+	{
+		for(i=0; i<3; i++) x[i]=Molecule_axis(C->molecule,i);
+		C->tree=KdTree_createAxes(x,Molecule_count(C->molecule),3);
+	}
+
+	K=C->tree;
+	pthread_mutex_unlock(&C->lock);
+
+	return K;
+}
+
+// ==================================================================
+// Methods of local type CandidateSet
+// ==================================================================
+
+static CandidateSet *CandidateSet_create(Molecule *M, Template *T, int k)
+{
+	CandidateSet *S;
+	KdTree *K;
+	const int *rank,*order;
+	Atom *A = (Atom*)Molecule_atoms(M);
+	int n = Molecule_count(M);
+	int m;
+
+	S = (CandidateSet*)calloc(1,sizeof(CandidateSet));
+	S->atom=(Atom**)calloc(n,sizeof(Atom*));
+	S->rank=(int*)calloc(n,sizeof(int));
+
+	// Find the atoms that match in one pass over them all
+	// (into rank[], for now) then, if there are any, look
+	// up their ranks in the tree.
+
+	S->count=T->select(T,k,A,n,S->rank);
+
+	S->atom=(Atom**)realloc(S->atom,sizeof(Atom*)*S->count);
+	S->rank=(int*)realloc(S->rank,sizeof(int)*S->count);
+	S->ranked=(Atom**)calloc(S->count,sizeof(Atom*));
+
+	if(S->count==0) return S;
+
+	K=Molecule_tree(M);
+	rank=KdTree_rank(K);
+	order=KdTree_order(K);
+
+	for(m=0; m<S->count; m++)
+	{
+		S->atom[m]=&A[S->rank[m]];
+		S->rank[m]=rank[S->rank[m]];
+	}
+
+	// Then list the atoms again in order of rank.
+
+	qsort(S->rank,S->count,sizeof(int),compareRank);
+
+	for(m=0; m<S->count; m++)
+	{
+		S->ranked[m]=(Atom*)Molecule_atom(M,order[S->rank[m]]);
+	}
+
+	return S;
+}
+
+static void CandidateSet_free(CandidateSet *S)
+{
+	if(S)
+	{
+		if(S->atom) free(S->atom);
+		if(S->ranked) free(S->ranked);
+		if(S->rank) free(S->rank);
+		free(S);
+	}
+}
+
+// ==================================================================
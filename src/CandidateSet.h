@@ -0,0 +1,70 @@
+// ==================================================================
+// CandidateSet.h
+// ==================================================================
+// Declaration of types CandidateSet, CandidateCache and their
+// methods.
+// ==================================================================
+
+#ifndef CANDIDATESET_H
+#define CANDIDATESET_H
+
+#include "Molecule.h"
+#include "Template.h"
+#include "Atom.h"
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// CandidateSet			The atoms of a molecule matching a template atom
+// CandidateCache		(see Molecule.h)
+// ==================================================================
+
+typedef struct _CandidateSet CandidateSet;
+
+// ==================================================================
+// type CandidateSet
+// ==================================================================
+// count				Number of atoms in the set
+// atom[k]				Points to ATOM record for kth candidate
+// ranked[k]			As atom[] but in increasing order of rank
+// rank[k]				Rank of ranked[k] in the molecule's tree
+// ==================================================================
+// The atoms in ranked[] are in the order the mask of a query on the
+// molecule's tree must be in (see KdTree_queryMasked); those in
+// atom[] are in molecule order.
+// ==================================================================
+
+struct _CandidateSet
+{
+	int count;
+	Atom **atom;
+	Atom **ranked;
+	int *rank;
+};
+
+// ==================================================================
+// Methods of type CandidateCache
+// ==================================================================
+// create(M,K)			Create an empty cache of candidates of M, with
+//						K as the tree of M (or if K is NULL, one built
+//						when it is first asked for)
+// free(C)				Free C, all the sets in it and the tree
+// get(C,T,k)			The set of atoms which match atom k of T
+// tree(C)				The tree of M (see Molecule_tree)
+// ==================================================================
+// Sets are looked up by the key of the template atom (see Template.h)
+// so templates whose atoms share a match rule share one set. Sets
+// belong to the cache and last until it is freed. get() and tree()
+// may be called on many threads at once. The tree is only built
+// once a set has some atoms, so a molecule which no template atom
+// can match never pays for it.
+// ==================================================================
+
+extern CandidateCache *CandidateCache_create(Molecule*,KdTree*);
+extern void CandidateCache_free(CandidateCache*);
+extern const CandidateSet *CandidateCache_get(CandidateCache*,Template*,int);
+extern KdTree *CandidateCache_tree(CandidateCache*);
+
+// ==================================================================
+
+#endif
@@ -0,0 +1,251 @@
+// ==================================================================
+// Filter.c
+// ==================================================================
+// Implementation of type Filter.
+// ==================================================================
+
+#include "Filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ==================================================================
+// FILTER_START			Starting number of buckets of a filter
+// ==================================================================
+
+#define FILTER_START 64
+
+// ==================================================================
+// Local type Kept
+// ==================================================================
+// score				Score of a hit kept
+// data,size			Output of the hit
+// ==================================================================
+
+typedef struct _Kept Kept;
+
+struct _Kept
+{
+	double score;
+	char *data;
+	size_t size;
+};
+
+// ==================================================================
+// Local type Entry
+// ==================================================================
+// key					The key of the hits
+// hash					Hash of key
+// count				Number of hits kept
+// kept[i]				The hits kept, from the lowest score up
+// room					Size of kept
+// chain				Next entry in the same bucket
+// ==================================================================
+
+typedef struct _Entry Entry;
+
+struct _Entry
+{
+	char *key;
+	unsigned int hash;
+	int count;
+	Kept *kept;
+	int room;
+	Entry *chain;
+};
+
+// ==================================================================
+// type Filter
+// ==================================================================
+// most					Most hits kept per key
+// entry[0..count-1]	The entries, in the order of their keys
+// room					Size of entry
+// bucket[h]			Entries whose hashes are h modulo buckets
+// buckets				Size of bucket (a power of 2)
+// ==================================================================
+
+struct _Filter
+{
+	int most;
+	Entry **entry;
+	int count;
+	int room;
+	Entry **bucket;
+	int buckets;
+};
+
+// ==================================================================
+// Private methods of type Filter
+// ==================================================================
+// entry(F,k)			The entry for key k (new if need be)
+// grow(F)				Double the buckets of F and rehash its entries
+// ==================================================================
+
+static Entry *Filter_entry(Filter*,const char*);
+static void Filter_grow(Filter*);
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static unsigned int hash(const char *s)
+{
+	unsigned int h=2166136261u;
+
+	while(*s) h=(h^(unsigned char)*s++)*16777619u;
+	return h;
+}
+
+// ==================================================================
+// Methods of type Filter
+// ==================================================================
+
+Filter *Filter_create(int most)
+{
+	Filter *F;
+
+	F=(Filter*)calloc(1,sizeof(Filter));
+	F->most = most>0 ? most:1;
+	F->buckets=FILTER_START;
+	F->bucket=(Entry**)calloc(F->buckets,sizeof(Entry*));
+
+	return F;
+}
+
+void Filter_free(Filter *F)
+{
+	Entry *E;
+	int i,k;
+
+	if(F)
+	{
+		for(k=0; k<F->count; k++)
+		{
+			E=F->entry[k];
+			for(i=0; i<E->count; i++) free(E->kept[i].data);
+			free(E->kept);
+			free(E->key);
+			free(E);
+		}
+
+		free(F->entry);
+		free(F->bucket);
+		free(F);
+	}
+}
+
+void Filter_add(Filter *F, const char *key, double score, char *data, size_t size)
+{
+	Entry *E = Filter_entry(F,key);
+	int i;
+
+	// The hit goes after those that score no higher; if
+	// that is past the last place, it is not kept.
+
+	for(i=E->count; i>0 && score<E->kept[i-1].score; i--);
+
+	if(i>=F->most)
+	{
+		free(data);
+		return;
+	}
+
+	if(E->count==F->most) free(E->kept[--E->count].data);
+
+	if(E->count==E->room)
+	{
+		E->room = E->room ? 2*E->room:4;
+		if(E->room>F->most) E->room=F->most;
+		E->kept=(Kept*)realloc(E->kept,E->room*sizeof(Kept));
+	}
+
+	memmove(&E->kept[i+1],&E->kept[i],(E->count-i)*sizeof(Kept));
+	E->kept[i].score=score;
+	E->kept[i].data=data;
+	E->kept[i].size=size;
+	E->count++;
+}
+
+void Filter_merge(Filter *F, Filter *G)
+{
+	Entry *E;
+	int i,k;
+
+	// (Each key's hits are offered in the order they
+	// rank, which for equal scores is the order they
+	// were offered to G.)
+
+	for(k=0; k<G->count; k++)
+	{
+		E=G->entry[k];
+		for(i=0; i<E->count; i++)
+		{
+			Filter_add(F,E->key,E->kept[i].score,E->kept[i].data,E->kept[i].size);
+		}
+		E->count=0;
+	}
+
+	Filter_free(G);
+}
+
+void Filter_write(const Filter *F, Writer *W)
+{
+	Entry *E;
+	int i,k;
+
+	for(k=0; k<F->count; k++)
+	{
+		E=F->entry[k];
+		for(i=0; i<E->count; i++) Writer_bytes(W,E->kept[i].data,E->kept[i].size);
+	}
+}
+
+// ==================================================================
+// Private methods of type Filter
+// ==================================================================
+
+static Entry *Filter_entry(Filter *F, const char *key)
+{
+	unsigned int h=hash(key);
+	Entry *E;
+
+	for(E=F->bucket[h&(F->buckets-1)]; E; E=E->chain)
+	{
+		if(E->hash==h && strcmp(E->key,key)==0) return E;
+	}
+
+	if(F->count==F->room)
+	{
+		F->room = F->room ? 2*F->room:FILTER_START;
+		F->entry=(Entry**)realloc(F->entry,F->room*sizeof(Entry*));
+	}
+
+	if(F->count>=F->buckets) Filter_grow(F);
+
+	E=(Entry*)calloc(1,sizeof(Entry));
+	E->key=strdup(key);
+	E->hash=h;
+	E->chain=F->bucket[h&(F->buckets-1)];
+	F->bucket[h&(F->buckets-1)]=E;
+	F->entry[F->count++]=E;
+
+	return E;
+}
+
+static void Filter_grow(Filter *F)
+{
+	Entry *E;
+	int k;
+
+	free(F->bucket);
+	F->buckets*=2;
+	F->bucket=(Entry**)calloc(F->buckets,sizeof(Entry*));
+
+	for(k=0; k<F->count; k++)
+	{
+		E=F->entry[k];
+		E->chain=F->bucket[E->hash&(F->buckets-1)];
+		F->bucket[E->hash&(F->buckets-1)]=E;
+	}
+}
+
+// ==================================================================
@@ -0,0 +1,51 @@
+// ==================================================================
+// Filter.h
+// ==================================================================
+// Declaration of type Filter and its methods (the best hits of one
+// target for each of a set of keys, chosen while the target is
+// searched: e.g. for each template and set of residues, as kept by
+// filter_output.py, or for each template).
+// ==================================================================
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "Writer.h"
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Filter				The hits of a target kept so far
+// ==================================================================
+
+typedef struct _Filter Filter;
+
+// ==================================================================
+// Methods of type Filter
+// ==================================================================
+// create(m)			Create a filter which keeps at most m hits per key
+// free(F)				Free F and the hits it keeps
+// add(F,k,s,d,n)		Offer a hit with key k and score s, whose output
+//						is d[0..n-1] (which F takes over): it is kept
+//						if it is among the m lowest-scoring with key k
+//						offered so far
+// merge(F,G)			Offer the hits kept by G to F in turn, then
+//						free G
+// write(F,W)			Write the output of the hits kept to W: key by
+//						key in the order the keys were first offered,
+//						each key's hits from the lowest score up
+// ==================================================================
+// Of hits with equal scores the first offered ranks first, so that
+// merging the filters of consecutive parts of a search keeps the
+// same hits, in the same order, as one filter of the whole search.
+// ==================================================================
+
+extern Filter *Filter_create(int);
+extern void Filter_free(Filter*);
+extern void Filter_add(Filter*,const char*,double,char*,size_t);
+extern void Filter_merge(Filter*,Filter*);
+extern void Filter_write(const Filter*,Writer*);
+
+// ==================================================================
+
+#endif
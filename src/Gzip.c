@@ -0,0 +1,254 @@
+// ==================================================================
+// Gzip.c
+// ==================================================================
+// Implementation of type Gzip.
+// ==================================================================
+
+#include "Gzip.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+// ==================================================================
+// GZIP_BLOCKS			Number of blocks in the ring
+// GZIP_BLOCK			Size of a block of the inflated file
+// GZIP_INPUT			Size of a read from the stream
+// ==================================================================
+
+#define GZIP_BLOCKS 4
+#define GZIP_BLOCK 0x40000
+#define GZIP_INPUT 0x10000
+
+// ==================================================================
+// type Gzip
+// ==================================================================
+// file					The stream inflated (if data is NULL)
+// data,size			The file inflated
+// thread				The thread which inflates it
+// lock					Guards everything below
+// ready				Signalled when a block is filled or freed
+// filled				Number of blocks filled so far
+// taken				Number of blocks passed to the reader so far
+// freed				Number of blocks the reader is done with
+// done					1 at the end of the file, -1 if it is corrupt
+// stop					Whether to stop inflating
+// length[b]			Size of block b
+// block[b]				Block b of the ring (the filled-th block of the
+//						file goes in block[filled%GZIP_BLOCKS])
+// input				Buffer for reads from the stream
+// ==================================================================
+
+struct _Gzip
+{
+	FILE *file;
+	const unsigned char *data;
+	long size;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	long filled;
+	long taken;
+	long freed;
+	int done;
+	int stop;
+	long length[GZIP_BLOCKS];
+	char *block[GZIP_BLOCKS];
+	unsigned char input[GZIP_INPUT];
+};
+
+// ==================================================================
+// Private methods of type Gzip
+// ==================================================================
+// inflate(G)			Inflate the file (the body of G's thread)
+// input(G,z)			Give z more of the file; false at its end
+// ==================================================================
+
+static void *Gzip_inflate(void*);
+static int Gzip_input(Gzip*,z_stream*);
+
+// ==================================================================
+// Methods of type Gzip
+// ==================================================================
+
+Gzip *Gzip_create(FILE *file, const void *data, long size)
+{
+	Gzip *G;
+	int b;
+
+	G = (Gzip*)calloc(1,sizeof(Gzip));
+	G->file=file;
+	G->data=(const unsigned char*)data;
+	G->size=data ? size:0;
+
+	for(b=0; b<GZIP_BLOCKS; b++) G->block[b]=(char*)malloc(GZIP_BLOCK);
+
+	pthread_mutex_init(&G->lock,NULL);
+	pthread_cond_init(&G->ready,NULL);
+
+	if(pthread_create(&G->thread,NULL,Gzip_inflate,G))
+	{
+		perror("pthread_create");
+		exit(1);
+	}
+
+	return G;
+}
+
+void Gzip_free(Gzip *G)
+{
+	int b;
+
+	if(!G) return;
+
+	// Stop the thread (which may be waiting for a free
+	// block) and wait for it.
+
+	pthread_mutex_lock(&G->lock);
+	G->stop=1;
+	pthread_cond_broadcast(&G->ready);
+	pthread_mutex_unlock(&G->lock);
+
+	pthread_join(G->thread,NULL);
+
+	pthread_cond_destroy(&G->ready);
+	pthread_mutex_destroy(&G->lock);
+	for(b=0; b<GZIP_BLOCKS; b++) free(G->block[b]);
+	free(G);
+}
+
+int Gzip_test(const void *data, long size)
+{
+	const unsigned char *d = (const unsigned char*)data;
+
+	return size>0 && d[0]==0x1f && (size<2 || d[1]==0x8b);
+}
+
+long Gzip_read(Gzip *G, const char **p)
+{
+	long n;
+
+	pthread_mutex_lock(&G->lock);
+
+	// Give back the block read last time...
+
+	if(G->freed<G->taken)
+	{
+		G->freed=G->taken;
+		pthread_cond_broadcast(&G->ready);
+	}
+
+	// ...then wait for the next (or the end).
+
+	while(G->taken==G->filled && !G->done)
+	{
+		pthread_cond_wait(&G->ready,&G->lock);
+	}
+
+	if(G->taken<G->filled)
+	{
+		*p=G->block[G->taken%GZIP_BLOCKS];
+		n=G->length[G->taken++%GZIP_BLOCKS];
+	}
+	else n = G->done<0 ? -1:0;
+
+	pthread_mutex_unlock(&G->lock);
+
+	return n;
+}
+
+// ==================================================================
+// Private methods of type Gzip
+// ==================================================================
+
+static void *Gzip_inflate(void *arg)
+{
+	Gzip *G = (Gzip*)arg;
+	z_stream z;
+	long w,n;
+	int done=0,stop=0,result;
+
+	memset(&z,0,sizeof(z_stream));
+	if(inflateInit2(&z,15+16)!=Z_OK) done=-1;
+
+	for(w=0; !done; w++)
+	{
+		// 1. Wait for block w to be free (i.e. for the
+		// reader to be done with block w-GZIP_BLOCKS).
+
+		pthread_mutex_lock(&G->lock);
+		while(!G->stop && w-G->freed>=GZIP_BLOCKS)
+		{
+			pthread_cond_wait(&G->ready,&G->lock);
+		}
+		stop=G->stop;
+		pthread_mutex_unlock(&G->lock);
+
+		if(stop) break;
+
+		// 2. Fill it. A member of the file which ends is
+		// followed by another or (if anything but a gzip
+		// header follows, e.g. padding) by the end.
+
+		z.next_out=(unsigned char*)G->block[w%GZIP_BLOCKS];
+		z.avail_out=GZIP_BLOCK;
+
+		while(!done && z.avail_out>0)
+		{
+			if(!z.avail_in && !Gzip_input(G,&z))
+			{
+				done=-1;
+				break;
+			}
+
+			result=inflate(&z,Z_NO_FLUSH);
+
+			if(result==Z_STREAM_END)
+			{
+				if(!z.avail_in && !Gzip_input(G,&z)) done=1;
+				else if(z.next_in[0]!=0x1f) done=1;
+				else if(inflateReset(&z)!=Z_OK) done=-1;
+			}
+			else if(result!=Z_OK) done=-1;
+		}
+
+		// 3. Pass it to the reader.
+
+		n=GZIP_BLOCK-z.avail_out;
+
+		pthread_mutex_lock(&G->lock);
+		G->length[w%GZIP_BLOCKS]=n;
+		if(n>0) G->filled=w+1;
+		G->done=done;
+		pthread_cond_broadcast(&G->ready);
+		pthread_mutex_unlock(&G->lock);
+	}
+
+	inflateEnd(&z);
+	return NULL;
+}
+
+static int Gzip_input(Gzip *G, z_stream *z)
+{
+	long n;
+
+	if(G->data)
+	{
+		// (At most 1GB at once, as avail_in is 32 bits.)
+
+		n = G->size<0x40000000 ? G->size:0x40000000;
+		z->next_in=(unsigned char*)G->data;
+		G->data+=n;
+		G->size-=n;
+	}
+	else
+	{
+		n=fread(G->input,1,GZIP_INPUT,G->file);
+		z->next_in=G->input;
+	}
+
+	z->avail_in=n;
+	return n>0;
+}
+
+// ==================================================================
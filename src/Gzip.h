@@ -0,0 +1,47 @@
+// ==================================================================
+// Gzip.h
+// ==================================================================
+// Declaration of type Gzip and its methods (a reader of gzip files
+// which inflates them on a thread of its own).
+// ==================================================================
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stdio.h>
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Gzip					A gzip file being inflated
+// ==================================================================
+
+typedef struct _Gzip Gzip;
+
+// ==================================================================
+// Methods of type Gzip
+// ==================================================================
+// create(f,d,n)		Start inflating the gzip file d[0..n-1], or the
+//						rest of stream f if d is NULL
+// free(G)				Stop inflating (if it hasn't finished) and free G
+// test(d,n)			Whether d[0..n-1] may be the start of a gzip file
+// read(G,p)			Point p at the next block of the inflated file;
+//						returns its size, 0 at the end or -1 if the
+//						file is corrupt
+// ==================================================================
+// The file is inflated a block at a time into a small ring of blocks
+// while the caller reads the blocks before, so that inflating (and
+// reading f) overlaps with whatever is done with the blocks and the
+// whole file is never held in memory. A block lasts until the next
+// call to read(). Concatenated gzip members are read as one file.
+// Neither f nor d may be touched until G is freed.
+// ==================================================================
+
+extern Gzip *Gzip_create(FILE*,const void*,long);
+extern void Gzip_free(Gzip*);
+extern int Gzip_test(const void*,long);
+extern long Gzip_read(Gzip*,const char**);
+
+// ==================================================================
+
+#endif
@@ -0,0 +1,198 @@
+// ==================================================================
+// Hit.c
+// ==================================================================
+// Implementation of type Hit.
+// ==================================================================
+
+#include "Hit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ==================================================================
+// HIT_MAGIC			The first 8 bytes of a binary file of hits
+// HIT_VERSION			Version of the layout of a record
+// HIT_CHECK			Written after the version (as a test of the
+//						byte order)
+// ==================================================================
+
+#define HIT_MAGIC "JESSHITS"
+#define HIT_VERSION 1
+#define HIT_CHECK 0x01020304
+
+// ==================================================================
+// Local type Record
+// ==================================================================
+// The fixed part of a binary record (see Hit.h).
+// ==================================================================
+
+typedef struct _Record Record;
+
+struct _Record
+{
+	int size;
+	int count;
+	long target;
+	double rmsd;
+	double logE;
+	double det;
+	double rotation[9];
+	double centroid[2][3];
+};
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static void doubles(Writer *W, const double *x, int n, int places)
+{
+	int i;
+
+	for(i=0; i<n; i++)
+	{
+		if(i>0) Writer_character(W,',');
+		Writer_fixed(W,x[i],0,places);
+	}
+}
+
+static void integers(Writer *W, const int *x, int n)
+{
+	int i;
+
+	for(i=0; i<n; i++)
+	{
+		if(i>0) Writer_character(W,',');
+		Writer_integer(W,x[i],0);
+	}
+}
+
+// ==================================================================
+// Methods of type Hit
+// ==================================================================
+
+int Hit_header(FILE *file)
+{
+	int v[2] = { HIT_VERSION,HIT_CHECK };
+
+	return fwrite(HIT_MAGIC,1,8,file)==8 && fwrite(v,sizeof(int),2,file)==2;
+}
+
+int Hit_check(FILE *file)
+{
+	char magic[8];
+	int v[2];
+
+	return fread(magic,1,8,file)==8 && memcmp(magic,HIT_MAGIC,8)==0
+		&& fread(v,sizeof(int),2,file)==2 && v[0]==HIT_VERSION && v[1]==HIT_CHECK;
+}
+
+void Hit_write(const Hit *H, Writer *W)
+{
+	static const char zero[8];
+	Record R;
+	long n,m,size;
+
+	n=strlen(H->id)+1;
+	m=strlen(H->template)+1;
+	size=sizeof(Record)+2*H->count*sizeof(int)+n+m;
+
+	memset(&R,0,sizeof(Record));
+	R.size=(size+7)&~7;
+	R.count=H->count;
+	R.target=H->target;
+	R.rmsd=H->rmsd;
+	R.logE=H->logE;
+	R.det=H->det;
+	memcpy(R.rotation,H->rotation,sizeof(R.rotation));
+	memcpy(R.centroid,H->centroid,sizeof(R.centroid));
+
+	Writer_bytes(W,&R,sizeof(Record));
+	Writer_bytes(W,H->index,H->count*sizeof(int));
+	Writer_bytes(W,H->serial,H->count*sizeof(int));
+	Writer_bytes(W,H->id,n);
+	Writer_bytes(W,H->template,m);
+	Writer_bytes(W,zero,R.size-size);
+}
+
+Hit *Hit_read(FILE *file, int *error)
+{
+	Record R;
+	Hit *H;
+	char *s,*t;
+	long k,n;
+
+	*error=0;
+
+	// The record must hold its atoms and two strings.
+
+	if((k=fread(&R,1,sizeof(Record),file))==0) return NULL;
+
+	if(k<sizeof(Record) || R.size%8 || R.size<(int)sizeof(Record) || R.count<0
+		|| R.count>(R.size-(int)sizeof(Record))/(2*(int)sizeof(int)))
+	{
+		*error=1;
+		return NULL;
+	}
+
+	n=R.size-sizeof(Record);
+	H=(Hit*)malloc(sizeof(Hit)+n);
+	s=(char*)(H+1);
+
+	if(fread(s,1,n,file)<n)
+	{
+		free(H);
+		*error=1;
+		return NULL;
+	}
+
+	H->index=(int*)s;
+	H->serial=&H->index[R.count];
+	s=(char*)&H->serial[R.count];
+	n-=2*R.count*sizeof(int);
+
+	if(!(t=memchr(s,0,n)) || !memchr(t+1,0,n-(t+1-s)))
+	{
+		free(H);
+		*error=1;
+		return NULL;
+	}
+
+	H->target=R.target;
+	H->id=s;
+	H->template=t+1;
+	H->rmsd=R.rmsd;
+	H->logE=R.logE;
+	H->det=R.det;
+	memcpy(H->rotation,R.rotation,sizeof(R.rotation));
+	memcpy(H->centroid,R.centroid,sizeof(R.centroid));
+	H->count=R.count;
+
+	return H;
+}
+
+void Hit_tsv(const Hit *H, Writer *W)
+{
+	Writer_integer(W,H->target,0);
+	Writer_character(W,'\t');
+	Writer_string(W,H->id);
+	Writer_character(W,'\t');
+	Writer_string(W,H->template);
+	Writer_character(W,'\t');
+	Writer_fixed(W,H->rmsd,0,3);
+	Writer_character(W,'\t');
+	Writer_fixed(W,H->logE,0,2);
+	Writer_character(W,'\t');
+	Writer_fixed(W,H->det,0,1);
+	Writer_character(W,'\t');
+	doubles(W,H->rotation,9,6);
+	Writer_character(W,'\t');
+	doubles(W,H->centroid[0],3,3);
+	Writer_character(W,'\t');
+	doubles(W,H->centroid[1],3,3);
+	Writer_character(W,'\t');
+	integers(W,H->index,H->count);
+	Writer_character(W,'\t');
+	integers(W,H->serial,H->count);
+	Writer_character(W,'\n');
+}
+
+// ==================================================================
@@ -0,0 +1,95 @@
+// ==================================================================
+// Hit.h
+// ==================================================================
+// Declaration of type Hit and its methods (one hit as a record, for
+// the TSV and binary output of jess and for reading it back).
+// ==================================================================
+
+#ifndef HIT_H
+#define HIT_H
+
+#include "Writer.h"
+#include <stdio.h>
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Hit					A hit of a template on a target
+// ==================================================================
+
+typedef struct _Hit Hit;
+
+// ==================================================================
+// type Hit
+// ==================================================================
+// target				Position of the target in the target list
+// id					Target id (as in the REMARK of a text hit)
+// template				Name of the template
+// rmsd					RMSD of the superposition
+// logE					log(E) (see Template.h)
+// det					Determinant of rotation (which should be 1)
+// rotation				The rotation, as 9 doubles by row...
+// centroid[k]			...and the centroids of the target's (k=0) and
+//						the template's (k=1) atoms, so that a matched
+//						target atom x is at rotation.(x-centroid[0])+
+//						centroid[1] in the frame of the template
+// count				Number of atoms matched
+// index[i]				Position in the target (see Molecule_atom) of
+//						the atom matched by the ith template atom...
+// serial[i]			...and its serial number
+// ==================================================================
+
+struct _Hit
+{
+	long target;
+	const char *id;
+	const char *template;
+	double rmsd;
+	double logE;
+	double det;
+	double rotation[9];
+	double centroid[2][3];
+	int count;
+	int *index;
+	int *serial;
+};
+
+// ==================================================================
+// Methods of type Hit
+// ==================================================================
+// header(f)			Write the header of a binary file of hits to f;
+//						true=>success
+// check(f)				Read the header of a binary file of hits from
+//						f; true=>it is one (from a build of the same
+//						byte order)
+// write(H,W)			Write H to W as a binary record
+// read(f,e)			Read the next binary record from f (to be freed
+//						with free()); NULL at the end of f, or with *e
+//						set if the record is corrupt
+// tsv(H,W)				Write H to W as a line of TSV
+// ==================================================================
+// A binary file of hits is a header (the 8 bytes "JESSHITS", then
+// the version and 0x01020304, as native 32-bit integers) followed
+// by one record per hit, in native byte order:
+//
+//	int32	size		Size of the record in bytes (a multiple of 8)
+//	int32	count		As in Hit
+//	int64	target		As in Hit
+//	double	rmsd,logE,det,rotation[9],centroid[6]
+//	int32	index[count],serial[count]
+//	char	id[],template[]	Each ending in a zero, then zeros up to size
+//
+// A line of TSV has the fields target, id, template, rmsd, logE, det,
+// rotation (9 numbers), centroid[0] and centroid[1] (3 numbers each),
+// index and serial (count numbers each), lists separated by commas.
+// ==================================================================
+
+extern int Hit_header(FILE*);
+extern int Hit_check(FILE*);
+extern void Hit_write(const Hit*,Writer*);
+extern Hit *Hit_read(FILE*,int*);
+extern void Hit_tsv(const Hit*,Writer*);
+
+// ==================================================================
+
+#endif
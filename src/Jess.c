@@ -14,61 +14,77 @@
 #include <math.h>
 #include <string.h>
 
-// ==================================================================
-// Forward declarations of local types
-// ==================================================================
-// Node					A linked list of templates
-// ==================================================================
-
-typedef struct _Node Node;
-
 // ==================================================================
 // type Jess
 // ==================================================================
-// head					The head of the list of nodes
+// count				Number of templates
+// size					Allocated size of template[]
+// template[k]			The kth template added
+// ==================================================================
+// Templates are searched in the reverse of the order in which they
+// were added (as they were when these were kept in a linked list),
+// so search index k refers to template[count-1-k].
 // ==================================================================
 
 struct _Jess
 {
-	Node *head;
+	int count;
+	int size;
+	Template **template;
 };
 
 // ==================================================================
 // type JessQuery
 // ==================================================================
-// node					The current node
+// jess					The templates being searched
+// index				Search index of the current template
+// end					Search index at which to stop
 // scanner				The current scanner
-// super				The current superposition
+// super				The superposition (reused for each hit)...
+// superposed			...true if it is that of atoms
 // reverseQ				True if superposition is reversed
 // molecule				The molecule being scanned
 // atoms				Array of Atoms which are hit
 // threshold			The distance threshold
+// limit				Largest RMSD of a hit returned (<0: any)
+// top					Most hits returned per template (0: any)
+// heap[0..heaped-1]	Max-heap of the RMSDs of the best hits (at most
+//						top) returned for the current template
+// ==================================================================
+// With a limit, the scanner prunes branches whose hits cannot come
+// within it, or (once top hits of a template have been returned)
+// beat the worst of those; so a caller that keeps the top lowest-
+// RMSD hits of each template gets the same ones as from a search
+// with no limit, sooner.
 // ==================================================================
 
 struct _JessQuery
 {
-	Node *node;
+	Jess *jess;
+	int index;
+	int end;
 	Scanner *scanner;
 	Superposition *super;
+	int superposed;
 	int reverseQ;
 	Molecule *molecule;
 	Atom **atoms;
 	double threshold;
 	double max_total_threshold;
+	double limit;
+	int top;
+	double *heap;
+	int heaped;
 };
 
 // ==================================================================
-// type Node
+// Declaration of private methods of type JessQuery
 // ==================================================================
-// template				The template at this node
-// next					The next node in the list
+// keep(Q)				True if the hit just found is to be returned
+//						under the limit (which it then tightens)
 // ==================================================================
 
-struct _Node
-{
-	Template *template;
-	Node *next;
-};
+static int JessQuery_keep(JessQuery*);
 
 // ==================================================================
 // Methods of type Jess
@@ -81,40 +97,63 @@ Jess *Jess_create(void)
 
 void Jess_free(Jess *J)
 {
-	Node *n;
 	Template *T;
+	int k;
 
 	if(J)
 	{
-		while(J->head)
+		for(k=0; k<J->count; k++)
 		{
-			n=J->head->next;
-			T=J->head->template;
+			T=J->template[k];
 			if(T) T->free(T);
-			J->head=n;
 		}
+
+		free(J->template);
+		free(J);
 	}
 }
 
 void Jess_addTemplate(Jess *J, Template *T)
 {
-	Node *n;
+	if(J->count==J->size)
+	{
+		J->size = J->size ? 2*J->size:16;
+		J->template=(Template**)realloc(J->template,J->size*sizeof(Template*));
+	}
+
+	J->template[J->count++]=T;
+}
 
-	n=(Node*)calloc(1,sizeof(Node));
-	n->template=T;
-	n->next=J->head;
-	J->head=n;
+int Jess_count(const Jess *J)
+{
+	return J->count;
+}
+
+Template *Jess_template(const Jess *J, int k)
+{
+	return k<0 || k>=J->count ? NULL:J->template[J->count-1-k];
 }
 
 JessQuery *Jess_query(Jess *J, Molecule *M,double t,double s)
+{
+	return Jess_queryRange(J,M,0,J->count,t,s);
+}
+
+JessQuery *Jess_queryRange(Jess *J, Molecule *M,int begin,int end,double t,double s)
 {
 	JessQuery *Q;
 
+	if(begin<0) begin=0;
+	if(end>J->count) end=J->count;
+
 	Q = (JessQuery*)calloc(1,sizeof(JessQuery));
-	Q->node=J->head;
+	Q->jess=J;
+	Q->index=begin;
+	Q->end=end;
 	Q->molecule=M;
 	Q->threshold=t;
 	Q->max_total_threshold=s;
+	Q->limit=-1.0;
 
 	return Q;
 }
@@ -129,14 +168,15 @@ void JessQuery_free(JessQuery *Q)
 	{
 		Scanner_free(Q->scanner);
 		Superposition_free(Q->super);
+		free(Q->heap);
 		free(Q);
 	}
 }
 
 Template *JessQuery_template(JessQuery *Q)
 {
-	if(!Q->node) return NULL;
-	return Q->node->template;
+	if(Q->index>=Q->end) return NULL;
+	return Jess_template(Q->jess,Q->index);
 }
 
 const Molecule *JessQuery_molecule(JessQuery *Q)
@@ -157,64 +197,78 @@ Superposition *JessQuery_superposition(JessQuery *Q)
 	Template *T;
 	Atom **A;
 
-	if(Q->super) return Q->super;
+	if(Q->superposed) return Q->super;
 
 	A = Q->atoms;
-	T = Q->node->template;
+	T = Jess_template(Q->jess,Q->index);
 	count = T->count(T);
-	Q->super=Superposition_create();
+
+	if(!Q->super) Q->super=Superposition_create();
+	else Superposition_reset(Q->super);
 
 	for(i=0; i<count; i++)
 	{
 		Superposition_align(Q->super,A[i]->x,T->position(T,i));
 	}
 
+	Q->superposed=1;
 	return Q->super;
 }
 
 int JessQuery_next(JessQuery *Q, int ignore_chain)
 {
-	Template *T;
+	return JessQuery_poll(Q,ignore_chain,0);
+}
+
+int JessQuery_poll(JessQuery *Q, int ignore_chain, int steps)
+{
 	Atom **A;
-	Superposition *S;
 
-	while(Q->node)
+	while(Q->index<Q->end)
 	{
-		Superposition_free(Q->super);
-		Q->super=NULL;
+		Q->superposed=0;
 
 		if(!Q->scanner)
 		{
 			Q->scanner=Scanner_create(
 				Q->molecule,
-				Q->node->template,
+				Jess_template(Q->jess,Q->index),
 				Q->threshold,
 				Q->max_total_threshold
 				);
 
 			if(!Q->scanner)
 			{
-				Q->node=Q->node->next;
+				Q->index++;
 				continue;
 			}
+
+			Q->heaped=0;
+			if(Q->limit>=0.0) Scanner_limit(Q->scanner,Q->limit);
 		}
 
-		if((A=Scanner_next(Q->scanner, ignore_chain)))
+		if((A=Scanner_poll(Q->scanner, ignore_chain, steps)))
 		{
 			Q->atoms=A;
-			T = Q->node->template;
 
+			if(Q->limit>=0.0 && !JessQuery_keep(Q)) continue;
 			return 1;
 		}
 
+		// Out of steps, but not at the end of the scan...
+
+		if(!Scanner_finished(Q->scanner))
+		{
+			Q->atoms=NULL;
+			return -1;
+		}
+
 		Scanner_free(Q->scanner);
 		Q->scanner=NULL;
-
-		Superposition_free(Q->super);
-		Q->super=NULL;
+		Q->superposed=0;
 
 		Q->atoms=NULL;
-		Q->node=Q->node->next;
+		Q->index++;
 	}
 
 	// All done...
@@ -222,5 +276,96 @@ int JessQuery_next(JessQuery *Q, int ignore_chain)
 	return 0;
 }
 
+void JessQuery_limit(JessQuery *Q, double rmsd, int top)
+{
+	Q->limit=rmsd;
+	Q->top = rmsd>=0.0 && top>0 ? top:0;
+	Q->heaped=0;
+
+	free(Q->heap);
+	Q->heap = Q->top ? (double*)malloc(Q->top*sizeof(double)):NULL;
+
+	if(Q->scanner) Scanner_limit(Q->scanner,Q->limit);
+}
+
+JessQuery *JessQuery_split(JessQuery *Q)
+{
+	JessQuery *P;
+	Scanner *S;
+	int k;
+
+	// If there are templates left after the current one,
+	// give away the second half of them...
+
+	if(Q->index+1<Q->end)
+	{
+		k = Q->index+1;
+		k += (Q->end-k)/2;
+
+		P=Jess_queryRange(Q->jess,Q->molecule,k,Q->end,Q->threshold,Q->max_total_threshold);
+		JessQuery_limit(P,Q->limit,Q->top);
+		Q->end=k;
+		return P;
+	}
+
+	// ...otherwise give away part of the current scan.
+
+	if(Q->index<Q->end && Q->scanner && (S=Scanner_split(Q->scanner)))
+	{
+		P=Jess_queryRange(Q->jess,Q->molecule,Q->index,Q->index+1,Q->threshold,Q->max_total_threshold);
+
+		// The hits of Q so far all come before those of P,
+		// so P need not return any they beat (and S has the
+		// limit of Q already).
+
+		JessQuery_limit(P,Q->limit,Q->top);
+		if(P->heap) memcpy(P->heap,Q->heap,Q->heaped*sizeof(double));
+		P->heaped=Q->heaped;
+		P->scanner=S;
+		return P;
+	}
+
+	return NULL;
+}
+
+// Private methods of type JessQuery
 // ==================================================================
 
+static int JessQuery_keep(JessQuery *Q)
+{
+	double r = Superposition_rmsd(JessQuery_superposition(Q));
+	double *h = Q->heap;
+	int i,j;
+
+	if(r>Q->limit) return 0;
+	if(Q->top==0) return 1;
+
+	// Ties go to the hit found first.
+
+	if(Q->heaped==Q->top && r>=h[0]) return 0;
+
+	if(Q->heaped<Q->top)
+	{
+		for(i=Q->heaped++; i>0 && h[(i-1)/2]<r; i=(i-1)/2) h[i]=h[(i-1)/2];
+	}
+	else
+	{
+		for(i=0; (j=2*i+1)<Q->top; i=j)
+		{
+			if(j+1<Q->top && h[j+1]>h[j]) j++;
+			if(h[j]<=r) break;
+			h[i]=h[j];
+		}
+	}
+
+	h[i]=r;
+
+	// Once there are top hits, the worst of them is the
+	// limit for the rest of the scan.
+
+	if(Q->heaped==Q->top && h[0]<Q->limit) Scanner_limit(Q->scanner,h[0]);
+
+	return 1;
+}
+
+// ==================================================================
@@ -29,27 +29,48 @@ typedef struct _JessQuery JessQuery;
 // create()				Create a Jess module
 // free(J)				Free Jess object J (AND all templates)
 // addTemplate(J,T)		Add T to the list of templates for J
-// query(J,M,t)			Start a query on M using J threshold t
+// count(J)				Number of templates in J
+// template(J,k)		The kth template in search order
+// query(J,M,t,s)		Start a query on M using J threshold t
+// queryRange(J,M,a,b,t,s)	As query() but only on templates a,...,b-1
+// ==================================================================
+// Queries on disjoint ranges of templates are independent of each
+// other and may be run on different threads on the same molecule.
 // ==================================================================
 
 extern Jess *Jess_create(void);
 extern void Jess_free(Jess*);
 extern void Jess_addTemplate(Jess*,Template*);
+extern int Jess_count(const Jess*);
+extern Template *Jess_template(const Jess*,int);
 extern JessQuery *Jess_query(Jess*,Molecule*,double,double);
+extern JessQuery *Jess_queryRange(Jess*,Molecule*,int,int,double,double);
 
 // ==================================================================
 // Methods of type JessQuery
 // ==================================================================
 // free(Q)				Frees the query object (NOT the molecule)
 // next(Q)				Finds next result (true if successful)
+// poll(Q,i,n)			As next() but returns -1 if not done in n steps
+// limit(Q,r,k)			Only return hits with RMSD at most r (r<0: any)
+//						and, if k>0, that may be among the k lowest-RMSD
+//						hits of their template
+// split(Q)				Hand the later part of Q to a new query
 // template(Q)			Returns the template for the hit
 // molecule(Q)			Returns the molecule in which hit was found
 // atoms(Q)				Array of atoms for the hit
-// superposition(Q)		The superposition 
+// superposition(Q)		The superposition of the hit (Q's own, valid until
+//						the next call to next or poll)
+// ==================================================================
+// The results of a query returned by split(Q) are those Q would have
+// returned last. It may be run on a different thread to Q.
 // ==================================================================
 
 extern void JessQuery_free(JessQuery*);
 extern int JessQuery_next(JessQuery*, int);
+extern int JessQuery_poll(JessQuery*, int, int);
+extern void JessQuery_limit(JessQuery*,double,int);
+extern JessQuery *JessQuery_split(JessQuery*);
 extern Template *JessQuery_template(JessQuery*);
 extern const Molecule *JessQuery_molecule(JessQuery*);
 extern Atom **JessQuery_atoms(JessQuery*);
@@ -14,9 +14,11 @@
 // Forward declarations of local types
 // ==================================================================
 // KdTreeNode			One node of a KdTree
+// KdTreeItem			An entry on the stack of a KdTreeQuery
 // ==================================================================
 
 typedef struct _KdTreeNode KdTreeNode;
+typedef struct _KdTreeItem KdTreeItem;
 
 // ==================================================================
 // Local type KdTreeNode
@@ -26,6 +28,7 @@ typedef struct _KdTreeNode KdTreeNode;
 // left,right			Branches of tree (unless this is a leaf)
 // min,max				The box region encompassed by this node
 // depth				The depth of the tree below this node
+// lo,hi				The points below the node have ranks lo,...,hi-1
 // ==================================================================
 
 struct _KdTreeNode
@@ -37,29 +40,68 @@ struct _KdTreeNode
 	double *min;
 	double *max;
 	int depth;
+	int lo;
+	int hi;
+};
+
+// ==================================================================
+// Local type KdTreeItem
+// ==================================================================
+// node					A node still to be visited by the query (or
+//						NULL to test the points below one by one)
+// lo,hi				rank[lo],...,rank[hi-1] are the points of a
+//						masked query which lie below the node
+// ==================================================================
+
+struct _KdTreeItem
+{
+	KdTreeNode *node;
+	int lo;
+	int hi;
 };
 
 // ==================================================================
 // Declaration of methods of local type KdTreeNode
 // ==================================================================
-// create(...)			Creates a new node and its descendants
-// free(N)				Frees a node and all its descendants
+// create(K,idx,n,t,x)	Creates a new node and its descendants (with
+//						idx[] split as it already is if K is mapped)
 // ==================================================================
 
-static KdTreeNode *KdTreeNode_create(int*,int,int,double**,int);
-static void KdTreeNode_free(KdTreeNode*);
+static KdTreeNode *KdTreeNode_create(KdTree*,int*,int,int,const double**);
 
 // ==================================================================
 // type KdTree
 // ==================================================================
 // root					The root of the tree
 // dim					Dimension of the points
+// node					Block holding all 2n-1 nodes of the tree
+// bound				Block holding the min/max arrays of the nodes
+// used					Number of nodes handed out so far
+// order[r]				The point of rank r (the rth leaf)
+// rank[i]				The rank of point i
+// point				Coordinates of the points in order of rank
+// mapped				Whether order lies in a file written by
+//						KdTree_write (see KdTree_map)
+// ==================================================================
+// A tree is written as the number of points and their dimension,
+// then order and padding to a multiple of 8 bytes. That is all of
+// it that takes more than time of order n to find again: each node
+// splits the ranks below it in half, cycling through the axes, so
+// order gives the points below every node, and the rest follows
+// from them.
 // ==================================================================
 
 struct _KdTree
 {
 	KdTreeNode *root;
 	int dim;
+	KdTreeNode *node;
+	double *bound;
+	int used;
+	int *order;
+	int *rank;
+	double *point;
+	int mapped;
 };
 
 // ==================================================================
@@ -67,6 +109,7 @@ struct _KdTree
 // ==================================================================
 // tree					The tree which the query relates to
 // region				The region being queried (see Region.h)
+// rank					Ranks of the points queried (NULL: all of them)
 // count				Number of nodes on the stack
 // stack				The stack of nodes in the query
 // ==================================================================
@@ -75,21 +118,30 @@ struct _KdTreeQuery
 {
 	KdTree *tree;
 	Region *region;
+	const int *rank;
 	int count;
-	KdTreeNode *stack[0];
+	KdTreeItem stack[0];
 };
 
 
 // ==================================================================
-// Declaration of private methods/members of type KdTree
+// scanSize				A masked query tests this many points (or
+//						fewer) one by one rather than descend further
+// ==================================================================
+
+static const int scanSize = 8;
+
+// ==================================================================
+// Declaration of private methods of type KdTree
 // ==================================================================
-// compare(pa,pb)		Used during node creation (qsort)
-// data,index			Static globals (see KdTreeNode_create)
+// build(x,n,d)		Create kd-tree on points (x[0][i],...,x[d-1][i])
+// less(x,t,a,b)		Order on points a,b by coordinate t (then index)
+// select(idx,n,k,x,t)	Partially order idx[] about its kth element
 // ==================================================================
 
-static int KdTree_compare(const void*,const void*);
-static double **KdTree_data;
-static int KdTree_index;
+static KdTree *KdTree_build(const double**,int,int);
+static int KdTree_less(const double**,int,int,int);
+static void KdTree_select(int*,int,int,const double**,int);
 
 // ==================================================================
 // Local functions
@@ -105,14 +157,14 @@ static double dmax(double x, double y)
 	return x>y ? x:y;
 }
 
-static int imin(int x, int y)
+static int imax(int x, int y)
 {
-	return x<y ? x:y;
+	return x>y ? x:y;
 }
 
-static int imax(int x, int y)
+static long padding(long n)
 {
-	return x>y ? x:y;
+	return (8-n%8)%8;
 }
 
 // ==================================================================
@@ -122,60 +174,153 @@ static int imax(int x, int y)
 KdTree *KdTree_create(double **u, int n, int d)
 {
 	KdTree *K;
+	double **x;
 	int i,j;
-	int *tmp;
 
 	if(n<1 || d<1 || !u) return NULL;
 
-	// 1. Create memory for the object.
-
-	K = (KdTree*)calloc(1,sizeof(KdTree));
-	K->dim=d;
+	// Lay the coordinates out one axis at a time, which is
+	// how the tree is built.
 
-	// 3a. Create a temporary array to hold indices
-
-	tmp = (int*)calloc(n,sizeof(int));
-	for(i=0; i<n; i++) tmp[i]=i;
-
-	// 3b. Create the tree recursively. This takes time
-	// of order at most n.log(n)^2, assuming that qsort
-	// always manages n.log(n) and d is constant.
-
-	K->root = KdTreeNode_create(tmp,n,0,u,d);
-	free(tmp);
+	x=(double**)malloc(d*sizeof(double*));
+	x[0]=(double*)malloc(n*d*sizeof(double));
+	for(j=0; j<d; j++)
+	{
+		x[j]=&x[0][j*n];
+		for(i=0; i<n; i++) x[j][i]=u[i][j];
+	}
 
-	// 4. Return the result!
+	K=KdTree_build((const double**)x,n,d);
 
+	free(x[0]);
+	free(x);
 	return K;
 }
 
+KdTree *KdTree_createAxes(const double **x, int n, int d)
+{
+	if(n<1 || d<1 || !x) return NULL;
+	return KdTree_build(x,n,d);
+}
+
 void KdTree_free(KdTree *K)
 {
 	int i;
 
 	if(K)
 	{
-		KdTreeNode_free(K->root);
+		free(K->node);
+		free(K->bound);
+		if(!K->mapped) free(K->order);
+		free(K->rank);
+		free(K->point);
 		free(K);
 	}
 }
 
 KdTreeQuery *KdTree_query(KdTree *K, Region *R)
+{
+	return KdTree_queryMasked(K,R,NULL,0);
+}
+
+KdTreeQuery *KdTree_queryMasked(KdTree *K, Region *R, const int *rank, int n)
 {
 	KdTreeQuery *Q;
 	int rq;
 
-	rq = sizeof(KdTreeQuery)+K->root->depth*sizeof(KdTreeNode*);
+	rq = sizeof(KdTreeQuery)+K->root->depth*sizeof(KdTreeItem);
 
 	Q = (KdTreeQuery*)calloc(1,rq);
 	Q->tree=K;
 	Q->region=R;
-	Q->count=1;
-	Q->stack[0]=K->root;
+	Q->rank=rank;
+
+	if(!rank || n>0)
+	{
+		Q->count=1;
+		Q->stack[0].node=K->root;
+		Q->stack[0].lo=0;
+		Q->stack[0].hi=n;
+	}
 
 	return Q;
 }
 
+const int *KdTree_order(const KdTree *K)
+{
+	return K->order;
+}
+
+const int *KdTree_rank(const KdTree *K)
+{
+	return K->rank;
+}
+
+long KdTree_write(const KdTree *K, FILE *file)
+{
+	static const char zero[8];
+	int head[2];
+	long n,size;
+
+	n=K->root->hi;
+	head[0]=n;
+	head[1]=K->dim;
+	size=sizeof(head)+n*sizeof(int);
+
+	if(fwrite(head,sizeof(int),2,file)!=2
+		|| fwrite(K->order,sizeof(int),n,file)!=n
+		|| fwrite(zero,1,padding(size),file)!=padding(size))
+	{
+		return -1;
+	}
+
+	return size+padding(size);
+}
+
+KdTree *KdTree_map(const void *data, long size, const double **x, int n, int d)
+{
+	const int *head = (const int*)data;
+	KdTree *K;
+	int i,k;
+
+	// Check that this is a tree on n points of dimension d
+	// and that there is room for all of it.
+
+	if(n<1 || d<1 || size<2*sizeof(int) || head[0]!=n || head[1]!=d) return NULL;
+	if(size<2*sizeof(int)+n*sizeof(int)) return NULL;
+
+	K = (KdTree*)calloc(1,sizeof(KdTree));
+	K->dim=d;
+	K->mapped=1;
+	K->order=(int*)&head[2];
+	K->rank=(int*)malloc(n*sizeof(int));
+
+	// The order must be of every point once.
+
+	for(i=0; i<n; i++) K->rank[i]=-1;
+
+	for(k=0; k<n; k++)
+	{
+		i=K->order[k];
+		if(i<0 || i>=n || K->rank[i]>=0)
+		{
+			KdTree_free(K);
+			return NULL;
+		}
+		K->rank[i]=k;
+	}
+
+	// Lay out the nodes as KdTree_build would, but with the
+	// points below each already split (so with no selection).
+
+	K->node=(KdTreeNode*)malloc((2*n-1)*sizeof(KdTreeNode));
+	K->bound=(double*)malloc((2*n-1)*2*d*sizeof(double));
+	K->point=(double*)malloc(n*d*sizeof(double));
+	K->root=KdTreeNode_create(K,K->order,n,0,x);
+
+	return K;
+}
+
 // ==================================================================
 // Methods of type KdTreeQuery
 // ==================================================================
@@ -183,10 +328,13 @@ KdTreeQuery *KdTree_query(KdTree *K, Region *R)
 int KdTreeQuery_next(KdTreeQuery *Q)
 {
 	KdTreeNode *N;
+	KdTreeItem E;
 	Region *R = Q->region;
-	KdTreeNode **stack=&(Q->stack[0]);
+	KdTreeItem *stack=&(Q->stack[0]);
+	const int *rank = Q->rank;
 	int dim = Q->tree->dim;
 	int *count = &(Q->count);
+	int a,b,m;
 
 	// Until the stack is empty (or we return inside
 	// the while loop...
@@ -195,18 +343,42 @@ int KdTreeQuery_next(KdTreeQuery *Q)
 	{
 		// Pull the top node off the stack.
 
-		N = stack[--(*count)];
+		E = stack[--(*count)];
+		N = E.node;
+
+		// A masked query tests the last few points below a
+		// node one at a time, in order of rank, leaving the
+		// rest of them on the stack.
+
+		if(!N)
+		{
+			if(E.lo+1<E.hi)
+			{
+				stack[(*count)].node=NULL;
+				stack[(*count)].lo=E.lo+1;
+				stack[(*count)++].hi=E.hi;
+			}
+
+			if(R->inclusionQ(R,&Q->tree->point[dim*rank[E.lo]],dim))
+			{
+				return E.lo;
+			}
+
+			continue;
+		}
 
 		// If the node is a leaf we simply test it and
 		// remove it from the stack. If the point is in
 		// the query region, return it; otherwise continue
-		// with the rest of the stack.
+		// with the rest of the stack. (A leaf is only ever
+		// on the stack of a masked query if its point is
+		// one of those queried.)
 
 		if(N->type<0)
 		{
 			if(R->inclusionQ(R,N->min,dim))
 			{
-				return N->index;
+				return rank ? E.lo:N->index;
 			}
 			else
 			{
@@ -228,13 +400,77 @@ int KdTreeQuery_next(KdTreeQuery *Q)
 		// region. So now we must place the child nodes
 		// onto the stack.
 
-		stack[(*count)++]=N->left;
-		stack[(*count)++]=N->right;
+		if(!rank)
+		{
+			stack[(*count)].node=N->left;
+			stack[(*count)++].lo=0;
+			stack[(*count)].node=N->right;
+			stack[(*count)++].lo=0;
+			continue;
+		}
+
+		// For a masked query with few points below N, test
+		// them one by one. Otherwise split them between the
+		// children of N (by binary search on rank) and skip
+		// any child with none of them below it.
+
+		if(E.hi-E.lo<=scanSize)
+		{
+			stack[(*count)].node=NULL;
+			stack[(*count)].lo=E.lo;
+			stack[(*count)++].hi=E.hi;
+			continue;
+		}
+
+		a=E.lo;
+		b=E.hi;
+		while(a<b)
+		{
+			m=(a+b)/2;
+			if(rank[m]<N->right->lo) a=m+1; else b=m;
+		}
+
+		if(E.lo<a)
+		{
+			stack[(*count)].node=N->left;
+			stack[(*count)].lo=E.lo;
+			stack[(*count)++].hi=a;
+		}
+
+		if(a<E.hi)
+		{
+			stack[(*count)].node=N->right;
+			stack[(*count)].lo=a;
+			stack[(*count)++].hi=E.hi;
+		}
 	}
 
 	return -1;
 }
 
+KdTreeQuery *KdTreeQuery_split(KdTreeQuery *Q, Region *R)
+{
+	KdTreeQuery *P;
+	int m;
+
+	if(Q->count<1) return NULL;
+
+	// Nodes are popped from the top of the stack, so those
+	// at the bottom are the ones Q would have visited last.
+	// Give the bottom half of them (or the only one) away.
+
+	m = Q->count>1 ? Q->count/2:1;
+
+	P = KdTree_queryMasked(Q->tree,R,Q->rank,0);
+	memcpy(P->stack,Q->stack,m*sizeof(KdTreeItem));
+	P->count=m;
+
+	memmove(Q->stack,&Q->stack[m],(Q->count-m)*sizeof(KdTreeItem));
+	Q->count-=m;
+
+	return P;
+}
+
 void KdTreeQuery_free(KdTreeQuery *Q)
 {
 	if(Q)
@@ -248,36 +484,127 @@ void KdTreeQuery_free(KdTreeQuery *Q)
 // Private methods of type KdTree
 // ==================================================================
 
-static int KdTree_compare(const void *pa, const void *pb)
+static KdTree *KdTree_build(const double **x, int n, int d)
 {
-	const int a = *((const int*)pa);
-	const int b = *((const int*)pb);
-	double c = KdTree_data[a][KdTree_index];
-	double d = KdTree_data[b][KdTree_index];
+	KdTree *K;
+	int i;
+	int *tmp;
+
+	// 1. Create memory for the object. A tree on n points
+	// has exactly 2n-1 nodes so these are allocated in one
+	// block (as are their bounding boxes).
+
+	K = (KdTree*)calloc(1,sizeof(KdTree));
+	K->dim=d;
+	K->node=(KdTreeNode*)malloc((2*n-1)*sizeof(KdTreeNode));
+	K->bound=(double*)malloc((2*n-1)*2*d*sizeof(double));
+	K->point=(double*)malloc(n*d*sizeof(double));
+
+	// 3a. Create an array to hold indices. Building the tree
+	// leaves them in the order of the leaves of the tree.
+
+	tmp = (int*)malloc(n*sizeof(int));
+	for(i=0; i<n; i++) tmp[i]=i;
+	K->order=tmp;
+
+	// 3b. Create the tree recursively. Each level is split
+	// about its median by selection rather than sorting, so
+	// this takes time of order n.log(n) and uses no global
+	// state, i.e. trees may be built on many threads at once.
 
-	return c<d ? -1 : c>d ? 1 : 0;
+	K->root = KdTreeNode_create(K,tmp,n,0,x);
+
+	K->rank=(int*)malloc(n*sizeof(int));
+	for(i=0; i<n; i++) K->rank[tmp[i]]=i;
+
+	// 4. Return the result!
+
+	return K;
+}
+
+static int KdTree_less(const double **x, int type, int a, int b)
+{
+	double c = x[type][a];
+	double d = x[type][b];
+
+	// Ties are broken on the point index so that this is
+	// a strict total order and the tree is the same no
+	// matter how the selection below proceeds.
+
+	return c<d || (c==d && a<b);
+}
+
+static void KdTree_select(int *idx, int n, int k, const double **x, int type)
+{
+	int l,r,i,j,a,tmp;
+
+	// Quickselect (Hoare's FIND with a median-of-three
+	// pivot). On return idx[k] is the kth point in order
+	// of coordinate type, idx[0..k-1] are all less than it
+	// and idx[k+1..n-1] are all greater.
+
+#define SWAP(p,q) { tmp=idx[p]; idx[p]=idx[q]; idx[q]=tmp; }
+
+	l=0;
+	r=n-1;
+
+	while(r>l+1)
+	{
+		i=(l+r)/2;
+		SWAP(i,l+1);
+		if(KdTree_less(x,type,idx[r],idx[l])) SWAP(l,r);
+		if(KdTree_less(x,type,idx[r],idx[l+1])) SWAP(l+1,r);
+		if(KdTree_less(x,type,idx[l+1],idx[l])) SWAP(l,l+1);
+
+		i=l+1;
+		j=r;
+		a=idx[l+1];
+
+		for(;;)
+		{
+			do i++; while(KdTree_less(x,type,idx[i],a));
+			do j--; while(KdTree_less(x,type,a,idx[j]));
+			if(j<i) break;
+			SWAP(i,j);
+		}
+
+		idx[l+1]=idx[j];
+		idx[j]=a;
+
+		if(j>=k) r=j-1;
+		if(j<=k) l=i;
+	}
+
+	if(r==l+1 && KdTree_less(x,type,idx[r],idx[l])) SWAP(l,r);
+
+#undef SWAP
 }
 
 // ==================================================================
 // Methods of local type KdTreeNode
 // ==================================================================
 
-static KdTreeNode *KdTreeNode_create(int *idx,int n,int type,double **u,int dim)
+static KdTreeNode *KdTreeNode_create(KdTree *K,int *idx,int n,int type,const double **x)
 {
 	KdTreeNode *N;
+	int dim = K->dim;
 	int split;
-	int i,rq;
+	int i;
 
 	// 1. The really easy case. If n is 0 do nothing!
 
 	if(n<=0) return NULL;
 
 	// 1.5. We'll need to create a node in all other cases.
+	// Take the next one from the block owned by the tree.
 
-	rq = sizeof(KdTreeNode)+dim*2*sizeof(double);
-	N = (KdTreeNode*)calloc(1,rq);
-	N->min=(double*)&N[1];
-	N->max=&N->min[dim];
+	N = &K->node[K->used];
+	N->min = &K->bound[2*dim*K->used];
+	N->max = &N->min[dim];
+	N->left = N->right = NULL;
+	N->lo = idx-K->order;
+	N->hi = N->lo+n;
+	K->used++;
 
 	// 2. The easy case. If n is 1, create a leaf.
 
@@ -286,36 +613,30 @@ static KdTreeNode *KdTreeNode_create(int *idx,int n,int type,double **u,int dim)
 		N->type=-1;
 		N->index=idx[0];
 		N->depth=1;
-		memcpy(N->min,u[idx[0]],sizeof(double)*dim);
-		memcpy(N->max,u[idx[0]],sizeof(double)*dim);
+		for(i=0; i<dim; i++)
+		{
+			N->min[i]=N->max[i]=x[i][idx[0]];
+		}
+		memcpy(&K->point[dim*N->lo],N->min,sizeof(double)*dim);
 
 		return N;
 	}
 
-	// 2.5. Now we need to order the indices by coordinate
-	// numbered type. THIS IS NOT THREAD-SAFE. This kludge
-	// is used because it's not possible to pass extra
-	// parameters to qsort.
-
-	KdTree_data=u;
-	KdTree_index=type;
-	qsort(idx,n,sizeof(int),KdTree_compare);
-
 	// 3. The recursive case. Find [n/2] and split the array into
-	// two pieces. Create a node whose splitting value is the median.
-	// But make sure that if there are several entries with the same
-	// coordinate that we take the right-most.
+	// two pieces about the median by coordinate numbered type.
+	// Only the bounding boxes are used when querying the tree
+	// so points with equal coordinates may go either side.
 
 	split = n/2;
-	N->index=idx[split-1];
-	while(split<n-1 && u[split+1][type]==u[split][type]) split++;
+	if(!K->mapped) KdTree_select(idx,n,split,x,type);
+	N->index=idx[split];
 	N->type=type;
 
 	// Now create the left and right branches of the node.
 
 	type = (type+1)%dim;
-	N->left = KdTreeNode_create(idx,split,type,u,dim);
-	N->right = KdTreeNode_create(&idx[split],n-split,type,u,dim);
+	N->left = KdTreeNode_create(K,idx,split,type,x);
+	N->right = KdTreeNode_create(K,&idx[split],n-split,type,x);
 
 	// Compute max,min and depth...
 
@@ -332,15 +653,4 @@ static KdTreeNode *KdTreeNode_create(int *idx,int n,int type,double **u,int dim)
 	return N;
 }
 
-static void KdTreeNode_free(KdTreeNode *N)
-{
-	if(N)
-	{
-		KdTreeNode_free(N->left);
-		KdTreeNode_free(N->right);
-		free(N);
-	}
-}
-
 // ==================================================================
-
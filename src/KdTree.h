@@ -9,6 +9,7 @@
 #define KDTREE_H
 
 #include "Region.h"
+#include <stdio.h>
 
 // ==================================================================
 // Forward declarations
@@ -24,23 +25,55 @@ typedef struct _KdTreeQuery KdTreeQuery;
 // Methods of type KdTree
 // ==================================================================
 // create(u,n,k)			Create kd-tree on u[0],...,u[n-1]
+// createAxes(x,n,k)		Create kd-tree on points (x[0][i],...,x[k-1][i])
 // free(K)					Free the kd-tree K
 // query(K,R)				Initialise a query object (see code)
+// queryMasked(K,R,r,n)		Query only the points of ranks r[0..n-1]
+// order(K)					order[r] is the point of rank r
+// rank(K)					rank[i] is the rank of point i
+// write(K,f)				Write K to file f; returns the bytes written
+//							(a multiple of 8) or -1 on error
+// map(d,s,x,n,k)			The tree written to d[0..s-1] by write(),
+//							which must be on the n points of dimension k
+//							(x[0][i],...,x[k-1][i]) it was built on
+//							(else NULL)
+// ==================================================================
+// The rank of a point is its position among the leaves of the tree.
+// The ranks given to queryMasked() must be in increasing order, and
+// the query returns positions in that array rather than points. This
+// lets one tree on all points serve queries on many subsets of them.
+// ==================================================================
+// write() only writes the order of the points (4 bytes a point), and
+// map() uses it where it lies in d[] (so d must last as long as the
+// tree) and finds the nodes and their bounds again from the points,
+// in time of order n rather than n.log(n).
 // ==================================================================
 
 extern KdTree *KdTree_create(double**,int,int);
+extern KdTree *KdTree_createAxes(const double**,int,int);
 extern void KdTree_free(KdTree*);
 extern KdTreeQuery *KdTree_query(KdTree*,Region*);
+extern KdTreeQuery *KdTree_queryMasked(KdTree*,Region*,const int*,int);
+extern const int *KdTree_order(const KdTree*);
+extern const int *KdTree_rank(const KdTree*);
+extern long KdTree_write(const KdTree*,FILE*);
+extern KdTree *KdTree_map(const void*,long,const double**,int,int);
 
 // ==================================================================
 // Methods of type KdTreeQuery
 // ==================================================================
 // free(Q)					Free memory for query object AND region
 // next(Q)					Return next result in Q (-1 if no more)
+// split(Q,R)				Hand the later part of Q to a new query
+// ==================================================================
+// split(Q,R) returns a query on region R (which must select the same
+// points as the region of Q) that will return the results Q would
+// have returned last; Q keeps the rest. Returns NULL if Q is done.
 // ==================================================================
 
 extern void KdTreeQuery_free(KdTreeQuery*);
 extern int KdTreeQuery_next(KdTreeQuery*);
+extern KdTreeQuery *KdTreeQuery_split(KdTreeQuery*,Region*);
 
 // ==================================================================
 
@@ -7,6 +7,11 @@
 
 #include "Jess.h"
 #include "TessTemplate.h"
+#include "Archive.h"
+#include "Stream.h"
+#include "Writer.h"
+#include "Hit.h"
+#include "Filter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -14,190 +19,1425 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // ==================================================================
 // Global constants
 // ==================================================================
-// atomFormat			The format of a PDB ATOM record (for printf)
+// pollSteps			Steps a threaded search takes between checks
+//						for idle threads to give work to
 // ==================================================================
 
-static const char *atomFormat =
-	"ATOM  %5i%5s%c%-3s%c%c%4i%-4c%8.3f%8.3f%8.3f%6.2f%6.2f\n"; //Riziotis edit
-	//"ATOM  %5i%5s%c%-3s%c%c%4i%-4c%8.3f%8.3f%8.3f\n"; //Riziotis edit
-	//"ATOM  %5i%5s%c%-4s%c%4i%-4c%8.3f%8.3f%8.3f\n";
+static const int pollSteps = 4096;
+
+// ==================================================================
+// targetFormat			Line which starts each target in shard output
+// ==================================================================
+
+static const char *targetFormat = "#TARGET %ld\n";
+
+// ==================================================================
+// aheadDepth			Targets read ahead of the search by default
+// aheadBytes			Most bytes of target files held read ahead
+//						(beyond the first)
+// ==================================================================
+
+static const int aheadDepth = 8;
+static const long aheadBytes = 0x10000000;
+
+// ==================================================================
+// OUTPUT_TEXT			Hits as REMARK, ATOM records and ENDMDL
+// OUTPUT_TSV			Hits as lines of TSV (see Hit.h)
+// OUTPUT_BINARY		Hits as binary records (see Hit.h)
+// ==================================================================
+
+#define OUTPUT_TEXT 0
+#define OUTPUT_TSV 1
+#define OUTPUT_BINARY 2
 
 // ==================================================================
 // Global flags
 // ==================================================================
 // feedbackQ			Give feedback while processing
 // ==================================================================
+// This is only ever written while parsing the command line, i.e.
+// before any worker threads are started, so it is safe to read
+// from the search threads.
+// ==================================================================
 
 static int feedbackQ=0;
 
+// ==================================================================
+// Local type Options
+// ==================================================================
+// tRmsd				The RMSD threshold for reporting a hit
+// tDistance			The global distance cutoff
+// max_total_threshold	Hard limit on the per-atom distance cutoff
+// no_transform			Do not transform hits into template frame
+// ignore_chain			See the 'i' flag
+// write_filename		Write target filename instead of PDB code
+// ignore_endmdl		Parse atoms from all models
+// threads				Number of search threads (-t option)
+// shard,shards			Search shard i of N (--shard option; N=0: off)
+// archive				Archive the targets are read from (if not files)
+// stream				Whether the targets are one stream of structures
+// depth				Targets to read ahead (--ahead option; 0: off)
+// ahead				The read-ahead of a list of target files
+// writer				Where the hits go (to stdout)
+// format				One of OUTPUT_* above (--format option)
+// filter				Keep only the best hit of each template on
+//						each set of residues (--filter option)
+// top					Keep only the top lowest-RMSD hits of each
+//						template (--top option; 0: off)
+// atoms				Most atoms of any template (i.e. of any hit)
+// ==================================================================
+
+typedef struct _Options Options;
+typedef struct _Ahead Ahead;
+
+struct _Options
+{
+	double tRmsd;
+	double tDistance;
+	double max_total_threshold;
+	int no_transform;
+	int ignore_chain;
+	int write_filename;
+	int ignore_endmdl;
+	int threads;
+	int shard;
+	int shards;
+	Archive *archive;
+	int stream;
+	int depth;
+	Ahead *ahead;
+	Writer *writer;
+	int format;
+	int filter;
+	int top;
+	int atoms;
+};
+
+// ==================================================================
+// Local type Segment
+// ==================================================================
+// slot					The target this is part of
+// query				The part of the search of the target
+// taken				True once a worker has started on query
+// output				Buffered output of the query (when done)
+// size					Number of bytes in output
+// filter				The hits of query kept (with --filter or --top)
+//						rather than output
+// next					The segment which follows in the output
+// ==================================================================
+
+typedef struct _Segment Segment;
+typedef struct _Slot Slot;
+
+struct _Segment
+{
+	Slot *slot;
+	JessQuery *query;
+	int taken;
+	char *output;
+	size_t size;
+	Filter *filter;
+	Segment *next;
+};
+
+// ==================================================================
+// Local type Slot
+// ==================================================================
+// filename				The target filename
+// index				Position of the target in the target list
+// data,size			The target file itself, if it is from a stream
+// molecule				The target (shared by all its segments)
+// read					True once the target has been read
+// segment				The list of segments of the search
+// active				Number of segments not yet searched
+// done					True once all segments have been searched
+// ==================================================================
+
+struct _Slot
+{
+	char *filename;
+	long index;
+	char *data;
+	long size;
+	Molecule *molecule;
+	int read;
+	Segment *segment;
+	int active;
+	int done;
+};
+
+// ==================================================================
+// Local type Pool
+// ==================================================================
+// The worker pool used with -t N. Targets are placed in a ring of
+// slots by the main thread in input order. A worker reads each
+// target once and splits its templates into chunks; each is the
+// query of one segment of the target's output and may be searched
+// on any thread. A thread with nothing to do is given the later
+// part of some other thread's query (see JessQuery_split), which
+// becomes a new segment straight after that thread's own. The main
+// thread writes the segments out in order, so the output is
+// identical to a serial run.
+// ==================================================================
+// J					The (shared, read-only) templates
+// options				The search options
+// chunks				Number of template chunks per target
+// slot[k]				Ring of targets in flight
+// size					Number of slots in the ring
+// head					Next target to be written out
+// parsed				Next target to be read
+// tail					Next free position in the ring
+// queued				Number of segments waiting for a thread
+// running				Number of segments being searched
+// closed				True when there are no more targets
+// lock					Guards all of the above
+// work					Signalled when there is new work
+// done					Signalled when a target is finished
+// idle					Number of threads waiting for work
+// thread[k]			The worker threads
+// ==================================================================
+
+typedef struct _Pool Pool;
+
+struct _Pool
+{
+	Jess *J;
+	const Options *options;
+	int chunks;
+	Slot *slot;
+	int size;
+	long head;
+	long parsed;
+	long tail;
+	int queued;
+	int running;
+	int closed;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	atomic_int idle;
+	pthread_t *thread;
+};
+
+// ==================================================================
+// Local type Size
+// ==================================================================
+// size					Size of a target file (in bytes)
+// index				Position of the target in the target list
+// ==================================================================
+
+typedef struct _Size Size;
+
+struct _Size
+{
+	double size;
+	long index;
+};
+
+// ==================================================================
+// Local type Fetch
+// ==================================================================
+// filename				The target filename
+// index				Position of the target in the target list
+// data,size			The file (if read but not parsed)
+// molecule				The target (if parsed)
+// parsed				True if the target has been parsed
+// error				errno if the file could not be read, else 0
+// read					True once the file has been read
+// next					The target after this in the queue
+// ==================================================================
+
+typedef struct _Fetch Fetch;
+
+struct _Fetch
+{
+	char *filename;
+	long index;
+	char *data;
+	long size;
+	Molecule *molecule;
+	int parsed;
+	int error;
+	int read;
+	Fetch *next;
+};
+
+// ==================================================================
+// Local type Ahead
+// ==================================================================
+// The read-ahead stage for a list of target files (--ahead N): a
+// thread which reads the files of the next N targets, and with -t 1
+// parses them too, while earlier targets are searched, so that a run
+// goes at the pace of the slower of the disk and the search rather
+// than of the two in turn. Targets are added in the order of the
+// list and read in that order; with -t N the pool's workers take
+// them as they read their slots (see Pool_read), otherwise the main
+// thread searches each target once N more have been added.
+// ==================================================================
+// options				The search options
+// parse				Whether to parse the targets as well
+// first				The queue of targets not yet taken...
+// last					...and the link to add the next one at
+// cursor				The first target in the queue not yet read
+// count				Number of targets in the queue
+// held					Number of targets read (or being read) and not
+//						yet taken
+// bytes				Size of the files held read
+// closed				True when there are no more targets
+// lock					Guards all of the above
+// more					Signalled when a target is added or taken
+// ready				Signalled when a target has been read
+// thread				The reading thread
+// ==================================================================
+
+struct _Ahead
+{
+	const Options *options;
+	int parse;
+	Fetch *first;
+	Fetch **last;
+	Fetch *cursor;
+	int count;
+	int held;
+	long bytes;
+	int closed;
+	pthread_mutex_t lock;
+	pthread_cond_t more;
+	pthread_cond_t ready;
+	pthread_t thread;
+};
+
+// ==================================================================
+// Declaration of methods of local type Pool
+// ==================================================================
+
+static void Pool_share(Pool*,Segment*,JessQuery*);
+
 // ==================================================================
 // Local functions
 // ==================================================================
 
-static void output(
-	const Atom *A,
-	const double *M,
-	const double *c,
-	const double *v,
-	int no_transform
-	)
+static void mark(Writer *out,long index)
+{
+	char s[32];
+
+	// Start a target in shard output.
+
+	sprintf(s,targetFormat,index);
+	Writer_string(out,s);
+}
+
+static void output(
+	Writer *out,
+	const Atom *A,
+	const double *M,
+	const double *c,
+	const double *v,
+	int no_transform
+	)
+{
+	const AtomInfo *I = A->info;
+	double x[3];
+	int i,j;
+	char name[5];
+	char resName[4];
+
+	// First transform the coordinates according to the
+	// transform and centroids given as arguments. See
+	// also Super.h/Super.c (type Superposition).
+
+	//Riziotis edit
+	if (no_transform == 1)
+	{
+		for(i=0; i<3; i++)
+		{
+			x[i]=A->x[i];
+		}
+	}
+	
+	else
+	{
+		for(i=0; i<3; i++)
+		{
+			x[i]=0.0;
+			for(j=0; j<3; j++)
+			{
+				x[i] += M[3*i+j]*(A->x[j]-c[j]);
+			}
+
+			x[i] += v[i];
+		}
+	}
+
+	// Remove underscores from atom name and residue name
+
+	for(i=0; i<4 && I->name[i]; i++) name[i] = I->name[i]=='_' ? ' ':I->name[i];
+	name[i]=0;
+	for(i=0; i<3 && I->resName[i]; i++) resName[i] = I->resName[i]=='_' ? ' ':I->resName[i];
+	resName[i]=0;
+
+	// Output the ATOM record with the coordinates
+	// and names suitably transformed, i.e. as printf
+	// with the format (Riziotis edit)
+	//
+	// "ATOM  %5i%5s%c%-3s%c%c%4i%-4c%8.3f%8.3f%8.3f%6.2f%6.2f\n"
+	//
+	// of serial, name, altLoc, resName, chainID1, chainID2,
+	// resSeq, iCode, x, occupancy and tempFactor.
+
+	Writer_string(out,"ATOM  ");
+	Writer_integer(out,I->serial,5);
+	Writer_field(out,name,5,0);
+	Writer_character(out,I->altLoc);
+	Writer_field(out,resName,3,1);
+	Writer_character(out,A->chainID1);
+	Writer_character(out,A->chainID2);
+	Writer_integer(out,A->resSeq,4);
+	Writer_character(out,I->iCode);
+	Writer_string(out,"   ");
+	for(i=0; i<3; i++) Writer_fixed(out,x[i],8,3);
+	Writer_fixed(out,I->occupancy,6,2);
+	Writer_fixed(out,I->tempFactor,6,2);
+	Writer_character(out,'\n');
+}
+
+static Molecule *load(const char *filename,long index,const char *data,long size,const Options *O)
+{
+	Molecule *M;
+	FILE *file;
+
+	// A target in an archive is taken from it as it is
+	// (see Archive_molecule); it is read already.
+
+	if(O->archive)
+	{
+		if(!(M=Archive_molecule(O->archive,index)))
+		{
+			fprintf(stderr,"%s: bad molecule in archive\n",filename);
+		}
+
+		return M;
+	}
+
+	// A target from a stream has been split off from it
+	// already (see Stream_next).
+
+	if(data)
+	{
+		M = Molecule_read(data, size, O->ignore_endmdl);
+	}
+	else if(!(file=fopen(filename,"r")))
+	{
+		perror(filename);
+		return NULL;
+	}
+	else
+	{
+		M = Molecule_create(file, O->ignore_endmdl);
+		fclose(file);
+	}
+
+	if(!M)
+	{
+		fprintf(stderr,"%s: bad PDB, mmCIF or BinaryCIF file\n",filename);
+		return NULL;
+	}
+
+	return M;
+}
+
+static void residue(Writer *K,const Atom *A)
+{
+	const char *s = A->info->resName;
+	char c[2];
+	int i,n;
+
+	// Write the residue of A as resName_chain_resSeq, with
+	// the name and chain stripped as in an ATOM record.
+
+	for(i=0; i<3 && s[i] && (s[i]==' ' || s[i]=='_'); i++);
+	for(n=i; n<3 && s[n]; n++);
+	while(n>i && (s[n-1]==' ' || s[n-1]=='_')) n--;
+	for(; i<n; i++) Writer_character(K,s[i]=='_' ? ' ':s[i]);
+	Writer_character(K,'_');
+
+	c[0]=A->chainID1;
+	c[1]=A->chainID2;
+	for(i=0; i<2 && c[i]==' '; i++);
+	for(n=2; n>i && c[n-1]==' '; n--);
+	Writer_bytes(K,&c[i],n-i);
+	Writer_character(K,'_');
+	Writer_integer(K,A->resSeq,0);
+}
+
+static Filter *filter(const Options *O)
+{
+	// The filter of the hits of a target (or part of it),
+	// if they are filtered.
+
+	if(O->top>0) return Filter_create(O->top);
+	if(O->filter) return Filter_create(1);
+
+	return NULL;
+}
+
+static void keep(Filter *best,Writer *W,const Options *O,const char *id,Template *T,Atom **A,int count,double rmsd,double logE)
+{
+	Writer *K;
+	char *key,*data;
+	char s[32];
+	size_t size,n;
+	int i,j;
+
+	// Offer the hit just written to W to the filter. With
+	// --top, it is keyed by the template and scored by its
+	// RMSD.
+
+	data=Writer_take(W,&size);
+
+	if(O->top>0)
+	{
+		Filter_add(best,T->name(T),rmsd,data,size);
+		return;
+	}
+
+	// With --filter, as in filter_output.py, it is keyed
+	// by the template and the residues of the matched atoms
+	// (in order, each once), scored by log(E) as written
+	// (to 2 places), and left out if it is of the template
+	// on itself.
+
+	if(strcmp(id,T->name(T))==0)
+	{
+		free(data);
+		return;
+	}
+
+	K=Writer_create(NULL);
+	Writer_string(K,T->name(T));
+
+	for(i=0; i<count; i++)
+	{
+		for(j=0; j<i; j++)
+		{
+			if(A[j]->resSeq==A[i]->resSeq && A[j]->resName==A[i]->resName
+				&& A[j]->chainID1==A[i]->chainID1 && A[j]->chainID2==A[i]->chainID2) break;
+		}
+
+		if(j<i) continue;
+
+		Writer_character(K,i>0 ? ':':'\t');
+		residue(K,A[i]);
+	}
+
+	Writer_character(K,0);
+	key=Writer_take(K,&n);
+	Writer_free(K);
+
+	snprintf(s,sizeof(s),"%.2f",logE);
+	Filter_add(best,key,strtod(s,NULL),data,size);
+	free(key);
+}
+
+static void report(JessQuery *Q,const char *filename,long index,const Molecule *M,const Options *O,Writer *out,Filter *best,Pool *pool,Segment *G)
+{
+	Superposition *sup;
+	Template *T;
+	Writer *W;
+	Hit H;
+	Atom **A;
+	int i,count;
+	const double *P,*c[2];
+	double det;
+	double logE;
+	int r;
+
+	// With a filter, each hit is written on its own to
+	// be offered to it.
+
+	W = best ? Writer_create(NULL):out;
+
+	// A hit as a record lists its atoms in a buffer which
+	// is large enough for any template.
+
+	H.index = O->format!=OUTPUT_TEXT ? (int*)malloc(2*O->atoms*sizeof(int)):NULL;
+
+	// In a worker pool, search a few steps at a time and
+	// give work away to idle threads in between.
+
+	for(;;)
+	{
+		if(!pool)
+		{
+			if(!JessQuery_next(Q, O->ignore_chain)) break;
+		}
+		else
+		{
+			r=JessQuery_poll(Q, O->ignore_chain, pollSteps);
+			if(r==0) break;
+			Pool_share(pool,G,Q);
+			if(r<0) continue;
+		}
+
+		T=JessQuery_template(Q);
+
+		count=T->count(T);
+		sup = JessQuery_superposition(Q);
+		A = JessQuery_atoms(Q);
+
+		if(Superposition_rmsd(sup)<=O->tRmsd)
+		{
+			P=Superposition_rotation(sup);
+
+			// This is to check for the unusual case where
+			// P is computed as a matrix with determinant -1.
+			// THIS SHOULD NOT HAPPEN!
+
+			det = 0.0;
+			det += P[0]*(P[4]*P[8]-P[5]*P[7]);
+			det -= P[1]*(P[3]*P[8]-P[5]*P[6]);
+			det += P[2]*(P[3]*P[7]-P[4]*P[6]);
+
+			c[0]=Superposition_centroid(sup,0);
+			c[1]=Superposition_centroid(sup,1);
+
+
+			logE=T->logE(T,Superposition_rmsd(sup),Molecule_count(M));
+
+			// A hit as a record refers to the matched target
+			// atoms rather than writing them out transformed.
+
+			if(O->format!=OUTPUT_TEXT)
+			{
+				H.target=index;
+				H.id = O->write_filename==1 || !Molecule_id(M) ? filename:Molecule_id(M);
+				H.template=T->name(T);
+				H.rmsd=Superposition_rmsd(sup);
+				H.logE=logE;
+				H.det=det;
+				memcpy(H.rotation,P,sizeof(H.rotation));
+				memcpy(H.centroid[0],c[0],sizeof(H.centroid[0]));
+				memcpy(H.centroid[1],c[1],sizeof(H.centroid[1]));
+				H.count=count;
+				H.serial=&H.index[count];
+
+				for(i=0; i<count; i++)
+				{
+					H.index[i]=A[i]-Molecule_atoms(M);
+					H.serial[i]=A[i]->info->serial;
+				}
+
+				if(O->format==OUTPUT_TSV) Hit_tsv(&H,W);
+				else Hit_write(&H,W);
+
+				if(best) keep(best,W,O,H.id,T,A,count,H.rmsd,logE);
+				continue;
+			}
+
+			// i.e. "REMARK %s %.3f %s Det= %.1f log(E)~ %.2f\n"
+
+			Writer_string(W,"REMARK ");
+			if(O->write_filename==1){
+				Writer_string(W,filename);
+			}
+			else{
+				Writer_string(W,Molecule_id(M) ? Molecule_id(M):filename);
+			}
+			Writer_character(W,' ');
+			Writer_fixed(W,Superposition_rmsd(sup),0,3);
+			Writer_character(W,' ');
+			Writer_string(W,T->name(T));
+			Writer_string(W," Det= ");
+			Writer_fixed(W,det,0,1);
+			Writer_string(W," log(E)~ ");
+			Writer_fixed(W,logE,0,2);
+			Writer_character(W,'\n');
+
+			// Output the transformed target atoms if reverseQ is
+			// not specified.
+
+			for(i=0; i<count; i++)
+			{
+				output(W,A[i],P,c[0],c[1],O->no_transform);
+			}
+
+			Writer_string(W,"ENDMDL\n\n");
+
+			if(best)
+			{
+				keep(best,W,O,O->write_filename==1 || !Molecule_id(M) ? filename:Molecule_id(M),
+					T,A,count,Superposition_rmsd(sup),logE);
+			}
+		}
+	}
+
+	free(H.index);
+	if(best) Writer_free(W);
+}
+
+static void search(const char *filename,long index,Molecule *M,Jess *J,const Options *O,Writer *out)
+{
+	JessQuery *Q;
+	Filter *F;
+
+	if(!M) return;
+
+	// With --filter or --top, the hits kept are written
+	// once the whole target has been searched.
+
+	F=filter(O);
+	Q=Jess_query(J,M,O->tDistance,O->max_total_threshold);
+	JessQuery_limit(Q,O->tRmsd,O->top);
+	report(Q,filename,index,M,O,out,F,NULL,NULL);
+
+	if(F)
+	{
+		Filter_write(F,out);
+		Filter_free(F);
+	}
+
+	JessQuery_free(Q);
+	Molecule_free(M);
+}
+
+// ==================================================================
+// Methods of local type Fetch
+// ==================================================================
+
+static Molecule *Fetch_molecule(Fetch *F,const Options *O)
+{
+	// The target, parsing it if it has only been read.
+
+	if(F->error)
+	{
+		fprintf(stderr,"%s: %s\n",F->filename,strerror(F->error));
+		return NULL;
+	}
+
+	if(F->parsed) return F->molecule;
+
+	return load(F->filename,F->index,F->data,F->size,O);
+}
+
+static void Fetch_free(Fetch *F)
+{
+	free(F->filename);
+	free(F->data);
+	free(F);
+}
+
+// ==================================================================
+// Methods of local type Ahead
+// ==================================================================
+
+static void Ahead_read(Ahead *A,Fetch *F)
+{
+	struct stat st;
+	long n,room;
+	int fd;
+
+	// Read (or parse) one target, without the lock. A file
+	// which is only read is read whole, to be parsed by the
+	// thread which takes it.
+
+	if(A->parse)
+	{
+		F->molecule=load(F->filename,F->index,NULL,0,A->options);
+		F->parsed=1;
+		return;
+	}
+
+	if((fd=open(F->filename,O_RDONLY))<0)
+	{
+		F->error=errno;
+		return;
+	}
+
+	room = fstat(fd,&st)==0 && S_ISREG(st.st_mode) ? st.st_size+1:0x10000;
+	F->data=(char*)malloc(room);
+
+	while((n=read(fd,&F->data[F->size],room-F->size))!=0)
+	{
+		if(n<0 && errno==EINTR) continue;
+		if(n<0)
+		{
+			F->error=errno;
+			break;
+		}
+
+		F->size+=n;
+		if(F->size==room) F->data=(char*)realloc(F->data,room*=2);
+	}
+
+	close(fd);
+}
+
+static void *Ahead_reader(void *arg)
+{
+	Ahead *A = (Ahead*)arg;
+	Fetch *F;
+
+	pthread_mutex_lock(&A->lock);
+
+	for(;;)
+	{
+		// 1. Wait for a target to read and room to hold it
+		// (there is always room for one), or for the end.
+
+		while(A->cursor || !A->closed)
+		{
+			if(A->cursor && (A->held==0
+				|| (A->held<A->options->depth && A->bytes<aheadBytes))) break;
+			pthread_cond_wait(&A->more,&A->lock);
+		}
+
+		if(!A->cursor) break;
+
+		// 2. Read it.
+
+		F=A->cursor;
+		A->cursor=F->next;
+		A->held++;
+		pthread_mutex_unlock(&A->lock);
+
+		Ahead_read(A,F);
+
+		pthread_mutex_lock(&A->lock);
+		F->read=1;
+		A->bytes+=F->size;
+		pthread_cond_broadcast(&A->ready);
+	}
+
+	pthread_mutex_unlock(&A->lock);
+	return NULL;
+}
+
+static Ahead *Ahead_create(const Options *O,int parse)
+{
+	Ahead *A;
+
+	A=(Ahead*)calloc(1,sizeof(Ahead));
+	A->options=O;
+	A->parse=parse;
+	A->last=&A->first;
+	pthread_mutex_init(&A->lock,NULL);
+	pthread_cond_init(&A->more,NULL);
+	pthread_cond_init(&A->ready,NULL);
+
+	if(pthread_create(&A->thread,NULL,Ahead_reader,A))
+	{
+		perror("pthread_create");
+		exit(1);
+	}
+
+	return A;
+}
+
+static void Ahead_add(Ahead *A,const char *filename,long index)
+{
+	Fetch *F;
+
+	F=(Fetch*)calloc(1,sizeof(Fetch));
+	F->filename=strdup(filename);
+	F->index=index;
+
+	pthread_mutex_lock(&A->lock);
+	*A->last=F;
+	A->last=&F->next;
+	if(!A->cursor) A->cursor=F;
+	A->count++;
+	pthread_cond_broadcast(&A->more);
+	pthread_mutex_unlock(&A->lock);
+}
+
+static int Ahead_count(Ahead *A)
+{
+	int n;
+
+	pthread_mutex_lock(&A->lock);
+	n=A->count;
+	pthread_mutex_unlock(&A->lock);
+
+	return n;
+}
+
+static Fetch *Ahead_take(Ahead *A,long index)
+{
+	Fetch **L,*F;
+
+	// Take the target at the given index in the list (or
+	// if index<0 the first in the queue), waiting for it to
+	// be read.
+
+	pthread_mutex_lock(&A->lock);
+
+	for(;;)
+	{
+		for(L=&A->first; index>=0 && *L && (*L)->index!=index; L=&(*L)->next);
+		if(*L && (*L)->read) break;
+		pthread_cond_wait(&A->ready,&A->lock);
+	}
+
+	F=*L;
+	*L=F->next;
+	if(A->last==&F->next) A->last=L;
+	A->count--;
+	A->held--;
+	A->bytes-=F->size;
+	pthread_cond_broadcast(&A->more);
+
+	pthread_mutex_unlock(&A->lock);
+
+	F->next=NULL;
+	return F;
+}
+
+static void Ahead_free(Ahead *A)
+{
+	Fetch *F;
+
+	if(!A) return;
+
+	// Stop the reader (once it has read what it holds)
+	// and drop any targets not taken.
+
+	pthread_mutex_lock(&A->lock);
+	A->closed=1;
+	pthread_cond_broadcast(&A->more);
+	pthread_mutex_unlock(&A->lock);
+
+	pthread_join(A->thread,NULL);
+
+	while((F=A->first))
+	{
+		A->first=F->next;
+		Molecule_free(F->molecule);
+		Fetch_free(F);
+	}
+
+	pthread_cond_destroy(&A->ready);
+	pthread_cond_destroy(&A->more);
+	pthread_mutex_destroy(&A->lock);
+	free(A);
+}
+
+// ==================================================================
+// Methods of local type Pool
+// ==================================================================
+
+static Segment *Pool_task(Pool *P)
+{
+	Segment *G;
+	long k;
+
+	// Find the first segment waiting for a thread, taking
+	// the oldest targets first. Must be called with the
+	// lock held.
+
+	if(P->queued==0) return NULL;
+
+	for(k=P->head; k<P->parsed; k++)
+	{
+		if(!P->slot[k%P->size].read) continue;
+
+		for(G=P->slot[k%P->size].segment; G; G=G->next)
+		{
+			if(G->query && !G->taken)
+			{
+				G->taken=1;
+				P->queued--;
+				P->running++;
+				return G;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int Pool_pending(Pool *P)
+{
+	long k;
+
+	// True if some target is still being read (and so may
+	// yet produce segments to search).
+
+	for(k=P->head; k<P->parsed; k++)
+	{
+		if(!P->slot[k%P->size].read) return 1;
+	}
+
+	return 0;
+}
+
+static void Pool_share(Pool *P, Segment *G, JessQuery *Q)
+{
+	Segment *H;
+	JessQuery *R;
+
+	// If some thread is idle and there is nothing queued
+	// for it, hand it the later part of Q as a new segment
+	// which follows G.
+
+	if(atomic_load(&P->idle)==0) return;
+
+	pthread_mutex_lock(&P->lock);
+
+	if(P->queued==0 && (R=JessQuery_split(Q)))
+	{
+		H=(Segment*)calloc(1,sizeof(Segment));
+		H->slot=G->slot;
+		H->query=R;
+		H->next=G->next;
+		G->next=H;
+		G->slot->active++;
+		P->queued++;
+		pthread_cond_broadcast(&P->work);
+	}
+
+	pthread_mutex_unlock(&P->lock);
+}
+
+static void Pool_read(Pool *P, Slot *S)
+{
+	Segment **G;
+	Fetch *F;
+	int k,n;
+
+	// Read the target and split its templates into chunks,
+	// one per segment. Must be called without the lock; the
+	// segments are not looked at by other threads until S is
+	// marked as read.
+
+	if(P->options->ahead)
+	{
+		F=Ahead_take(P->options->ahead,S->index);
+		S->molecule=Fetch_molecule(F,P->options);
+		Fetch_free(F);
+	}
+	else S->molecule=load(S->filename,S->index,S->data,S->size,P->options);
+
+	free(S->data);
+	S->data=NULL;
+	if(!S->molecule) return;
+
+	n = Jess_count(P->J);
+	G = &S->segment;
+
+	for(k=0; k<P->chunks; k++)
+	{
+		*G=(Segment*)calloc(1,sizeof(Segment));
+		(*G)->slot=S;
+		(*G)->query=Jess_queryRange(
+			P->J,
+			S->molecule,
+			(int)((long)k*n/P->chunks),
+			(int)((long)(k+1)*n/P->chunks),
+			P->options->tDistance,
+			P->options->max_total_threshold
+			);
+		JessQuery_limit((*G)->query,P->options->tRmsd,P->options->top);
+		G = &(*G)->next;
+	}
+}
+
+static void *Pool_worker(void *arg)
+{
+	Pool *P = (Pool*)arg;
+	Segment *G;
+	Slot *S;
+	Writer *out;
+	char *buf;
+	size_t size;
+
+	pthread_mutex_lock(&P->lock);
+
+	for(;;)
+	{
+		// 1. Prefer searching a segment of a target which has
+		// already been read: this finishes the oldest targets
+		// first and keeps all threads busy on the last, largest
+		// targets of a run.
+
+		if((G=Pool_task(P)))
+		{
+			S=G->slot;
+			pthread_mutex_unlock(&P->lock);
+
+			out=Writer_create(NULL);
+			G->filter=filter(P->options);
+			report(G->query,S->filename,S->index,S->molecule,P->options,out,G->filter,P,G);
+			buf=Writer_take(out,&size);
+			Writer_free(out);
+
+			pthread_mutex_lock(&P->lock);
+			JessQuery_free(G->query);
+			G->query=NULL;
+			G->output=buf;
+			G->size=size;
+
+			// Threads waiting for work may stop once nothing
+			// is being searched that could be split for them.
+
+			if(--P->running==0 && P->closed)
+			{
+				pthread_cond_broadcast(&P->work);
+			}
+
+			// The last segment to finish frees the molecule
+			// and marks the target as ready to be written.
+
+			if(--S->active==0)
+			{
+				Molecule_free(S->molecule);
+				S->molecule=NULL;
+				S->done=1;
+				pthread_cond_broadcast(&P->done);
+			}
+
+			continue;
+		}
+
+		// 2. Otherwise read the next target.
+
+		if(P->parsed<P->tail)
+		{
+			S = &P->slot[P->parsed%P->size];
+			P->parsed++;
+			pthread_mutex_unlock(&P->lock);
+
+			Pool_read(P,S);
+
+			pthread_mutex_lock(&P->lock);
+			S->read=1;
+			S->active = S->molecule ? P->chunks:0;
+			P->queued += S->active;
+
+			if(S->active==0)
+			{
+				S->done=1;
+				pthread_cond_broadcast(&P->done);
+			}
+			else
+			{
+				pthread_cond_broadcast(&P->work);
+			}
+
+			continue;
+		}
+
+		// 3. Nothing to do: stop if nothing more can
+		// turn up, otherwise wait for it.
+
+		if(P->closed && P->running==0 && !Pool_pending(P)) break;
+
+		atomic_fetch_add(&P->idle,1);
+		pthread_cond_wait(&P->work,&P->lock);
+		atomic_fetch_sub(&P->idle,1);
+	}
+
+	pthread_mutex_unlock(&P->lock);
+	return NULL;
+}
+
+static void Pool_flush(Pool *P)
+{
+	Writer *out = P->options->writer;
+	Segment *G;
+	Filter *F;
+	Slot *S;
+
+	// Write out the oldest target in the ring, waiting
+	// for the workers to finish it if necessary. Must be
+	// called with the lock held. With --filter, the hits
+	// kept for the segments are merged in order, then
+	// written.
+
+	S = &P->slot[P->head%P->size];
+	while(!S->done) pthread_cond_wait(&P->done,&P->lock);
+
+	pthread_mutex_unlock(&P->lock);
+	if(P->options->shards>0) mark(out,S->index);
+	F=NULL;
+	while((G=S->segment))
+	{
+		if(!F) F=G->filter;
+		else if(G->filter) Filter_merge(F,G->filter);
+		Writer_bytes(out,G->output,G->size);
+		free(G->output);
+		S->segment=G->next;
+		free(G);
+	}
+	if(F)
+	{
+		Filter_write(F,out);
+		Filter_free(F);
+	}
+	pthread_mutex_lock(&P->lock);
+
+	free(S->filename);
+	memset(S,0,sizeof(Slot));
+	P->head++;
+}
+
+static Pool *Pool_create(Jess *J,const Options *O)
+{
+	Pool *P;
+	int k;
+
+	P=(Pool*)calloc(1,sizeof(Pool));
+	P->J=J;
+	P->options=O;
+	P->size=4*O->threads;
+	P->slot=(Slot*)calloc(P->size,sizeof(Slot));
+	pthread_mutex_init(&P->lock,NULL);
+	pthread_cond_init(&P->work,NULL);
+	pthread_cond_init(&P->done,NULL);
+	atomic_init(&P->idle,0);
+
+	// Each target is split into (at most) this many chunks
+	// of templates to begin with.
+
+	P->chunks = Jess_count(J)<P->size ? Jess_count(J):P->size;
+
+	P->thread=(pthread_t*)calloc(O->threads,sizeof(pthread_t));
+	for(k=0; k<O->threads; k++)
+	{
+		pthread_create(&P->thread[k],NULL,Pool_worker,P);
+	}
+
+	return P;
+}
+
+static void Pool_submit(Pool *P,const char *filename,long index,char *data,long size)
+{
+	// Queue the target (which takes over data), making
+	// room in the ring first by writing out finished
+	// targets if it is full.
+
+	pthread_mutex_lock(&P->lock);
+	while(P->tail-P->head>=P->size) Pool_flush(P);
+	P->slot[P->tail%P->size].filename=strdup(filename);
+	P->slot[P->tail%P->size].index=index;
+	P->slot[P->tail%P->size].data=data;
+	P->slot[P->tail%P->size].size=size;
+	P->tail++;
+	pthread_cond_broadcast(&P->work);
+	pthread_mutex_unlock(&P->lock);
+}
+
+static void Pool_free(Pool *P)
+{
+	int k;
+
+	// No more targets: let the workers drain the ring
+	// and write out what is left.
+
+	pthread_mutex_lock(&P->lock);
+	P->closed=1;
+	pthread_cond_broadcast(&P->work);
+	while(P->head<P->tail) Pool_flush(P);
+	pthread_mutex_unlock(&P->lock);
+
+	for(k=0; k<P->options->threads; k++)
+	{
+		pthread_join(P->thread[k],NULL);
+	}
+
+	pthread_cond_destroy(&P->done);
+	pthread_cond_destroy(&P->work);
+	pthread_mutex_destroy(&P->lock);
+	free(P->thread);
+	free(P->slot);
+	free(P);
+}
+
+// ==================================================================
+// Dispatch of targets
+// ==================================================================
+
+static void fetch(Jess *J,const Options *O)
 {
-	double x[3];
-	int i,j,k;
-	char name[5];
-	char resName[4];
+	Fetch *F;
 
-	// First transform the coordinates according to the
-	// transform and centroids given as arguments. See
-	// also Super.h/Super.c (type Superposition).
+	// Search the first target read ahead.
 
-	//Riziotis edit
-	if (no_transform == 1)
-	{
-		for(i=0; i<3; i++)
-		{
-			x[i]=A->x[i];
-		}
-	}
-	
-	else
-	{
-		for(i=0; i<3; i++)
-		{
-			x[i]=0.0;
-			for(j=0; j<3; j++)
-			{
-				x[i] += M[3*i+j]*(A->x[j]-c[j]);
-			}
+	F=Ahead_take(O->ahead,-1);
+	if(O->shards>0) mark(O->writer,F->index);
+	search(F->filename,F->index,Fetch_molecule(F,O),J,O,O->writer);
+	Fetch_free(F);
+}
 
-			x[i] += v[i];
-		}
-	}
+static void target(const char *filename,long index,char *data,long size,Jess *J,const Options *O,Pool *P)
+{
+	// (The target takes over data, if from a stream.) A file
+	// to be read ahead is queued for that first; without a
+	// pool, it is searched once depth more have been queued.
 
-	// Remove underscores from atom name and residue name
+	if(feedbackQ) fprintf(stderr,"%s\n",filename);
+
+	if(O->ahead) Ahead_add(O->ahead,filename,index);
 
-	strncpy(name,A->name,4);
-	strncpy(resName,A->resName,3);
-	name[4]=0;
-	resName[3]=0;
-	for(i=0; i<3; i++)
+	if(P)
 	{
-		if(resName[i]=='_') resName[i]=' ';
+		Pool_submit(P,filename,index,data,size);
+		return;
 	}
-	for(i=0; i<4; i++)
+
+	if(O->ahead)
 	{
-		if(name[i]=='_') name[i]=' ';
+		while(Ahead_count(O->ahead)>O->depth) fetch(J,O);
+		return;
 	}
 
-	// Output the ATOM record with the coordinates
-	// and names suitably transformed.
-
-	printf(
-		atomFormat,
-		A->serial,
-		name,
-		A->altLoc,
-		resName,
-		//Riziotis edit
-		A->chainID1,
-		A->chainID2,
-		//A->chainID,
-		A->resSeq,
-		A->iCode,
-		x[0],x[1],x[2],
-		A->occupancy,
-		A->tempFactor,
-		A->segID,
-		A->element,
-		A->charge
-		);
+	if(O->shards>0) mark(O->writer,index);
+	search(filename,index,load(filename,index,data,size,O),J,O,O->writer);
+	free(data);
 }
-static void search(const char *filename,Jess *J,double tRmsd,double tDistance,double max_total_threshold,int no_transform,int ignore_chain,int write_filename,int ignore_endmdl)
+
+// ==================================================================
+// Sharding
+// ==================================================================
+
+static int compareSize(const void *pa,const void *pb)
 {
-	Molecule *M;
-	Superposition *sup;
-	Template *T;
-	Atom **A;
-	FILE *file;
-	JessQuery *Q;
-	int i,j,k,count;
-	const double *P,*c[2];
-	double det;
-	double logE;
-	int killswitch = 0;
+	const Size *a = (const Size*)pa;
+	const Size *b = (const Size*)pb;
 
-	if(!(file=fopen(filename,"r")))
+	// Largest first, then in input order.
+
+	if(a->size!=b->size) return a->size>b->size ? -1:1;
+	return a->index<b->index ? -1 : a->index>b->index ? 1:0;
+}
+
+static long shard(char **name,long n,const Options *O,long *index)
+{
+	struct stat st;
+	Size *order;
+	double *load;
+	char *mine;
+	long i,k,m;
+	int s,best;
+
+	// Split the targets between the shards by the greedy
+	// longest-processing-time rule, using file size (or size
+	// in the archive) as the estimate of the cost of a target:
+	// largest first, each onto the least loaded shard. Ties go
+	// to the earlier target and the lower numbered shard, so
+	// every shard computes the same split. Returns the number
+	// of targets in our shard, and their positions in input
+	// order.
+
+	order=(Size*)calloc(n,sizeof(Size));
+	load=(double*)calloc(O->shards,sizeof(double));
+	mine=(char*)calloc(n,sizeof(char));
+
+	for(i=0; i<n; i++)
 	{
-		perror(filename);
-		return;
+		if(O->archive) order[i].size=(double)Archive_size(O->archive,i);
+		else order[i].size = stat(name[i],&st)==0 ? (double)st.st_size:0.0;
+		order[i].index=i;
 	}
 
-	M = Molecule_create(file, ignore_endmdl);
+	qsort(order,n,sizeof(Size),compareSize);
 
-	fclose(file);
-	if(!M)
+	for(k=0; k<n; k++)
 	{
-		fprintf(stderr,"%s: bad PDB file\n",filename);
-		return;
-	}
+		for(best=0,s=1; s<O->shards; s++)
+		{
+			if(load[s]<load[best]) best=s;
+		}
 
-	Q=Jess_query(J,M,tDistance,max_total_threshold);
+		load[best]+=order[k].size+1.0;
+		if(best==O->shard) mine[order[k].index]=1;
+	}
 
-	while(JessQuery_next(Q, ignore_chain) && killswitch<200)
+	for(i=0,m=0; i<n; i++)
 	{
-		T=JessQuery_template(Q);
+		if(mine[i]) index[m++]=i;
+	}
 
-		count=T->count(T);
-		sup = JessQuery_superposition(Q);
-		A = JessQuery_atoms(Q);
+	free(order);
+	free(load);
+	free(mine);
 
-		if(Superposition_rmsd(sup)<=tRmsd)
-		{
-			P=Superposition_rotation(sup);
+	return m;
+}
 
-			// This is to check for the unusual case where
-			// P is computed as a matrix with determinant -1.
-			// THIS SHOULD NOT HAPPEN!
+static void merge(int n,char **filename)
+{
+	FILE **file;
+	char **line;
+	size_t *size;
+	long *index;
+	int k,best;
 
-			det = 0.0;
-			det += P[0]*(P[4]*P[8]-P[5]*P[7]);
-			det -= P[1]*(P[3]*P[8]-P[5]*P[6]);
-			det += P[2]*(P[3]*P[7]-P[4]*P[6]);
+	// Merge the outputs of the shards of a run. Each is a
+	// sequence of targets (in increasing order) introduced
+	// by a targetFormat line. Repeatedly copy out the target
+	// with the lowest index of those at the heads of the
+	// files, dropping the targetFormat lines.
 
-			c[0]=Superposition_centroid(sup,0);
-			c[1]=Superposition_centroid(sup,1);
+	file=(FILE**)calloc(n,sizeof(FILE*));
+	line=(char**)calloc(n,sizeof(char*));
+	size=(size_t*)calloc(n,sizeof(size_t));
+	index=(long*)calloc(n,sizeof(long));
 
+	for(k=0; k<n; k++)
+	{
+		if(!(file[k]=fopen(filename[k],"r")))
+		{
+			perror(filename[k]);
+			exit(1);
+		}
 
-			logE=T->logE(T,Superposition_rmsd(sup),Molecule_count(M));
+		// Read up to the first target (if there is one).
 
-			if(write_filename==1){
-				printf("REMARK %s ",filename);
-			}
-			else{
-				printf("REMARK %s ",Molecule_id(M) ? Molecule_id(M):filename);
-			}
-			printf("%.3f ",Superposition_rmsd(sup));
-			printf("%s Det= %.1f log(E)~ %.2f\n",T->name(T),det,logE);
+		index[k]=-1;
+		while(getline(&line[k],&size[k],file[k])>=0)
+		{
+			if(sscanf(line[k],targetFormat,&index[k])==1) break;
+		}
+	}
 
-			// Output the transformed target atoms if reverseQ is
-			// not specified.
+	for(;;)
+	{
+		for(best=-1,k=0; k<n; k++)
+		{
+			if(index[k]<0) continue;
+			if(best<0 || index[k]<index[best]) best=k;
+		}
 
-			for(i=0; i<count; i++)
-			{
-				output(A[i],P,c[0],c[1],no_transform);
-			}
+		if(best<0) break;
 
-			printf("ENDMDL\n\n");
+		k=best;
+		index[k]=-1;
+		while(getline(&line[k],&size[k],file[k])>=0)
+		{
+			if(sscanf(line[k],targetFormat,&index[k])==1) break;
+			fputs(line[k],stdout);
 		}
-		//killswitch+=1;
 	}
 
-	JessQuery_free(Q);
-	Molecule_free(M);
+	for(k=0; k<n; k++)
+	{
+		fclose(file[k]);
+		free(line[k]);
+	}
+
+	free(file);
+	free(line);
+	free(size);
+	free(index);
 }
 
 static Jess *init(const char *filename)
@@ -284,10 +1524,41 @@ static void help(void)
 		"Jess version 0.4(gamma)\n"
 		"Copyright (c) Jonathan Barker, 2002\n"
 		"Command line syntax:\n\n"
-		"   jess <T> <S> <r> <d> <m> [F]\n\n"
+		"   jess [-t N] [--shard i/N] [--ahead N] [--stream] [--format F]\n"
+		"	 [--filter | --top K] <T> <S> <r> <d> <m> [F]\n"
+		"   jess --merge <shard output>...\n"
+		"   jess --pack <S> <A> [F]\n\n"
 		"where\n\n"
+		"   -t N searches N targets at a time on N threads. The\n"
+		"	 output is the same as (and in the same order as)\n"
+		"	 a run on a single thread\n"
+		"   --shard i/N searches only shard i (0<=i<N) of the targets,\n"
+		"	 split so that the shards have equal total file size\n"
+		"   --ahead N reads (and with -t 1 parses) up to N target files\n"
+		"	 ahead of the search on a separate thread (default 8; 0: off)\n"
+		"   --format F writes each hit as text (the default: REMARK,\n"
+		"	 ATOM records and ENDMDL), or as one line of TSV (tsv) or\n"
+		"	 one binary record (binary, not with --shard) giving the\n"
+		"	 superposition and the matched target atoms (see Hit.h)\n"
+		"   --filter writes, for each template, set of residues and\n"
+		"	 target, only the hit with the lowest log(E) (the first of\n"
+		"	 equals), leaving out a template's hits on itself; the\n"
+		"	 same hits as filter_output.py keeps, in the same order\n"
+		"   --top K writes, for each template and target, only the K\n"
+		"	 hits with the lowest RMSD (from the lowest up; the first\n"
+		"	 found of equals), pruning the search of branches whose hits\n"
+		"	 could not be among them\n"
+		"   --stream reads the targets from the one stream <S>: a tar\n"
+		"	 archive, or PDB files each ending with END (or mmCIF files),\n"
+		"	 optionally gzipped. Its shards are dealt out in turn\n"
+		"   --merge merges the outputs of the N shards of a run into\n"
+		"	 the output of a single run\n"
+		"   --pack reads the targets <S> into the archive <A>, which\n"
+		"	 may then be given as <S> to search them with no parsing.\n"
+		"	 Flags f and e are as below; k leaves out the kd-trees\n"
 		"   <T> is the name of the template list file\n"
-		"   <S> is a file containing a list of PDB filenames (use - for stdin)\n"
+		"   <S> is a file containing a list of PDB, mmCIF or BinaryCIF filenames,\n"
+		"	 optionally gzipped (use - for stdin), or an archive\n"
 		"   <r> is the RMSD threshold\n"
 		"   <d> is the distance cutoff\n"
 		"   <m>: the maximum allowed template/query atom distance\n"
@@ -311,12 +1582,89 @@ static void help(void)
 
 	exit(1);
 }
+
+// ==================================================================
+// Packing
+// ==================================================================
+
+static void pack(int n,char **arg)
+{
+	FILE *file;
+	char buf[0x100];
+	const char *s;
+	Options O;
+	Archive *A;
+	Molecule *M;
+	int k,trees=1,ok=1;
+
+	// Read every target in the list arg[0] (as a search with
+	// the flags arg[2] would) into the archive arg[1].
+
+	if(n<2 || n>3) help();
+
+	memset(&O,0,sizeof(Options));
+
+	if(n==3)
+	{
+		for(s=arg[2]; *s; s++)
+		{
+			if(*s=='f') feedbackQ=1;
+			else if(*s=='e') O.ignore_endmdl=1;
+			else if(*s=='k') trees=0;
+			else help();
+		}
+	}
+
+	if(strcmp(arg[0],"-")==0)
+	{
+		file=stdin;
+	}
+	else if(!(file=fopen(arg[0],"r")))
+	{
+		perror(arg[0]);
+		exit(1);
+	}
+
+	if(!(A=Archive_create(arg[1],trees))) exit(1);
+
+	while(ok && fgets(buf,0x100,file))
+	{
+		// Strip out blank lines and leading/trailing
+		// spaces from the line...
+
+		for(s=buf; isspace(*s); s++);
+		for(k=strlen(s); k>0 && isspace(s[k-1]); k--);
+		buf[k]=0;
+		if(strlen(s)==0) continue;
+
+		if(feedbackQ) fprintf(stderr,"%s\n",buf);
+
+		if(!(M=load(buf,-1,NULL,0,&O))) continue;
+		if(!(ok=Archive_add(A,buf,M))) perror(arg[1]);
+		Molecule_free(M);
+	}
+
+	fclose(file);
+
+	if(!Archive_close(A) || !ok) exit(1);
+}
+
 // ==================================================================
 // Entry point
 // ==================================================================
+// Options:
+//	-t N			Number of search threads (default 1)
+//	--shard i/N		Only search shard i (0,...,N-1) of the targets
+//	--ahead N		Number of target files to read ahead (default 8)
+//	--stream		The targets are one stream of structures
+//	--filter		Keep only the best hit per template and residues
+//	--top K			Keep only the K lowest-RMSD hits per template
+//	--format F		Write hits as text, tsv or binary records
+//	--merge F...	Merge the outputs F... of all shards of a run
+//	--pack S A [F]	Pack the targets listed in S into the archive A
 // Arguments:
 //	1				A file containing template filenames
-//	2				A file containing PDB filenames
+//	2				A file containing PDB filenames (or the stream)
 //	3				RMSD threshold (default 2)
 //	4				Distance threshold (default 1)
 //	5				Maximum total distance thresold
@@ -327,20 +1675,100 @@ int main(int argc, char **argv)
 	FILE *file;
 	char buf[0x100];
 	const char *s;
-	double tRmsd;
-	double tDistance;
-	double max_total_threshold;
+	Options O;
+	Pool *P;
 	Jess *J;
-	int line,k;
-	int count;
-	//Riziotis edit
-	int no_transform=0;
-	int ignore_chain=0;
-	int write_filename=0;
-	int ignore_endmdl=0;
+	Template *T;
+	Stream *S;
+	char **name;
+	char *data,*id;
+	long *index;
+	long count,size,n;
+	int k;
+
+	memset(&O,0,sizeof(Options));
+	O.threads=1;
+	O.depth=aheadDepth;
+
+	// Merging shard outputs is a job on its own...
+
+	if(argc>1 && strcmp(argv[1],"--merge")==0)
+	{
+		merge(argc-2,&argv[2]);
+		return 0;
+	}
+
+	// ...as is packing targets into an archive.
+
+	if(argc>1 && strcmp(argv[1],"--pack")==0)
+	{
+		pack(argc-2,&argv[2]);
+		return 0;
+	}
+
+	// Get leading options
+
+	while(argc>1 && argv[1][0]=='-' && argv[1][1])
+	{
+		if(strcmp(argv[1],"-t")==0 && argc>2)
+		{
+			O.threads=atoi(argv[2]);
+			if(O.threads<1) help();
+			argc-=2;
+			argv+=2;
+		}
+		else if(strcmp(argv[1],"--shard")==0 && argc>2)
+		{
+			if(sscanf(argv[2],"%i/%i",&O.shard,&O.shards)!=2) help();
+			if(O.shards<1 || O.shard<0 || O.shard>=O.shards) help();
+			argc-=2;
+			argv+=2;
+		}
+		else if(strcmp(argv[1],"--ahead")==0 && argc>2)
+		{
+			O.depth=atoi(argv[2]);
+			if(O.depth<0) help();
+			argc-=2;
+			argv+=2;
+		}
+		else if(strcmp(argv[1],"--format")==0 && argc>2)
+		{
+			if(strcmp(argv[2],"text")==0) O.format=OUTPUT_TEXT;
+			else if(strcmp(argv[2],"tsv")==0) O.format=OUTPUT_TSV;
+			else if(strcmp(argv[2],"binary")==0) O.format=OUTPUT_BINARY;
+			else help();
+			argc-=2;
+			argv+=2;
+		}
+		else if(strcmp(argv[1],"--top")==0 && argc>2)
+		{
+			O.top=atoi(argv[2]);
+			if(O.top<1) help();
+			argc-=2;
+			argv+=2;
+		}
+		else if(strcmp(argv[1],"--filter")==0)
+		{
+			O.filter=1;
+			argc--;
+			argv++;
+		}
+		else if(strcmp(argv[1],"--stream")==0)
+		{
+			O.stream=1;
+			argc--;
+			argv++;
+		}
+		else help();
+	}
 
 	if(argc<6 || argc>7) help();
 
+	// (Shards are marked by lines, which binary output lacks.)
+
+	if(O.format==OUTPUT_BINARY && O.shards>0) help();
+	if(O.filter && O.top>0) help();
+
 	// Get optional flags
 
 	if(argc==7)
@@ -349,18 +1777,31 @@ int main(int argc, char **argv)
 		{
 			if(*s=='f') feedbackQ=1;
 			//Riziotis edit
-			else if(*s=='n') no_transform=1;
-			else if(*s=='i') ignore_chain=1;
-			else if(*s=='q') write_filename=1;
-			else if(*s=='e') ignore_endmdl=1;
+			else if(*s=='n') O.no_transform=1;
+			else if(*s=='i') O.ignore_chain=1;
+			else if(*s=='q') O.write_filename=1;
+			else if(*s=='e') O.ignore_endmdl=1;
 			else help();
 		}
 	}
 
 	J=init(argv[1]);
-	tRmsd=atof(argv[3]);
-	tDistance=atof(argv[4]);
-	max_total_threshold=atof(argv[5]);
+
+	for(k=0; k<Jess_count(J); k++)
+	{
+		T=Jess_template(J,k);
+		if(T->count(T)>O.atoms) O.atoms=T->count(T);
+	}
+
+	O.tRmsd=atof(argv[3]);
+	O.tDistance=atof(argv[4]);
+	O.max_total_threshold=atof(argv[5]);
+
+	// The targets are the structures in a stream, if asked,
+	// or the molecules in an archive, if that is what we are
+	// given, or else the files in a list.
+
+	file=NULL;
 
 	if(strcmp(argv[2],"-")==0)
 	{
@@ -371,12 +1812,74 @@ int main(int argc, char **argv)
 		perror(argv[2]);
 		exit(1);
 	}
+	else if(!O.stream && Archive_check(file))
+	{
+		fclose(file);
+		file=NULL;
 
-	line=0;
-	while(fgets(buf,0x100,file))
+		if(!(O.archive=Archive_open(argv[2])))
+		{
+			fprintf(stderr,"%s: cannot map the archive\n",argv[2]);
+			exit(1);
+		}
+	}
+
+	// The files in a list are read ahead of the search (and
+	// without a pool, parsed too).
+
+	if(file && !O.stream && O.depth>0) O.ahead=Ahead_create(&O,O.threads==1);
+
+	if(O.format==OUTPUT_BINARY && !Hit_header(stdout))
 	{
-		line++;
+		perror("stdout");
+		exit(1);
+	}
+
+	O.writer=Writer_create(stdout);
+	P = O.threads>1 ? Pool_create(J,&O):NULL;
+
+	// A stream is searched as it is read, so its sizes are
+	// not known up front: its shards are dealt round-robin.
+
+	if(O.stream)
+	{
+		S=Stream_create(file,argv[2]);
+
+		for(n=0; (k=Stream_next(S,&data,&size,&id))>0; n++)
+		{
+			if(O.shards==0 || n%O.shards==O.shard)
+			{
+				target(id,n,data,size,J,&O,P);
+			}
+			else free(data);
+
+			free(id);
+		}
+
+		if(k<0) fprintf(stderr,"%s: corrupt stream\n",argv[2]);
+
+		Stream_free(S);
+		fclose(file);
+		file=NULL;
+	}
+
+	// Without sharding, targets are searched as they are read.
+	// With it, the whole list must be read first to split it.
+
+	name=NULL;
+	count=size=0;
+
+	if(O.archive)
+	{
+		count=Archive_count(O.archive);
+		for(n=0; O.shards==0 && n<count; n++)
+		{
+			target(Archive_name(O.archive,n),n,NULL,0,J,&O,P);
+		}
+	}
 
+	while(file && fgets(buf,0x100,file))
+	{
 		// Strip out blank lines and leading/trailing
 		// spaces from the line...
 
@@ -385,15 +1888,49 @@ int main(int argc, char **argv)
 		buf[k]=0;
 		if(strlen(s)==0) continue;
 
-		if(feedbackQ) fprintf(stderr,"%s\n",s);
-		search(buf,J,tRmsd,tDistance,max_total_threshold,no_transform,ignore_chain,write_filename,ignore_endmdl);
+		if(O.shards==0)
+		{
+			target(buf,count++,NULL,0,J,&O,P);
+			continue;
+		}
+
+		if(count==size)
+		{
+			size = size ? 2*size:256;
+			name=(char**)realloc(name,size*sizeof(char*));
+		}
+
+		name[count++]=strdup(buf);
 	}
 
-	fclose(file);
+	if(file) fclose(file);
+
+	if(O.shards>0 && !O.stream)
+	{
+		index=(long*)calloc(count ? count:1,sizeof(long));
+		n=shard(name,count,&O,index);
+
+		for(k=0; k<n; k++)
+		{
+			s = O.archive ? Archive_name(O.archive,index[k]):name[index[k]];
+			target(s,index[k],NULL,0,J,&O,P);
+		}
+
+		for(k=0; name && k<count; k++) free(name[k]);
+		free(name);
+		free(index);
+	}
+
+	// Search what is left of the read-ahead, then stop it.
+
+	while(O.ahead && !P && Ahead_count(O.ahead)>0) fetch(J,&O);
+
+	if(P) Pool_free(P);
+	Ahead_free(O.ahead);
+	Writer_free(O.writer);
+	Archive_close(O.archive);
 
 	return 0;
 }
 
 // ==================================================================
-
-
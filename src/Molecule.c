@@ -6,134 +6,914 @@
 // ==================================================================
 
 #include "Molecule.h"
+#include "CandidateSet.h"
+#include "BinaryCif.h"
+#include "Gzip.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // ==================================================================
-// Local type Node
+// type Molecule
 // ==================================================================
-// next					Next node in the list of all nodes
-// atom					Atom record stored at this node
+// count				Number of atoms in the molecule
+// id					The molecule PDB code (if found)
+// cache				Candidate sets of the templates searched so far,
+//						and the tree of the positions of all the atoms
+// atom[k]				The kth atom in the molecule
+// info[k]				The rest of the record of the kth atom
+// x[i][k]				ith coordinate of the kth atom
+// mapped				Whether x lies in a file written by
+//						Molecule_write (see Molecule_map)
 // ==================================================================
 
-typedef struct _Node Node;
-
-struct _Node
+struct _Molecule
 {
-	Node *next;
+	int count;
+	char id[5];
+	CandidateCache *cache;
 	Atom *atom;
+	AtomInfo *info;
+	double *x[3];
+	int mapped;
 };
 
 // ==================================================================
-// type Molecule
+// Local types Record, Packed and Label
 // ==================================================================
+// Record: the start of a molecule as written by Molecule_write
 // count				Number of atoms in the molecule
-// id					The molecule PDB code (if found)
-// atom[k]				Pointer to kth atom in the molecule
+// tree					Whether its tree is written too
+// labels				Number of Labels written
+// id					The PDB code
+// ==================================================================
+// Packed: the fields of an atom other than its coordinates and labels
+// serial,altLoc,iCode,	As in AtomInfo
+// occupancy,tempFactor
+// resSeq,chainID1,		As in Atom
+// chainID2
+// label				Which of the Labels the atom has
+// ==================================================================
+// Label: text fields which many atoms share
+// name,resName,segID,	As in AtomInfo
+// element,charge
+// ==================================================================
+// A molecule is written as a Record, then its coordinates one axis at
+// a time (once: the atoms and the tree are laid out again from them),
+// then the Packed record of each atom, then the distinct Labels of
+// the atoms and last (if tree is set) its tree, as written by
+// KdTree_write; each part padded to a multiple of 8 bytes. The ids
+// and flags of the names of an Atom follow from its Label.
 // ==================================================================
 
-struct _Molecule
+typedef struct _Record Record;
+typedef struct _Packed Packed;
+typedef struct _Label Label;
+
+struct _Record
 {
 	int count;
-	char id[5];
-	Atom *atom[0];
+	int tree;
+	int labels;
+	char id[8];
+};
+
+struct _Packed
+{
+	int serial;
+	int resSeq;
+	int label;
+	char chainID1;
+	char chainID2;
+	char altLoc;
+	char iCode;
+	double occupancy;
+	double tempFactor;
 };
 
+struct _Label
+{
+	char name[5];
+	char resName[4];
+	char segID[4];
+	char element[3];
+	int charge;
+};
+
+// ==================================================================
+// Local type Reader
+// ==================================================================
+// size					Number of atoms there is room for in the molecule
+// pdb					The PDB code (if found)
+// all					Whether to read all models or just the first
+// format				READ_PDB or READ_CIF once the file is recognised
+// state				Where an mmCIF reader is (CIF_* below)
+// blocks				Number of data blocks begun
+// text					Whether inside a multi-line text value
+// columns				Number of columns in the current loop
+// field[c]				Field (ATOM_SITE_*) in column c, or -1 if unused
+// column				Column of the next value in the loop
+// rows					Number of rows of _atom_site read
+// model				Model number of the first row
+// value[f]				Value of field f in the current row...
+// length[f]			...and its length (0 if missing or null)
+// pointer[f]			Points to value[f]
+// ==================================================================
+
+typedef struct _Reader Reader;
+
+struct _Reader
+{
+	int size;
+	char pdb[5];
+	int all;
+	int format;
+	int state;
+	int blocks;
+	int text;
+	int columns;
+	int *field;
+	int column;
+	int rows;
+	int model;
+	char value[ATOM_SITE_FIELDS][0x20];
+	int length[ATOM_SITE_FIELDS];
+	const char *pointer[ATOM_SITE_FIELDS];
+};
+
+// ==================================================================
+// Local type Site
+// ==================================================================
+// key[i]				Index of the string in the ith column of strings
+//						of a BinaryCIF _atom_site (or -1 if none)
+// ok					Whether the strings are those of an atom...
+// atom,info			...and if so the atom read from them
+// ==================================================================
+
+typedef struct _Site Site;
+
+struct _Site
+{
+	int key[ATOM_SITE_FIELDS];
+	int ok;
+	Atom atom;
+	AtomInfo info;
+};
+
+// ==================================================================
+// READ_PDB, READ_CIF	The formats of file read
+// CIF_OUTSIDE			Not in a loop (or not in one of interest)
+// CIF_LOOP				In the header of a loop
+// CIF_ROWS				In the rows of the _atom_site loop
+// BLANK(c)				Whether c is an mmCIF blank
+// ==================================================================
+
+#define READ_PDB 1
+#define READ_CIF 2
+
+#define CIF_OUTSIDE 0
+#define CIF_LOOP 1
+#define CIF_ROWS 2
+
+#define BLANK(c) ((unsigned char)(c)<=' ')
+
+// ==================================================================
+// siteField			Names of the _atom_site items read (by field)
+// ==================================================================
+
+static const char *siteField[ATOM_SITE_FIELDS] =
+{
+	"group_PDB","id","type_symbol","auth_atom_id","label_atom_id",
+	"label_alt_id","auth_comp_id","label_comp_id","auth_asym_id",
+	"label_asym_id","auth_seq_id","label_seq_id","pdbx_PDB_ins_code",
+	"Cartn_x","Cartn_y","Cartn_z","occupancy","B_iso_or_equiv",
+	"pdbx_formal_charge","pdbx_PDB_model_num"
+};
+
+// ==================================================================
+// Private methods of type Molecule
+// ==================================================================
+// begin(R,all)			Create an empty molecule, to be read with R
+// buffer(M,R,d,n)		Read the file d[0..n-1] into M; false if it
+//						is corrupt
+// end(M,R,ok)			Finish reading M (or free it and return NULL
+//						if it is empty or not ok)
+// line(M,R,s,n)		Read the line s[0..n-1] into M; false at the end
+// pdb(M,R,s,n)			Read a line of a PDB file
+// cif(M,R,s,n)			Read a line of an mmCIF file
+// token(M,R,t,m,q)		Read the mmCIF token t[0..m-1] (q if quoted)
+// site(M,R)			Read the _atom_site row in R into M
+// binary(M,R,d,n)		Read the BinaryCIF file d[0..n-1] into M
+// gzip(M,R,G)			Read the file inflated by G into M; false if
+//						it is corrupt
+// ==================================================================
+
+static Molecule *Molecule_begin(Reader*,int);
+static int Molecule_buffer(Molecule*,Reader*,const char*,long);
+static Molecule *Molecule_end(Molecule*,Reader*,int);
+static int Molecule_line(Molecule*,Reader*,const char*,int);
+static int Molecule_pdb(Molecule*,Reader*,const char*,int);
+static int Molecule_cif(Molecule*,Reader*,const char*,int);
+static int Molecule_token(Molecule*,Reader*,const char*,int,int);
+static int Molecule_site(Molecule*,Reader*);
+static void Molecule_binary(Molecule*,Reader*,const char*,long);
+static int Molecule_gzip(Molecule*,Reader*,Gzip*);
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static long padding(long n)
+{
+	return (8-n%8)%8;
+}
+
+static long rounded(long n)
+{
+	return n+padding(n);
+}
+
+static unsigned int hashLabel(const Label *L)
+{
+	const unsigned char *p = (const unsigned char*)L;
+	unsigned int h=2166136261u;
+	int i;
+
+	for(i=0; i<sizeof(Label); i++) h=(h^p[i])*16777619u;
+	return h;
+}
+
+static void append(char **s, long *n, long *size, const char *t, long m)
+{
+	if(*n+m>*size)
+	{
+		for(*size = *size ? *size:0x1000; *n+m>*size; *size*=2);
+		*s=(char*)realloc(*s,*size);
+	}
+
+	memcpy(&(*s)[*n],t,m);
+	*n+=m;
+}
+
 // ==================================================================
 // Methods of type Molecule;
 // ==================================================================
 
 Molecule *Molecule_create(FILE *file, int ignore_endmdl)
 {
-	Node *head=NULL;
-	Node *N;
-	Atom A;
-	Atom *pA;
 	Molecule *M;
-	char buf[0x100];
-	char pdb[5];
-	int count=0;
+	Reader R;
+	struct stat st;
+	const char *text;
+	char buf[0x1000];
+	char *data,*line=NULL;
+	long size,length;
+	off_t offset;
+	Gzip *G;
+	int i,k,ok=1,more=1;
 
-	pdb[0]=0;
+	M=Molecule_begin(&R,ignore_endmdl);
 
-	// Loop through the file and read all of the ATOM
-	// records. Discard all altLoc atoms and those which
-	// occur after the end of the first MODEL.
+	// Loop through the file and read all of the atoms
+	// straight into the arrays of the molecule (see
+	// Molecule_line). If the file is a regular one, map
+	// it into memory and read the lines where they lie.
+	// Otherwise (e.g. a pipe) read it line by line.
 
-	memset(buf,0,0x100);
-	while(fgets(buf,0x100,file))
+	offset = ftello(file);
+	text = MAP_FAILED;
+	if(offset>=0 && fstat(fileno(file),&st)==0 && S_ISREG(st.st_mode) && st.st_size>offset)
 	{
-		// If we want to include all models (for instance in biounit PDB structures)
-		if(ignore_endmdl==0 && strncmp(buf,"ENDMDL",6)==0){
-			break;
-		}
-    
-		// Get the PDB code if possible
-		if(strncmp(buf,"HEADER",6)==0)
+		text = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fileno(file),0);
+	}
+
+	if(text!=MAP_FAILED)
+	{
+		madvise((void*)text,st.st_size,MADV_SEQUENTIAL);
+		ok=Molecule_buffer(M,&R,&text[offset],st.st_size-offset);
+		munmap((void*)text,st.st_size);
+	}
+	else
+	{
+		// Peek at the first char of the stream to tell
+		// gzip and BinaryCIF (which is read into memory)
+		// from text.
+
+		if((i=getc(file))!=EOF) ungetc(i,file);
+		buf[0]=(char)i;
+
+		if(i!=EOF && Gzip_test(buf,1))
 		{
-			strncpy(pdb,&buf[62],4);
-			pdb[4]=0;
+			G=Gzip_create(file,NULL,0);
+			ok=Molecule_gzip(M,&R,G);
+			Gzip_free(G);
 		}
+		else if(i!=EOF && BinaryCif_test(buf,1))
+		{
+			data = (char*)malloc(size=0x10000);
+			for(length=0; (k=fread(&data[length],1,size-length,file))>0; )
+			{
+				if((length+=k)==size) data = (char*)realloc(data,size*=2);
+			}
 
-		// Parse an atom record if possible...
-		if(Atom_parse(&A,buf)) //Riziotis edit: we want the altLoc atoms
-		//if(Atom_parse(&A,buf) && isspace(A.altLoc))
+			Molecule_binary(M,&R,data,length);
+			free(data);
+		}
+		else
 		{
-			// We got one! Create a new node in
-			// the list...
+			// Text is read a line at a time, put together in
+			// line[0..length-1] from as many pieces as it
+			// takes (a line of mmCIF may be long).
+
+			for(length=size=0; more && fgets(buf,sizeof(buf),file); )
+			{
+				k=strlen(buf);
+				append(&line,&length,&size,buf,k);
+
+				if(k>0 && buf[k-1]=='\n')
+				{
+					more=Molecule_line(M,&R,line,length);
+					length=0;
+				}
+			}
 
-			pA = (Atom*)calloc(1,sizeof(Atom));
-			memcpy(pA,&A,sizeof(Atom));
+			// (The last line need not end in a newline.)
 
-			N = (Node*)calloc(1,sizeof(Node));
-			N->next=head;
-			N->atom=pA;
-			head=N;
-			count++;
+			if(more && length>0) Molecule_line(M,&R,line,length);
+			free(line);
 		}
-		
-		memset(buf,0,0x100);
 	}
 
-	// Right, if count>0 we got some atoms. Otherwise
-	// return NULL now!
+	return Molecule_end(M,&R,ok);
+}
+
+Molecule *Molecule_read(const void *data, long size, int ignore_endmdl)
+{
+	Molecule *M;
+	Reader R;
+	int ok;
+
+	M=Molecule_begin(&R,ignore_endmdl);
+	ok=Molecule_buffer(M,&R,(const char*)data,size);
+
+	return Molecule_end(M,&R,ok);
+}
+
+static Molecule *Molecule_begin(Reader *R, int all)
+{
+	Molecule *M;
+	int i;
+
+	memset(R,0,sizeof(Reader));
+	R->size=0x400;
+	R->all=all;
+	for(i=0; i<ATOM_SITE_FIELDS; i++) R->pointer[i]=R->value[i];
+
+	M = (Molecule*)calloc(1,sizeof(Molecule));
+	M->atom = (Atom*)malloc(R->size*sizeof(Atom));
+	M->info = (AtomInfo*)malloc(R->size*sizeof(AtomInfo));
+
+	return M;
+}
+
+static int Molecule_buffer(Molecule *M, Reader *R, const char *text, long size)
+{
+	const char *p,*q,*end = &text[size];
+	Gzip *G;
+	int ok=1;
+
+	// A BinaryCIF file is read whole, rather than by line
+	// (see Molecule_binary). A gzip file is inflated on
+	// another thread while it is read (see Molecule_gzip).
+
+	if(Gzip_test(text,size))
+	{
+		G=Gzip_create(NULL,text,size);
+		ok=Molecule_gzip(M,R,G);
+		Gzip_free(G);
+	}
+	else if(BinaryCif_test(text,size))
+	{
+		Molecule_binary(M,R,text,size);
+	}
+	else for(p=text; p<end; p=q)
+	{
+		q = memchr(p,'\n',end-p);
+		q = q ? q+1:end;
+		if(!Molecule_line(M,R,p,q-p)) break;
+	}
+
+	return ok;
+}
 
-	if(count<=0) return NULL;
+static Molecule *Molecule_end(Molecule *M, Reader *R, int ok)
+{
+	int count;
+	int i,k;
 
-	// Create the molecule...
+	free(R->field);
+	count=M->count;
 
-	M = (Molecule*)calloc(1,sizeof(Molecule)+count*sizeof(Atom*));
-	M->count=count;
-	strcpy(M->id,pdb);
+	// Right, if count>0 we got some atoms (and the file
+	// was whole). Otherwise return NULL now!
 
-	// Loop through the list and add all the atoms to it.
-	// Remember that we added them all backwards!
+	if(count<=0 || !ok)
+	{
+		Molecule_free(M);
+		return NULL;
+	}
 
-	while(count-->0)
+	strcpy(M->id,R->pdb);
+
+	// Trim the arrays and point each atom at the rest of
+	// its record. Keep a copy of the coordinates one axis
+	// at a time, which is how the tree is built.
+
+	M->atom = (Atom*)realloc(M->atom,count*sizeof(Atom));
+	M->info = (AtomInfo*)realloc(M->info,count*sizeof(AtomInfo));
+
+	M->x[0] = (double*)malloc(3*count*sizeof(double));
+	M->x[1] = &M->x[0][count];
+	M->x[2] = &M->x[1][count];
+
+	for(k=0; k<count; k++)
 	{
-		M->atom[count]=head->atom;
-		N=head->next;
-		free(head);
-		head=N;
+		M->atom[k].info=&M->info[k];
+		for(i=0; i<3; i++) M->x[i][k]=M->atom[k].x[i];
 	}
 
+	// One tree on the positions of all the atoms is built
+	// when the first template finds atoms to match here (see
+	// CandidateCache_tree). Every template searched against
+	// the molecule queries this one tree (masked to the atoms
+	// which match) rather than build trees of its own.
+
+	M->cache=CandidateCache_create(M,NULL);
+
 	// Check memory leaks??
 
 	return M;
 }
 
-void Molecule_free(Molecule *M)
+static int Molecule_line(Molecule *M, Reader *R, const char *s, int n)
 {
-	int k;
+	int i;
 
-	if(M)
+	// The file is mmCIF if it begins (blank lines and
+	// comments aside) with a data block. Otherwise it is
+	// taken to be PDB.
+
+	if(!R->format)
 	{
-		for(k=0; k<M->count; k++)
+		for(i=0; i<n && isspace(s[i]); i++);
+		if(i==n || s[i]=='#') return 1;
+		R->format = n>=5 && strncmp(s,"data_",5)==0 ? READ_CIF:READ_PDB;
+	}
+
+	return R->format==READ_CIF ? Molecule_cif(M,R,s,n):Molecule_pdb(M,R,s,n);
+}
+
+static int Molecule_pdb(Molecule *M, Reader *R, const char *s, int n)
+{
+	int i;
+
+	// (Only the first 255 chars of a line count.)
+
+	if(n>0xff) n=0xff;
+
+	// Discard all atoms which occur after the end of the
+	// first MODEL (unless asked to keep all models).
+
+	// If we want to include all models (for instance in biounit PDB structures)
+	if(R->all==0 && n>=6 && strncmp(s,"ENDMDL",6)==0){
+		return 0;
+	}
+
+	// Get the PDB code if possible
+	if(n>=6 && strncmp(s,"HEADER",6)==0)
+	{
+		for(i=0; i<4 && 62+i<n && s[62+i]; i++) R->pdb[i]=s[62+i];
+		R->pdb[i]=0;
+	}
+
+	// Make room for another atom (doubling the arrays as
+	// they fill up)...
+
+	if(M->count==R->size)
+	{
+		R->size*=2;
+		M->atom = (Atom*)realloc(M->atom,R->size*sizeof(Atom));
+		M->info = (AtomInfo*)realloc(M->info,R->size*sizeof(AtomInfo));
+	}
+
+	// Parse an atom record if possible...
+	if(Atom_read(&M->atom[M->count],&M->info[M->count],s,n)) //Riziotis edit: we want the altLoc atoms
+	//if(Atom_read(&M->atom[M->count],&M->info[M->count],s,n) && isspace(M->info[M->count].altLoc))
+	{
+		M->count++;
+	}
+
+	return 1;
+}
+
+static int Molecule_cif(Molecule *M, Reader *R, const char *s, int n)
+{
+	const char *t;
+	int i=0,m;
+
+	// A multi-line text value runs from a line beginning
+	// with ';' to the next such line. Only its first line
+	// is kept (no _atom_site item read is ever one).
+
+	if(n>0 && s[0]==';')
+	{
+		R->text=!R->text;
+		if(R->text)
+		{
+			for(m=n; m>1 && BLANK(s[m-1]); m--);
+			return Molecule_token(M,R,&s[1],m-1,1);
+		}
+		i=1;
+	}
+	else if(R->text)
+	{
+		return 1;
+	}
+
+	// Split the rest of the line into tokens: quoted
+	// strings (which end at a quote followed by a blank)
+	// or runs of non-blanks. A '#' begins a comment.
+	// (Blanks in mmCIF are spaces, tabs and line ends.)
+
+	while(i<n)
+	{
+		while(i<n && BLANK(s[i])) i++;
+		if(i==n || s[i]=='#') break;
+
+		if(s[i]=='\'' || s[i]=='"')
+		{
+			for(m=i+1; m<n && !(s[m]==s[i] && (m+1==n || BLANK(s[m+1]))); m++);
+			t=&s[i+1];
+			i=m+1;
+			if(!Molecule_token(M,R,t,m-(t-s),1)) return 0;
+		}
+		else
+		{
+			for(m=i; m<n && !BLANK(s[m]); m++);
+			t=&s[i];
+			i=m;
+			if(!Molecule_token(M,R,t,m-(t-s),0)) return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int Molecule_token(Molecule *M, Reader *R, const char *t, int m, int quoted)
+{
+	int tag = !quoted && m>0 && t[0]=='_';
+	int loop = !quoted && m==5 && (t[0]|0x20)=='l' && strncasecmp(t,"loop_",5)==0;
+	int data = !quoted && m>=5 && (t[0]|0x20)=='d' && strncasecmp(t,"data_",5)==0;
+	int f;
+
+	// Rows of the _atom_site loop: keep the values of the
+	// fields that are read and read the atom at the end of
+	// each row. Anything else ends the loop, and as that
+	// is all that is wanted of the file, ends it too.
+
+	if(R->state==CIF_ROWS)
+	{
+		if(tag || loop || data) return 0;
+
+		f=R->field[R->column];
+		if(f>=0)
 		{
-			if(M->atom[k]) free(M->atom[k]);
+			if(!quoted && m==1 && (t[0]=='.' || t[0]=='?')) m=0;
+			if(m>=(int)sizeof(R->value[f])) m=sizeof(R->value[f])-1;
+			memcpy(R->value[f],t,m);
+			R->value[f][m]=0;
+			R->length[f]=m;
 		}
 
+		if(++R->column<R->columns) return 1;
+
+		R->column=0;
+		return Molecule_site(M,R);
+	}
+
+	// The header of a loop: list the fields of its columns
+	// if it is the _atom_site loop. The first value ends it.
+
+	if(R->state==CIF_LOOP)
+	{
+		if(tag)
+		{
+			if(m<11 || strncasecmp(t,"_atom_site.",11)!=0)
+			{
+				R->state=CIF_OUTSIDE;
+				return 1;
+			}
+
+			for(f=0; f<ATOM_SITE_FIELDS; f++)
+			{
+				if((int)strlen(siteField[f])==m-11 && strncasecmp(&t[11],siteField[f],m-11)==0) break;
+			}
+
+			R->field=(int*)realloc(R->field,(R->columns+1)*sizeof(int));
+			R->field[R->columns++] = f<ATOM_SITE_FIELDS ? f:-1;
+			return 1;
+		}
+
+		R->state=CIF_OUTSIDE;
+		if(R->columns>0 && !loop && !data)
+		{
+			R->state=CIF_ROWS;
+			R->column=0;
+			return Molecule_token(M,R,t,m,quoted);
+		}
+	}
+
+	// Otherwise look out for the _atom_site loop, and take
+	// the name of the (first) data block as the PDB code.
+
+	if(loop)
+	{
+		R->state=CIF_LOOP;
+		R->columns=0;
+	}
+	else if(data)
+	{
+		if(R->blocks++>0) return 0;
+		if(m==9)
+		{
+			memcpy(R->pdb,&t[5],4);
+			R->pdb[4]=0;
+		}
+	}
+
+	return 1;
+}
+
+static int Molecule_site(Molecule *M, Reader *R)
+{
+	int model = atoi(R->value[ATOM_SITE_MODEL]);
+
+	// Discard all atoms after the first model (unless
+	// asked to keep all models).
+
+	if(R->length[ATOM_SITE_MODEL]>0)
+	{
+		if(R->rows==0) R->model=model;
+		else if(R->all==0 && model!=R->model) return 0;
+	}
+	R->rows++;
+
+	// Make room for another atom (as for a PDB file) and
+	// read it.
+
+	if(M->count==R->size)
+	{
+		R->size*=2;
+		M->atom = (Atom*)realloc(M->atom,R->size*sizeof(Atom));
+		M->info = (AtomInfo*)realloc(M->info,R->size*sizeof(AtomInfo));
+	}
+
+	if(Atom_readSite(&M->atom[M->count],&M->info[M->count],R->pointer,R->length))
+	{
+		M->count++;
+	}
+
+	return 1;
+}
+
+static void Molecule_binary(Molecule *M, Reader *R, const char *data, long size)
+{
+	BinaryCif *B;
+	BinaryCifColumn *C[ATOM_SITE_FIELDS],*T;
+	const char *v[ATOM_SITE_FIELDS];
+	int n[ATOM_SITE_FIELDS];
+	int text[ATOM_SITE_FIELDS];
+	int key[ATOM_SITE_FIELDS];
+	Site *site,*S;
+	double *x;
+	int *row;
+	char *used;
+	int rows,texts=0,sites,distinct=0,model=0,f,i,k,m;
+	unsigned int h;
+
+	if(!(B=BinaryCif_create(data,size,"_atom_site"))) return;
+
+	if(strlen(BinaryCif_id(B))==4) strcpy(R->pdb,BinaryCif_id(B));
+
+	// Decode the columns that are read, then make room for
+	// all the rows at once (no atom is read without all
+	// three coordinates).
+
+	rows=BinaryCif_rows(B);
+	for(f=0; f<ATOM_SITE_FIELDS; f++) C[f]=BinaryCif_column(B,siteField[f]);
+	if(!C[ATOM_SITE_X] || !C[ATOM_SITE_Y] || !C[ATOM_SITE_Z]) rows=0;
+
+	if(rows>R->size)
+	{
+		R->size=rows;
+		M->atom = (Atom*)realloc(M->atom,R->size*sizeof(Atom));
+		M->info = (AtomInfo*)realloc(M->info,R->size*sizeof(AtomInfo));
+	}
+
+	// Read the strings of each row through Atom_readSite
+	// (as from an mmCIF file) and note which row each atom
+	// came from. The strings repeat a lot (the same atom and
+	// residue names in every residue and chain) so each
+	// distinct set of them is read just once, and kept in a
+	// table keyed by their indices, for other rows to copy.
+
+	row = (int*)malloc((rows+1)*sizeof(int));
+	for(f=0; f<ATOM_SITE_FIELDS; f++)
+	{
+		v[f]="";
+		n[f]=0;
+		if(C[f] && C[f]->text) text[texts++]=f;
+	}
+
+	for(sites=0x100; sites<2*rows && sites<0x4000; sites*=2);
+	site = (Site*)malloc(sites*sizeof(Site));
+	used = (char*)calloc(sites,1);
+
+	for(k=0; k<rows; k++)
+	{
+		// Discard all atoms after the first model (unless
+		// asked to keep all models).
+
+		if(BinaryCifColumn_present(C[ATOM_SITE_MODEL],k))
+		{
+			if(k==0) model=(int)BinaryCifColumn_number(C[ATOM_SITE_MODEL],k);
+			else if(R->all==0 && model!=(int)BinaryCifColumn_number(C[ATOM_SITE_MODEL],k)) break;
+		}
+
+		for(h=0, i=0; i<texts; i++)
+		{
+			T = C[text[i]];
+			key[i] = T->mask && T->mask[k] ? -1:T->index[k];
+			h = (h^(unsigned int)key[i])*16777619u;
+		}
+
+		for(h&=sites-1; used[h] && memcmp(site[h].key,key,texts*sizeof(int)); h=(h+1)&(sites-1));
+
+		if(!used[h])
+		{
+			for(i=0; i<texts; i++)
+			{
+				f=text[i];
+				n[f]=BinaryCifColumn_string(C[f],k,&v[f]);
+			}
+
+			S = &site[h];
+			S->ok=Atom_readSite(&S->atom,&S->info,v,n);
+
+			// (Once the table is half full, just read
+			// the strings of the rest of the rows.)
+
+			if(distinct<sites/2)
+			{
+				memcpy(S->key,key,texts*sizeof(int));
+				used[h]=1;
+				distinct++;
+			}
+		}
+
+		if(site[h].ok)
+		{
+			M->atom[M->count]=site[h].atom;
+			M->info[M->count]=site[h].info;
+			row[M->count++]=k;
+		}
+	}
+
+	free(site);
+	free(used);
+
+	// ...then set the numbers column by column.
+
+	x = (double*)malloc((M->count+1)*sizeof(double));
+
+	for(f=0; f<ATOM_SITE_FIELDS; f++)
+	{
+		if(!C[f] || C[f]->text) continue;
+
+		T = C[f];
+		for(m=0; m<M->count; m++) x[m] = T->i ? T->i[row[m]]:T->r[row[m]];
+		for(m=0; m<M->count && T->mask; m++) if(T->mask[row[m]]) x[m]=0.0;
+
+		switch(f)
+		{
+			case ATOM_SITE_ID:
+				for(m=0; m<M->count; m++) M->info[m].serial=(int)x[m];
+				break;
+			case ATOM_SITE_SEQ:
+				for(m=0; m<M->count; m++)
+				{
+					if(BinaryCifColumn_present(C[f],row[m])) M->atom[m].resSeq=(int)x[m];
+				}
+				break;
+			case ATOM_SITE_LABEL_SEQ:
+				for(m=0; m<M->count; m++)
+				{
+					if(!BinaryCifColumn_present(C[ATOM_SITE_SEQ],row[m])) M->atom[m].resSeq=(int)x[m];
+				}
+				break;
+			case ATOM_SITE_X:
+			case ATOM_SITE_Y:
+			case ATOM_SITE_Z:
+				for(m=0; m<M->count; m++) M->atom[m].x[f-ATOM_SITE_X]=x[m];
+				break;
+			case ATOM_SITE_OCC:
+				for(m=0; m<M->count; m++) M->info[m].occupancy=x[m];
+				break;
+			case ATOM_SITE_B:
+				for(m=0; m<M->count; m++) M->info[m].tempFactor=x[m];
+				break;
+			case ATOM_SITE_CHARGE:
+				for(m=0; m<M->count; m++) M->info[m].charge=(int)x[m];
+				break;
+		}
+	}
+
+	free(x);
+	free(row);
+	for(f=0; f<ATOM_SITE_FIELDS; f++) BinaryCifColumn_free(C[f]);
+	BinaryCif_free(B);
+}
+
+static int Molecule_gzip(Molecule *M, Reader *R, Gzip *G)
+{
+	const char *p,*q,*end;
+	char *line=NULL;
+	long n,length=0,size=0;
+	int more=1;
+
+	// A BinaryCIF file (as told by the first block) is
+	// gathered whole...
+
+	n=Gzip_read(G,&p);
+
+	if(n>0 && BinaryCif_test(p,n))
+	{
+		for(; n>0; n=Gzip_read(G,&p)) append(&line,&length,&size,p,n);
+		if(n==0) Molecule_binary(M,R,line,length);
+	}
+
+	// ...but text is read a line at a time where it lies
+	// in each block, bar a line split between blocks which
+	// is put together in line[0..length-1].
+
+	else for(; n>0 && more; n = more ? Gzip_read(G,&p):n)
+	{
+		end=&p[n];
+
+		if(length>0)
+		{
+			q = memchr(p,'\n',n);
+			q = q ? q+1:end;
+			append(&line,&length,&size,p,q-p);
+			p=q;
+
+			if(line[length-1]=='\n')
+			{
+				more=Molecule_line(M,R,line,length);
+				length=0;
+			}
+		}
+
+		for(; more && p<end; p=q)
+		{
+			if(!(q = memchr(p,'\n',end-p)))
+			{
+				append(&line,&length,&size,p,end-p);
+				break;
+			}
+			more=Molecule_line(M,R,p,++q-p);
+		}
+	}
+
+	// (The last line need not end in a newline.)
+
+	if(more && n==0 && length>0) Molecule_line(M,R,line,length);
+
+	free(line);
+	return n>=0;
+}
+
+void Molecule_free(Molecule *M)
+{
+	if(M)
+	{
+		CandidateCache_free(M->cache);
+		free(M->atom);
+		free(M->info);
+		if(!M->mapped) free(M->x[0]);
 		free(M);
 	}
 }
@@ -145,7 +925,27 @@ int Molecule_count(const Molecule *M)
 
 const Atom *Molecule_atom(const Molecule *M, int k)
 {
-	return !M || k<0 || k>=M->count ? NULL:M->atom[k];
+	return !M || k<0 || k>=M->count ? NULL:&M->atom[k];
+}
+
+KdTree *Molecule_tree(const Molecule *M)
+{
+	return CandidateCache_tree(M->cache);
+}
+
+CandidateCache *Molecule_cache(const Molecule *M)
+{
+	return M->cache;
+}
+
+const Atom *Molecule_atoms(const Molecule *M)
+{
+	return M->atom;
+}
+
+const double *Molecule_axis(const Molecule *M, int i)
+{
+	return M->x[i];
 }
 
 const char *Molecule_id(const Molecule *M)
@@ -154,5 +954,185 @@ const char *Molecule_id(const Molecule *M)
 	return NULL;
 }
 
-// ==================================================================
+long Molecule_write(const Molecule *M, FILE *file, int tree)
+{
+	static const char zero[8];
+	const AtomInfo *I;
+	const Atom *A;
+	Record R;
+	Packed *packed;
+	Label *label,L;
+	int *slot;
+	long n = M->count;
+	long size,k;
+	unsigned int h,mask;
+	int ok;
+
+	// Each distinct Label is kept once, found by hashing
+	// into slot[] (open addressing, at most half full).
+
+	for(mask=1; mask<2*n; mask<<=1);
+	mask--;
+
+	packed=(Packed*)calloc(n,sizeof(Packed));
+	label=(Label*)malloc(n*sizeof(Label));
+	slot=(int*)malloc((mask+1)*sizeof(int));
+	memset(slot,0xff,(mask+1)*sizeof(int));
+
+	memset(&R,0,sizeof(Record));
+	R.count=M->count;
+	R.tree=tree;
+	strcpy(R.id,M->id);
+
+	for(k=0; k<n; k++)
+	{
+		A=&M->atom[k];
+		I=A->info;
+
+		memset(&L,0,sizeof(Label));
+		memcpy(L.name,I->name,sizeof(L.name));
+		memcpy(L.resName,I->resName,sizeof(L.resName));
+		memcpy(L.segID,I->segID,sizeof(L.segID));
+		memcpy(L.element,I->element,sizeof(L.element));
+		L.charge=I->charge;
+
+		for(h=hashLabel(&L)&mask; slot[h]>=0; h=(h+1)&mask)
+		{
+			if(memcmp(&label[slot[h]],&L,sizeof(Label))==0) break;
+		}
+
+		if(slot[h]<0)
+		{
+			slot[h]=R.labels;
+			label[R.labels++]=L;
+		}
+
+		packed[k].serial=I->serial;
+		packed[k].resSeq=A->resSeq;
+		packed[k].label=slot[h];
+		packed[k].chainID1=A->chainID1;
+		packed[k].chainID2=A->chainID2;
+		packed[k].altLoc=I->altLoc;
+		packed[k].iCode=I->iCode;
+		packed[k].occupancy=I->occupancy;
+		packed[k].tempFactor=I->tempFactor;
+	}
+
+	ok = fwrite(&R,sizeof(Record),1,file)==1
+		&& fwrite(zero,1,padding(sizeof(Record)),file)==padding(sizeof(Record))
+		&& fwrite(M->x[0],sizeof(double),3*n,file)==3*n
+		&& fwrite(packed,sizeof(Packed),n,file)==n
+		&& fwrite(label,sizeof(Label),R.labels,file)==R.labels
+		&& fwrite(zero,1,padding(R.labels*sizeof(Label)),file)==padding(R.labels*sizeof(Label));
+
+	size=rounded(sizeof(Record))+3*n*sizeof(double)+n*sizeof(Packed)+rounded(R.labels*sizeof(Label));
+
+	free(packed);
+	free(label);
+	free(slot);
+
+	if(!ok) return -1;
+
+	if(tree)
+	{
+		if((k=KdTree_write(Molecule_tree(M),file))<0) return -1;
+		size+=k;
+	}
+
+	return size;
+}
+
+Molecule *Molecule_map(const void *data, long size)
+{
+	const Record *R = (const Record*)data;
+	const char *p = (const char*)data;
+	const Packed *packed;
+	const Label *label,*L;
+	const double *x[3];
+	Molecule *M;
+	AtomInfo *I;
+	Atom *A;
+	KdTree *K;
+	long n,used;
+	int i,k;
+
+	// Check there is room for all of the molecule.
+
+	if(size<sizeof(Record) || (n=R->count)<1 || R->labels<1 || R->labels>n
+		|| memchr(R->id,0,sizeof(R->id))==NULL) return NULL;
+
+	used=rounded(sizeof(Record))+3*n*sizeof(double)+n*sizeof(Packed)+rounded(R->labels*sizeof(Label));
+
+	if(size<used || strlen(R->id)>4) return NULL;
+
+	p+=rounded(sizeof(Record));
+	packed=(const Packed*)&p[3*n*sizeof(double)];
+	label=(const Label*)&packed[n];
+
+	for(k=0; k<n; k++)
+	{
+		if(packed[k].label<0 || packed[k].label>=R->labels) return NULL;
+	}
+
+	M = (Molecule*)calloc(1,sizeof(Molecule));
+	M->count=n;
+	M->mapped=1;
+	strcpy(M->id,R->id);
+
+	// The coordinates are used where they lie; the atoms
+	// and their info are laid out again from them and the
+	// sites and labels.
+
+	M->x[0]=(double*)p;
+	M->x[1]=&M->x[0][n];
+	M->x[2]=&M->x[1][n];
+
+	M->atom=(Atom*)calloc(n,sizeof(Atom));
+	M->info=(AtomInfo*)calloc(n,sizeof(AtomInfo));
+
+	for(k=0; k<n; k++)
+	{
+		A=&M->atom[k];
+		I=&M->info[k];
+		L=&label[packed[k].label];
+
+		memcpy(I->name,L->name,sizeof(I->name));
+		memcpy(I->resName,L->resName,sizeof(I->resName));
+		memcpy(I->segID,L->segID,sizeof(I->segID));
+		memcpy(I->element,L->element,sizeof(I->element));
+		I->charge=L->charge;
+		I->serial=packed[k].serial;
+		I->altLoc=packed[k].altLoc;
+		I->iCode=packed[k].iCode;
+		I->occupancy=packed[k].occupancy;
+		I->tempFactor=packed[k].tempFactor;
+
+		for(i=0; i<3; i++) A->x[i]=M->x[i][k];
+		A->info=I;
+		A->name=Atom_id(I->name,4);
+		A->flags=Atom_flags(A->name);
+		A->resName=Atom_id(I->resName,3);
+		A->resSeq=packed[k].resSeq;
+		A->chainID1=packed[k].chainID1;
+		A->chainID2=packed[k].chainID2;
+	}
 
+	// Then take the tree as it was written (or leave it to
+	// be built if it is needed).
+
+	K=NULL;
+
+	for(i=0; i<3; i++) x[i]=M->x[i];
+
+	if(R->tree && !(K=KdTree_map((const char*)data+used,size-used,x,n,3)))
+	{
+		Molecule_free(M);
+		return NULL;
+	}
+
+	M->cache=CandidateCache_create(M,K);
+
+	return M;
+}
+
+// ==================================================================
@@ -2,38 +2,68 @@
 // Molecule.h
 // Copyright (c) Jonathan Barker, 2002
 // ==================================================================
-// Declaration of type Molecule (a PDB reader).
+// Declaration of type Molecule (a PDB, mmCIF and BinaryCIF reader).
 // ==================================================================
 
 #ifndef MOLECULE_H
 #define MOLECULE_H
 
 #include "Atom.h"
+#include "KdTree.h"
 #include <stdio.h>
 
 // ==================================================================
 // Forward declarations
 // ==================================================================
 // Molecule					A complete molecule
+// CandidateCache			Atoms matching template atoms (CandidateSet.h)
 // ==================================================================
 
 typedef struct _Molecule Molecule;
+typedef struct _CandidateCache CandidateCache;
 
 // ==================================================================
 // Methods of type Molecule
 // ==================================================================
-// create(file)				Create molecule from PDB file
+// create(file,all)		Create molecule from PDB, mmCIF or BinaryCIF file
+//							(all of its models if all, else the first), which
+//							may be gzipped
+// read(d,n,all)			As create() but from the file d[0..n-1]
 // free(M)					Free memory associated with molecule M
 // count(M)					Count number of atoms in the molecule
 // atom(M,k)				Return pointer to atom k (see Atom.h)
+// atoms(M)					All the atoms, as one array
+// axis(M,i)				ith coordinate (x, y or z) of all the atoms
+// tree(M)					Tree of all atom positions (see KdTree.h), built
+//							the first time it is asked for
+// cache(M)					Cache of the candidate sets of M
 // id(M)					The PDB code (if found)
+// write(M,f,t)				Write M (and its tree if t) to file f; returns
+//							the bytes written (a multiple of 8) or -1
+// map(d,n)					Molecule written to d[0..n-1] by write()
+//							(NULL if d is not such a molecule)
+// ==================================================================
+// map() points M at the coordinates where they lie in d[], which must
+// last as long as M and be aligned to 8 bytes, so that one copy of
+// them (e.g. in the page cache) serves any number of processes. The
+// atoms are laid out again from them and the compact records of the
+// rest of each atom (its names being stored once per molecule), and
+// the tree is found again from its order of points (or built when it
+// is needed if it was not written), all in time of order n.
 // ==================================================================
 
 extern Molecule *Molecule_create(FILE*,int);
+extern Molecule *Molecule_read(const void*,long,int);
 extern void Molecule_free(Molecule*);
 extern int Molecule_count(const Molecule*);
 extern const Atom *Molecule_atom(const Molecule*,int);
+extern const Atom *Molecule_atoms(const Molecule*);
+extern const double *Molecule_axis(const Molecule*,int);
+extern KdTree *Molecule_tree(const Molecule*);
+extern CandidateCache *Molecule_cache(const Molecule*);
 extern const char *Molecule_id(const Molecule*);
+extern long Molecule_write(const Molecule*,FILE*,int);
+extern Molecule *Molecule_map(const void*,long);
 
 // ==================================================================
 
@@ -6,71 +6,94 @@
 // ==================================================================
 
 #include "Scanner.h"
+#include "CandidateSet.h"
 #include "KdTree.h"
 #include "Region.h"
 #include "Annulus.h"
 #include "Join.h"
+#include "Super.h"
 #include <stdlib.h>
 #include <string.h>
-
-// ==================================================================
-// Local type CandidateSet
-// ==================================================================
-// count				Number of atoms in the set
-// atom[k]				Points to ATOM record for kth candidate
-// coord[k]				Points to coordinates for kth candidate
-// ==================================================================
-
-typedef struct _CandidateSet CandidateSet;
-
-struct _CandidateSet
-{
-	int count;
-	Atom **atom;
-	double **coord;
-};
-
-// ==================================================================
-// Declaration of methods of local type CandidateSet
-// ==================================================================
-// create(M,T,k)		Create from molecule M, atom k of T
-// free(S)				Free candidate set
-// ==================================================================
-
-static CandidateSet *CandidateSet_create(Molecule*,Template*,int);
-static void CandidateSet_free(CandidateSet*);
+#include <math.h>
+#include <stdatomic.h>
 
 // ==================================================================
 // type Scanner
 //===================================================================
 // template				The template object
-// set[k]				Set of candidates for atom k
-// tree[k]				Tree of candidate positions for atom k
+// set[k]				Set of candidates for atom k (see CandidateSet.h)
+// distance[n*i+j]		Distance between template atoms i and j
+// tree					Tree of all atom positions in the molecule
+// shared				Number of scanners sharing set[] and distance[]
 // query[k]				Current query state for tree k
 // index[k]				Index of result[k] in set[k].
 // result[k]			kth atom of current result set
+// deviation[k]			Largest difference between a distance among
+//						result[0..k] and that in the template
+// partial				Superposition of those of result[0..] that are
+//						aligned...
+// aligned[k]			...i.e. for which this is true
 // region[i]			Temporary region pointer
 // count				= template->count(template)
+// level				Level at which to resume the search (-1: done)
+// floor				Lowest level this scanner may backtrack to
+// end					End of the range of set[0] to scan
 // threshold			The global distance cutoff  
 // max_total_threshold		The maximum value the distance cutoff can take
 // 				after adding the global and single-residue
 // 				distance cutoff
+// limit				RMSD above which results may be pruned (<0: none)
+//===================================================================
+// A scanner may be split (see Scanner_split) into several scanners
+// which share the candidate sets and tree but each own their own
+// query state. The one created by the split searches the part of the
+// search space which follows what is left to the original.
 //===================================================================
 
 struct _Scanner
 {
 	Template *template;
-	CandidateSet **set;
-	KdTree **tree;
+	const CandidateSet **set;
+	double *distance;
+	KdTree *tree;
+	atomic_int *shared;
 	KdTreeQuery **query;
 	int *index;
 	Atom **atom;
+	double *deviation;
+	Superposition *partial;
+	char *aligned;
 	Region **region;
 	int count;
+	int level;
+	int floor;
+	int end;
 	double threshold;
 	double max_total_threshold;
+	double limit;
 };
 
+// ==================================================================
+// Declaration of private methods of type Scanner
+// ==================================================================
+// clone(S)				New scanner sharing the candidates of S
+// region(S,k)			Region in which to look for candidate k
+// push(S,k)			Align atom k of the result, updating deviation[k]
+// pop(S,k)				Undo push(S,k) (if it was done)
+// within(S,k)			Push atom k, then pop it and return false if
+//						no result with atoms 0,...,k as they are now
+//						can have an RMSD within the limit
+// ==================================================================
+// Atoms are only pushed while there is a limit; each is popped when
+// it is replaced by the next candidate for its place.
+// ==================================================================
+
+static Scanner *Scanner_clone(Scanner*);
+static Region *Scanner_region(Scanner*,int);
+static void Scanner_push(Scanner*,int);
+static void Scanner_pop(Scanner*,int);
+static int Scanner_within(Scanner*,int);
+
 // ==================================================================
 // Methods of type Scanner
 // ==================================================================
@@ -78,42 +101,65 @@ struct _Scanner
 Scanner *Scanner_create(Molecule *M, Template *T,double r, double s)
 {
 	Scanner *S;
-	int k,n=T->count(T);
-	int m;
+	int j,k,n=T->count(T);
+	const double *x,*y;
 
 	S=(Scanner*)calloc(1,sizeof(Scanner));
-	S->set=(CandidateSet**)calloc(n,sizeof(CandidateSet*));
-	S->tree=(KdTree**)calloc(n,sizeof(KdTree*));
+	S->set=(const CandidateSet**)calloc(n,sizeof(CandidateSet*));
+	S->distance=(double*)calloc(n*n,sizeof(double));
+	S->shared=(atomic_int*)malloc(sizeof(atomic_int));
+	atomic_init(S->shared,1);
 	S->query=(KdTreeQuery**)calloc(n,sizeof(KdTreeQuery*));
 	S->index=(int*)calloc(n,sizeof(int));
 	S->atom=(Atom**)calloc(n,sizeof(Atom*));
+	S->deviation=(double*)calloc(n,sizeof(double));
+	S->partial=Superposition_create();
+	S->aligned=(char*)calloc(n,sizeof(char));
 	S->region=(Region**)calloc(n,sizeof(Region*));
 
 	S->template=T;
 	S->threshold=r;
 	S->max_total_threshold=s;
+	S->limit=-1.0;
 	S->count=n;
+	S->level=n-1;
+
+	for(j=0; j<n; j++)
+	{
+		x=T->position(T,j);
+		for(k=0; k<j; k++)
+		{
+			y=T->position(T,k);
+			S->distance[n*j+k]=S->distance[n*k+j]=sqrt(
+				(x[0]-y[0])*(x[0]-y[0])+(x[1]-y[1])*(x[1]-y[1])+(x[2]-y[2])*(x[2]-y[2]));
+		}
+	}
 
 	for(k=0; k<n; k++)
 	{
 		S->index[k]=-1;
-		S->set[k]=CandidateSet_create(M,T,k);
+		S->set[k]=CandidateCache_get(Molecule_cache(M),T,k);
 
 		if(S->set[k]->count==0)
 		{
 			Scanner_free(S);
 			return NULL;
 		}
-
-		S->tree[k]=KdTree_create(S->set[k]->coord,S->set[k]->count,3);
 	}
 
+	// Only now that every template atom has candidates is
+	// the molecule's tree needed.
+
+	S->tree=Molecule_tree(M);
+
 	if(S->count>0 && S->set[0]->count>0)
 	{
 		S->index[0]=0;
 		S->atom[0]=S->set[0]->atom[0];
 	}
 
+	S->end=S->set[0]->count;
+
 	return S;
 }
 
@@ -127,15 +173,25 @@ void Scanner_free(Scanner *S)
 
 		for(k=0; k<n; k++)
 		{
-			if(S->set && S->set[k]) CandidateSet_free(S->set[k]);
-			if(S->tree && S->tree[k]) KdTree_free(S->tree[k]);
 			if(S->query && S->query[k]) KdTreeQuery_free(S->query[k]);
 		}
 
-		if(S->set) free(S->set);
+		// The last of the scanners sharing them frees the
+		// array of candidate sets and the distances. The
+		// sets and tree belong to the molecule.
+
+		if(atomic_fetch_sub(S->shared,1)==1)
+		{
+			if(S->set) free(S->set);
+			if(S->distance) free(S->distance);
+			free(S->shared);
+		}
+
 		if(S->query) free(S->query);
-		if(S->tree) free(S->tree);
 		if(S->atom) free(S->atom);
+		if(S->deviation) free(S->deviation);
+		if(S->aligned) free(S->aligned);
+		Superposition_free(S->partial);
 		if(S->index) free(S->index);
 		if(S->region) free(S->region);
 
@@ -145,30 +201,41 @@ void Scanner_free(Scanner *S)
 
 Atom **Scanner_next(Scanner *S, int ignore_chain)
 {
-	int j,k;
-	double min,max;
-	Region *J;
+	return Scanner_poll(S,ignore_chain,0);
+}
 
-	double dynamic_threshold = S->threshold;
+Atom **Scanner_poll(Scanner *S, int ignore_chain, int steps)
+{
+	int k;
 
-	k=S->count-1;
+	k=S->level;
 
 	// Attempt to find the next query result.
 
-	while(k>=0)
+	while(k>=S->floor)
 	{
 		// If k==S->count, we have a hit!
 
 		if(k==S->count) break;
 
+		// If we have run out of steps, remember where we
+		// got to and return (see Scanner_finished).
+
+		if(steps>0 && --steps==0)
+		{
+			S->level=k;
+			return NULL;
+		}
+
 		// If k==0 we must find the next left-most
 		// atom of the query...
 
 		if(k==0)
 		{
+			Scanner_pop(S,0);
 			S->index[0]++;
 
-			if(S->index[0]>=S->set[0]->count)
+			if(S->index[0]>=S->end)
 			{
 				// End of query...
 
@@ -177,6 +244,7 @@ Atom **Scanner_next(Scanner *S, int ignore_chain)
 			else
 			{
 				S->atom[0]=S->set[0]->atom[S->index[0]];
+				if(S->limit>=0.0) Scanner_push(S,0);
 				k++;
 			}
 
@@ -188,6 +256,7 @@ Atom **Scanner_next(Scanner *S, int ignore_chain)
 
 		if(S->query[k])
 		{
+			Scanner_pop(S,k);
 			S->index[k]=KdTreeQuery_next(S->query[k]);
 			if(S->index[k]<0)
 			{
@@ -202,11 +271,12 @@ Atom **Scanner_next(Scanner *S, int ignore_chain)
 			else
 			{
 				// The query was successful(?) Remember the
-				// atom, check n-ary constraints and continue
-				// up...
+				// atom, check n-ary constraints (and the
+				// limit on the RMSD) and continue up...
 
-				S->atom[k]=S->set[k]->atom[S->index[k]];
-				if(S->template->check(S->template,S->atom,k+1,ignore_chain))
+				S->atom[k]=S->set[k]->ranked[S->index[k]];
+				if(S->template->check(S->template,S->atom,k+1,ignore_chain)
+					&& (S->limit<0.0 || Scanner_within(S,k)))
 				{
 					k++;
 				}
@@ -229,79 +299,239 @@ Atom **Scanner_next(Scanner *S, int ignore_chain)
 		// no active query at k; create a new query at
 		// index k and try again (with the same k)
 
-		for(j=0; j<k; j++)
-		{
-			S->template->range(S->template,j,k,&min,&max);
+		S->query[k]=KdTree_queryMasked(S->tree,Scanner_region(S,k),
+			S->set[k]->rank,S->set[k]->count);
+	}
 
-			dynamic_threshold = S->threshold + S->template->distWeight(S->template, j) + S->template->distWeight(S->template, k);
-			// Limit threshold to a hard cutoff so execution does not suffer
-			if(dynamic_threshold > S->max_total_threshold){
-				dynamic_threshold = S->max_total_threshold;
-			}
-			min -= dynamic_threshold;
-			max += dynamic_threshold;
-			if(min<0.5) min=0.5;
+	// If k is below the floor there is no more!
 
-			S->region[j]=Annulus_create(S->atom[j]->x,min,max,3);
-		}
+	if(k<S->floor)
+	{
+		S->level=-1;
+		return NULL;
+	}
+
+	// Otherwise, the atoms are listed in S->atom. Next
+	// time carry on from the last level.
 
-		J = Join_create(S->region,k,innerJoin);
-		S->query[k]=KdTree_query(S->tree[k],J);
+	S->level=S->count-1;
+	return S->atom;
+}
+
+void Scanner_limit(Scanner *S, double rmsd)
+{
+	int k;
+
+	// Atoms are only pushed while there is a limit, so
+	// push those the scan is at (if it has started) when
+	// one is set.
+
+	if(S->limit<0.0 && rmsd>=0.0)
+	{
+		for(k=0; k<S->level && k<S->count && S->atom[k]; k++) Scanner_push(S,k);
 	}
 
-	// If k<0 there is no more!
+	S->limit=rmsd;
+}
+
+int Scanner_finished(const Scanner *S)
+{
+	return S->level<0;
+}
 
-	if(k<0) return NULL;
+Scanner *Scanner_split(Scanner *S)
+{
+	Scanner *T;
+	KdTreeQuery *Q;
+	Region *R;
+	int j,k;
 
-	// Otherwise, the atoms are listed in S->atom.
+	if(S->level<0) return NULL;
 
-	return S->atom;
+	// Work is given away at the lowest level at which there
+	// is any left, so that all of it follows (in the order
+	// of a serial scan) everything that S still has to do.
+	// First, hand over the second half of the anchors left.
+
+	if(S->floor==0 && S->index[0]+1<S->end)
+	{
+		j = S->index[0]+1;
+		j += (S->end-j)/2;
+
+		// T resumes at level 0, where it will move on
+		// to anchor j.
+
+		T = Scanner_clone(S);
+		T->index[0]=j-1;
+		T->end=S->end;
+		T->level=0;
+		T->floor=0;
+
+		S->end=j;
+		return T;
+	}
+
+	// Otherwise find the lowest active query with nodes
+	// left to visit and give part of it away.
+
+	for(k=S->floor>1 ? S->floor:1; k<S->count && k<=S->level; k++)
+	{
+		if(!S->query[k]) continue;
+
+		T = Scanner_clone(S);
+		for(j=0; j<k; j++)
+		{
+			T->index[j]=S->index[j];
+			T->atom[j]=S->atom[j];
+			if(T->limit>=0.0) Scanner_push(T,j);
+		}
+
+		R = Scanner_region(T,k);
+		if((Q=KdTreeQuery_split(S->query[k],R)))
+		{
+			T->query[k]=Q;
+			T->level=k;
+			T->floor=k;
+			return T;
+		}
+
+		// Nothing left at this level...
+
+		R->free(R);
+		Scanner_free(T);
+	}
+
+	return NULL;
 }
 
 // ==================================================================
-// Methods of local type CandidateSet
+// Private methods of type Scanner
 // ==================================================================
 
-static CandidateSet *CandidateSet_create(Molecule *M, Template *T, int k)
+static Scanner *Scanner_clone(Scanner *S)
 {
-	CandidateSet *S;
-	Atom *A;
-	int n = Molecule_count(M);
-	int m;
+	Scanner *T;
+	int k,n=S->count;
+
+	T=(Scanner*)calloc(1,sizeof(Scanner));
+	T->query=(KdTreeQuery**)calloc(n,sizeof(KdTreeQuery*));
+	T->index=(int*)calloc(n,sizeof(int));
+	T->atom=(Atom**)calloc(n,sizeof(Atom*));
+	T->deviation=(double*)calloc(n,sizeof(double));
+	T->partial=Superposition_create();
+	T->aligned=(char*)calloc(n,sizeof(char));
+	T->region=(Region**)calloc(n,sizeof(Region*));
+
+	T->template=S->template;
+	T->set=S->set;
+	T->distance=S->distance;
+	T->tree=S->tree;
+	T->shared=S->shared;
+	atomic_fetch_add(T->shared,1);
+
+	T->threshold=S->threshold;
+	T->max_total_threshold=S->max_total_threshold;
+	T->limit=S->limit;
+	T->count=n;
+	T->level=-1;
+
+	for(k=0; k<n; k++) T->index[k]=-1;
+
+	return T;
+}
 
-	S = (CandidateSet*)calloc(1,sizeof(CandidateSet));
-	S->atom=(Atom**)calloc(n,sizeof(Atom*));
+static Region *Scanner_region(Scanner *S, int k)
+{
+	int j;
+	double min,max;
+	double dynamic_threshold;
 
-	for(m=0; m<n; m++)
+	// The kth atom of a hit must lie within the right
+	// distance range of each of atoms 0,...,k-1.
+
+	for(j=0; j<k; j++)
 	{
-		A = (Atom*)Molecule_atom(M,m);
-		if(T->match(T,k,A))
-		{
-			S->atom[S->count]=A;
-			S->count++;
+		S->template->range(S->template,j,k,&min,&max);
+
+		dynamic_threshold = S->threshold + S->template->distWeight(S->template, j) + S->template->distWeight(S->template, k);
+		// Limit threshold to a hard cutoff so execution does not suffer
+		if(dynamic_threshold > S->max_total_threshold){
+			dynamic_threshold = S->max_total_threshold;
 		}
+		min -= dynamic_threshold;
+		max += dynamic_threshold;
+		if(min<0.5) min=0.5;
+
+		S->region[j]=Annulus_create(S->atom[j]->x,min,max,3);
 	}
 
-	S->atom=(Atom**)realloc(S->atom,sizeof(Atom*)*S->count);
-	S->coord=(double**)calloc(S->count,sizeof(double*));
+	return Join_create(S->region,k,innerJoin);
+}
 
-	for(m=0; m<S->count; m++)
+static void Scanner_push(Scanner *S, int k)
+{
+	const double *x,*y;
+	double d,e;
+	int j;
+
+	Superposition_align(S->partial,S->atom[k]->x,S->template->position(S->template,k));
+	S->aligned[k]=1;
+
+	if(k==0) return;
+
+	e=S->deviation[k-1];
+	x=S->atom[k]->x;
+
+	for(j=0; j<k; j++)
 	{
-		S->coord[m]=S->atom[m]->x;
+		y=S->atom[j]->x;
+		d=sqrt((x[0]-y[0])*(x[0]-y[0])+(x[1]-y[1])*(x[1]-y[1])+(x[2]-y[2])*(x[2]-y[2]));
+		d=fabs(d-S->distance[S->count*j+k]);
+		if(d>e) e=d;
 	}
 
-	return S;
+	S->deviation[k]=e;
 }
 
-static void CandidateSet_free(CandidateSet *S)
+static void Scanner_pop(Scanner *S, int k)
 {
-	if(S)
+	if(S->aligned[k])
 	{
-		if(S->atom) free(S->atom);
-		if(S->coord) free(S->coord);
-		free(S);
+		Superposition_remove(S->partial,S->atom[k]->x,S->template->position(S->template,k));
+		S->aligned[k]=0;
 	}
 }
 
-// ==================================================================
+static int Scanner_within(Scanner *S, int k)
+{
+	double e,d;
+
+	Scanner_push(S,k);
+
+	// However atoms 0,...,k are superposed on the template,
+	// two of them whose distance apart differs by e from
+	// that of their template atoms are displaced by e in
+	// all, so the sum of squared displacements of a result
+	// is at least e^2/2: its RMSD is at least e/sqrt(2n).
+	// (With a margin for rounding in the superposition.)
+
+	e=S->deviation[k];
+
+	// Superposed on the template, the whole result has a
+	// sum of squared displacements at least that of the
+	// best superposition of atoms 0,...,k alone, so its
+	// RMSD is at least that RMSD times sqrt((k+1)/n).
 
+	if(e*e/(2*S->count)<=S->limit*S->limit+1e-6)
+	{
+		if(k<2) return 1;
+
+		d=Superposition_rmsd(S->partial);
+		if(d*d*(k+1)/S->count<=S->limit*S->limit+1e-6) return 1;
+	}
+
+	Scanner_pop(S,k);
+	return 0;
+}
+
+// ==================================================================
@@ -25,11 +25,26 @@ typedef struct _Scanner Scanner;
 // create(M,T,r)			Create object to scan M with template T
 // free(S)					Free memory associated with S
 // next(S)					Next result (an array of Atoms)
+// poll(S,i,n)				As next() but give up after n steps
+// limit(S,r)				Let S prune results whose RMSD must exceed r
+//							(r<0: none; the default)
+// finished(S)				True once S has no more results
+// split(S)					Hand the later part of the scan to a new
+//							scanner (NULL if there is none)
+// ==================================================================
+// poll() returns NULL either at the end of the scan or when it runs
+// out of steps; finished() tells these apart. A scanner returned by
+// split() shares the candidates of S and may be run on a different
+// thread. Its results are those S would have found last.
 // ==================================================================
 
 extern Scanner *Scanner_create(Molecule*,Template*,double,double);
 extern void Scanner_free(Scanner*);
 extern Atom **Scanner_next(Scanner*, int);
+extern Atom **Scanner_poll(Scanner*, int, int);
+extern void Scanner_limit(Scanner*,double);
+extern int Scanner_finished(const Scanner*);
+extern Scanner *Scanner_split(Scanner*);
 extern double Scanner_rmsd(Scanner*);
 
 // ==================================================================
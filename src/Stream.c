@@ -0,0 +1,410 @@
+// ==================================================================
+// Stream.c
+// ==================================================================
+// Implementation of type Stream.
+// ==================================================================
+
+#include "Stream.h"
+#include "Gzip.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ==================================================================
+// STREAM_TAR			The stream is a tar archive
+// STREAM_PDB			The stream is PDB files, each ending with END
+// STREAM_CIF			The stream is mmCIF files
+// STREAM_BLOCK			Size of a read from the file
+// TAR_BLOCK			Size of a block of a tar archive
+// ==================================================================
+
+#define STREAM_TAR 1
+#define STREAM_PDB 2
+#define STREAM_CIF 3
+#define STREAM_BLOCK 0x10000
+#define TAR_BLOCK 512
+
+// ==================================================================
+// type Stream
+// ==================================================================
+// file					The file read
+// gzip					Inflates it, if it is gzipped
+// name					Name of the stream
+// format				One of STREAM_* above
+// count				Number of structures read so far
+// error				Whether the stream is corrupt
+// block[0..length-1]	The block of the stream being read...
+// pos					...and how far through it we are
+// text[0..used-1]		The text of the structure being read (of PDB
+//						or mmCIF files), with room for room chars
+// line					Where in text the line being read starts
+// begun				Whether text holds the start of a data block
+// buffer				Buffer for reads from the file
+// ==================================================================
+
+struct _Stream
+{
+	FILE *file;
+	Gzip *gzip;
+	char *name;
+	int format;
+	long count;
+	int error;
+	const char *block;
+	long length;
+	long pos;
+	char *text;
+	long used;
+	long room;
+	long line;
+	int begun;
+	char buffer[STREAM_BLOCK];
+};
+
+// ==================================================================
+// Private methods of type Stream
+// ==================================================================
+// fill(S)				Make sure there is some of block left to read;
+//						false at the end of the stream
+// get(S,d,n)			Copy the next n bytes into d (or skip them if
+//						d is NULL); returns the number there were
+// tar(S,d,n,s)			next() for a tar archive
+// text(S,d,n,s)		next() for PDB or mmCIF files
+// append(S,s,n)		Add s[0..n-1] to text
+// ==================================================================
+
+static int Stream_fill(Stream*);
+static long Stream_get(Stream*,char*,long);
+static int Stream_tar(Stream*,char**,long*,char**);
+static int Stream_text(Stream*,char**,long*,char**);
+static void Stream_append(Stream*,const char*,long);
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static long octal(const unsigned char *s, int n)
+{
+	long x=0;
+	int i;
+
+	// A number in a tar header: octal digits (after any
+	// blanks), or big-endian binary if the top bit is set.
+
+	if(s[0]&0x80)
+	{
+		for(i=1; i<n; i++) x=(x<<8)|s[i];
+		return x;
+	}
+
+	for(i=0; i<n && (s[i]==' ' || s[i]==0); i++);
+	for(; i<n && s[i]>='0' && s[i]<='7'; i++) x=8*x+s[i]-'0';
+
+	return x;
+}
+
+static int isTar(const unsigned char *h)
+{
+	long sum=0;
+	int i;
+
+	// A tar header has a checksum of its bytes (with those
+	// of the checksum itself taken as blanks).
+
+	for(i=0; i<TAR_BLOCK; i++) sum += i>=148 && i<156 ? ' ':h[i];
+
+	return h[0] && sum==octal(&h[148],8);
+}
+
+static int isEnd(const char *s, long n)
+{
+	// An END record (but not ENDMDL).
+
+	return n>=3 && strncmp(s,"END",3)==0 && (n==3 || (unsigned char)s[3]<=' ');
+}
+
+// ==================================================================
+// Methods of type Stream
+// ==================================================================
+
+Stream *Stream_create(FILE *file, const char *name)
+{
+	Stream *S;
+	const char *p,*end;
+	int c;
+
+	S = (Stream*)calloc(1,sizeof(Stream));
+	S->file=file;
+	S->name=strdup(name);
+
+	// Peek at the first char to see if the stream is
+	// gzipped, then at the first block to see what it is.
+
+	if((c=getc(file))!=EOF) ungetc(c,file);
+	S->buffer[0]=(char)c;
+	if(c!=EOF && Gzip_test(S->buffer,1)) S->gzip=Gzip_create(file,NULL,0);
+
+	if(Stream_fill(S) && S->length>=TAR_BLOCK && isTar((const unsigned char*)S->block))
+	{
+		S->format=STREAM_TAR;
+	}
+	else
+	{
+		// Text is mmCIF if the first thing in it (but
+		// blanks and comments) is a data block.
+
+		S->format=STREAM_PDB;
+		end=&S->block[S->length];
+		for(p=S->block; p<end && ((unsigned char)*p<=' ' || *p=='#'); p++)
+		{
+			if(*p=='#' && !(p=memchr(p,'\n',end-p))) break;
+		}
+		if(p && end-p>=5 && strncmp(p,"data_",5)==0) S->format=STREAM_CIF;
+	}
+
+	return S;
+}
+
+void Stream_free(Stream *S)
+{
+	if(S)
+	{
+		Gzip_free(S->gzip);
+		free(S->text);
+		free(S->name);
+		free(S);
+	}
+}
+
+int Stream_next(Stream *S, char **data, long *size, char **name)
+{
+	if(S->format==STREAM_TAR) return Stream_tar(S,data,size,name);
+	return Stream_text(S,data,size,name);
+}
+
+// ==================================================================
+// Private methods of type Stream
+// ==================================================================
+
+static int Stream_fill(Stream *S)
+{
+	long n;
+
+	if(S->pos<S->length) return 1;
+	if(S->error) return 0;
+
+	if(S->gzip)
+	{
+		n=Gzip_read(S->gzip,&S->block);
+	}
+	else
+	{
+		n=fread(S->buffer,1,STREAM_BLOCK,S->file);
+		S->block=S->buffer;
+	}
+
+	S->length = n>0 ? n:0;
+	S->pos=0;
+	if(n<0) S->error=1;
+
+	return n>0;
+}
+
+static long Stream_get(Stream *S, char *d, long n)
+{
+	long k,m;
+
+	for(k=0; k<n && Stream_fill(S); k+=m)
+	{
+		m = n-k<S->length-S->pos ? n-k:S->length-S->pos;
+		if(d) memcpy(&d[k],&S->block[S->pos],m);
+		S->pos+=m;
+	}
+
+	return k;
+}
+
+static int Stream_tar(Stream *S, char **data, long *size, char **name)
+{
+	unsigned char h[TAR_BLOCK];
+	char *d,*s,*t,*path=NULL;
+	long n,m,k;
+
+	for(;;)
+	{
+		// 1. Read the next header. A zero block (or the end
+		// of the stream just here) ends the archive.
+
+		k=Stream_get(S,(char*)h,TAR_BLOCK);
+		if(k==0 && !S->error) break;
+		if(k<TAR_BLOCK) goto bad;
+		if(!h[0]) break;
+		if(!isTar(h)) goto bad;
+
+		// 2. Skip all but regular files, GNU long names and
+		// pax headers (which may also give a long name).
+
+		n=octal(&h[124],12);
+		m=(TAR_BLOCK-n%TAR_BLOCK)%TAR_BLOCK;
+
+		if(h[156]!='0' && h[156]!=0 && h[156]!='7' && h[156]!='L' && h[156]!='x')
+		{
+			if(Stream_get(S,NULL,n+m)<n+m) goto bad;
+			continue;
+		}
+
+		d=(char*)malloc(n+1);
+		if(Stream_get(S,d,n)<n || Stream_get(S,NULL,m)<m)
+		{
+			free(d);
+			goto bad;
+		}
+		d[n]=0;
+
+		// 3. A long name is that of the next file. In a pax
+		// header it is the record "<length> path=<name>\n".
+
+		if(h[156]=='L')
+		{
+			free(path);
+			path=d;
+			continue;
+		}
+
+		if(h[156]=='x')
+		{
+			for(s=d; s<&d[n]; s+=k)
+			{
+				if((k=strtol(s,&t,10))<=0 || s+k>&d[n]) break;
+				if(strncmp(t," path=",6)==0)
+				{
+					free(path);
+					path=strndup(t+6,s+k-1-(t+6));
+				}
+			}
+
+			free(d);
+			continue;
+		}
+
+		// 4. Otherwise this is a structure. Its name is the
+		// long name (if any) or the name in the header, after
+		// the prefix in a POSIX header.
+
+		if(!path)
+		{
+			path=(char*)malloc(257);
+			if(memcmp(&h[257],"ustar",6)==0 && h[345])
+			{
+				sprintf(path,"%.155s/%.100s",(const char*)&h[345],(const char*)h);
+			}
+			else sprintf(path,"%.100s",(const char*)h);
+		}
+
+		*data=d;
+		*size=n;
+		*name=path;
+		S->count++;
+
+		return 1;
+	}
+
+	free(path);
+	return 0;
+
+bad:
+	free(path);
+	return -1;
+}
+
+static int Stream_text(Stream *S, char **data, long *size, char **name)
+{
+	const char *p,*q;
+	char *rest;
+	long n,k;
+
+	// Read lines into text until one ends the structure: an
+	// END record, or a data block after the one it began with
+	// (which is put back to begin the next), or the end of the
+	// stream, whose last line may have no newline but is part
+	// of the structure all the same.
+
+	for(;;)
+	{
+		if(!Stream_fill(S))
+		{
+			S->line=S->used;
+			break;
+		}
+
+		p=&S->block[S->pos];
+		q=memchr(p,'\n',S->length-S->pos);
+		q = q ? q+1:&S->block[S->length];
+		Stream_append(S,p,q-p);
+		S->pos=q-S->block;
+
+		if(q[-1]!='\n') continue;
+
+		p=&S->text[S->line];
+		n=S->used-S->line;
+
+		if(S->format==STREAM_PDB && isEnd(p,n))
+		{
+			S->line=S->used;
+			break;
+		}
+
+		if(S->format==STREAM_CIF && n>=5 && strncmp(p,"data_",5)==0)
+		{
+			if(S->begun) break;
+			S->begun=1;
+		}
+
+		S->line=S->used;
+	}
+
+	if(S->error) return -1;
+
+	// What is left at the end of the stream is a structure
+	// unless it is blank.
+
+	for(k=0; k<S->line && (unsigned char)S->text[k]<=' '; k++);
+	if(k==S->line) return 0;
+
+	// Hand over the text, keeping any line which was put
+	// back for the next structure.
+
+	n=S->used-S->line;
+	rest=S->text;
+
+	*data=S->text;
+	*size=S->line;
+	*name=(char*)malloc(strlen(S->name)+24);
+	sprintf(*name,"%s:%li",S->name,++S->count);
+
+	S->text=NULL;
+	S->used=S->room=S->line=0;
+	S->begun=0;
+
+	if(n>0)
+	{
+		Stream_append(S,&rest[*size],n);
+		S->line=S->used;
+		S->begun=1;
+	}
+
+	return 1;
+}
+
+static void Stream_append(Stream *S, const char *s, long n)
+{
+	if(S->used+n>S->room)
+	{
+		for(S->room = S->room ? S->room:STREAM_BLOCK; S->used+n>S->room; S->room*=2);
+		S->text=(char*)realloc(S->text,S->room);
+	}
+
+	memcpy(&S->text[S->used],s,n);
+	S->used+=n;
+}
+
+// ==================================================================
@@ -0,0 +1,49 @@
+// ==================================================================
+// Stream.h
+// ==================================================================
+// Declaration of type Stream and its methods (a reader of many
+// structures from one file or pipe).
+// ==================================================================
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Stream				A stream of structures
+// ==================================================================
+
+typedef struct _Stream Stream;
+
+// ==================================================================
+// Methods of type Stream
+// ==================================================================
+// create(f,s)			Start reading the structures in f, named s
+// free(S)				Free S (but do not close its file)
+// next(S,d,n,s)		Read the next structure into d[0..*n-1] and
+//						its name into s (both to be freed by the
+//						caller); returns 1, 0 at the end of the
+//						stream or -1 if it is corrupt
+// ==================================================================
+// The stream is read once, in order, so f may be a pipe. It may be
+// gzipped, and holds either
+//
+// - a tar archive, each regular file in which is a structure named
+//   by its path (and may be in any format Molecule_create reads), or
+// - PDB files one after another, each ending with an END record, or
+//   mmCIF files one after another, each starting with a data block.
+//   The kth structure (counting from 1) is named s:k.
+//
+// The structures are not read (see Molecule_read), only split up.
+// ==================================================================
+
+extern Stream *Stream_create(FILE*,const char*);
+extern void Stream_free(Stream*);
+extern int Stream_next(Stream*,char**,long*,char**);
+
+// ==================================================================
+
+#endif
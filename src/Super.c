@@ -10,49 +10,41 @@
 #include <stdlib.h>
 #include <string.h>
 
-// ==================================================================
-// Local type Node
-// ==================================================================
-// data[]			The 2 vectors stored at this node
-// succ				The next pair.
-// ==================================================================
-
-typedef struct _Node Node;
-
-struct _Node
-{
-	double data[2][3];
-	Node *succ;
-};
-
-// ==================================================================
-// Methods of local type Node
-// ==================================================================
-
-static Node *Node_create(const double*, const double*);
-static void Node_free(Node*);
-
 // ==================================================================
 // type Superposition
 // ==================================================================
 // upToDate			True if rmsd up to date.
+// rotated			True if rotation is up to date too
 // rmsd				The current rmsd
 // rmsd100			The current rmsd100
 // count			Number of vector pairs added
-// head				The head of the list of pairs
 // centre[k]		The centroid of the kth set (k=0,1)
 // rotation			The rotation matrix used
+// covariance		Covariance of the sets about their centroids
+// lambda			Largest eigenvalue of its key matrix (see below)
+// sum[k]			Sum of the vectors of the kth set
+// square[k]		Sum of their squared lengths
+// cross[3*i+j]		Sum of x[i]*y[j] over the pairs (x,y)
+// ==================================================================
+// Only these running sums of the pairs are kept, so that a pair is
+// added or removed in constant time with no allocation, and the
+// superposition is computed from them without revisiting the pairs.
 // ==================================================================
 
 struct _Superposition
 {
 	int upToDate;
+	int rotated;
 	double rmsd;
 	double rmsd100;
 	int count;
 	double rotation[9];
 	double centre[2][3];
-	Node *head;
+	double covariance[9];
+	double lambda;
+	double sum[2][3];
+	double square[2];
+	double cross[9];
 };
 
 // ==================================================================
@@ -66,18 +58,21 @@ static void Superposition_compute(Superposition*);
 // ==================================================================
 // Local procedures
 // ==================================================================
-// min(a,b)				Returns min(a,b)
 // max(a,b)				Returns max(a,b)
-// rotate()				Used by subroutine jacobi()
-// jacobi(M,P,v)		Computes diag(v) = P^T M P (M in, P,v out)
-// superpose(a,b,n,M)	Computes superposition of arrays
+// key(X,K)				The key matrix K (4x4) of covariance X
+// det3(A,n,r,c)		Determinant of rows r[] and columns c[] (3 of
+//						each) of the n-column matrix A
+// largest(X,K,e)		Largest eigenvalue of K, given an upper bound e
+// quaternion(K,l,q)	Unit eigenvector q of K for eigenvalue l
+// rotation(q,M)		The rotation matrix M of unit quaternion q
 // ==================================================================
 
-static double min(double,double);
 static double max(double,double);
-static void rotate(double*,double*,int,int);
-static int jacobi(double*,double*,double*);
-static double superpose(double*,double*,int,double*);
+static void key(const double*,double*);
+static double det3(const double*,int,const int*,const int*);
+static double largest(const double*,const double*,double);
+static void quaternion(const double*,double,double*);
+static void rotation(const double*,double*);
 
 // ==================================================================
 // Methods of type Superposition
@@ -92,29 +87,55 @@ Superposition *Superposition_create(void)
 
 void Superposition_free(Superposition *S)
 {
-	Node *tmp;
-	if(S)
-	{
-		while(S->head)
-		{
-			tmp=S->head->succ;
-			Node_free(S->head);
-			S->head=tmp;
-		}
+	if(S) free(S);
+}
 
-		free(S);
-	}
+void Superposition_reset(Superposition *S)
+{
+	memset(S,0,sizeof(Superposition));
 }
 
 void Superposition_align(Superposition *S,const double *x,const double *y)
 {
-	Node *n;
+	int i,j;
 
 	S->upToDate=0;
-	n=Node_create(x,y);
-	n->succ=S->head;
-	S->head=n;
 	S->count++;
+
+	for(i=0; i<3; i++)
+	{
+		S->sum[0][i] += x[i];
+		S->sum[1][i] += y[i];
+		S->square[0] += x[i]*x[i];
+		S->square[1] += y[i]*y[i];
+
+		for(j=0; j<3; j++) S->cross[3*i+j] += x[i]*y[j];
+	}
+}
+
+void Superposition_alignAll(Superposition *S,const double *x,const double *y,int n)
+{
+	int k;
+
+	for(k=0; k<n; k++) Superposition_align(S,&x[3*k],&y[3*k]);
+}
+
+void Superposition_remove(Superposition *S,const double *x,const double *y)
+{
+	int i,j;
+
+	S->upToDate=0;
+	S->count--;
+
+	for(i=0; i<3; i++)
+	{
+		S->sum[0][i] -= x[i];
+		S->sum[1][i] -= y[i];
+		S->square[0] -= x[i]*x[i];
+		S->square[1] -= y[i]*y[i];
+
+		for(j=0; j<3; j++) S->cross[3*i+j] -= x[i]*y[j];
+	}
 }
 
 int Superposition_count(const Superposition *S)
@@ -138,85 +159,58 @@ double Superposition_rmsd100(Superposition *S)
 
 void Superposition_compute(Superposition *S)
 {
-	Node *n;
-	double *r1;
-	double *r2;
-	double c1[3];
-	double c2[3];
-	int c,i,j,k;
-	double v[3];
+	double *X = S->covariance;
+	double K[16];
+	double sumA,sumB;
 	double rmsd;
-
-	double tmp,tst;
+	int c,i,j;
 
 	if(S->count<=1) return;
 
-	// Copy all the vectors into an array.
-	// This is not strictly necessary, but the
-	// superposition code works on arrays
-	// and I can't be arsed to rewrite it.
+	// Find the centroids of both sets, and from them the
+	// sums of squares and covariance of the sets about
+	// their centroids, i.e. as if each set were shifted
+	// to make its centroid the origin.
 
 	c=S->count;
-	r1=(double*)calloc(c,sizeof(double)*3);
-	r2=(double*)calloc(c,sizeof(double)*3);
 
-	for(n=S->head,k=0; k<c; k++,n=n->succ)
+	for(j=0; j<3; j++)
 	{
-		for(j=0; j<3; j++)
-		{
-			r1[3*k+j]=n->data[0][j];
-			r2[3*k+j]=n->data[1][j];
-		}
+		S->centre[0][j]=S->sum[0][j]/(double)c;
+		S->centre[1][j]=S->sum[1][j]/(double)c;
 	}
 
-	// Find the centroids of both sets...
+	sumA=S->square[0];
+	sumB=S->square[1];
 
-	memset(c1,0,sizeof(double)*3);
-	memset(c2,0,sizeof(double)*3);
-
-	for(i=0; i<c; i++)
+	for(i=0; i<3; i++)
 	{
+		sumA -= S->sum[0][i]*S->centre[0][i];
+		sumB -= S->sum[1][i]*S->centre[1][i];
+
 		for(j=0; j<3; j++)
 		{
-			c1[j] += r1[3*i+j];
-			c2[j] += r2[3*i+j];
+			X[3*i+j] = S->cross[3*i+j]-S->sum[0][i]*S->centre[1][j];
 		}
 	}
 
-	for(j=0; j<3; j++)
-	{
-		c1[j]/=(double)c;
-		c2[j]/=(double)c;
-	}
-
-	// Shift each set by its centroid to make each
-	// centroid the origin. Forgot this at first and
-	// results were FUBAR!
+	// The best rotation takes the sum of squares of the
+	// displacements down by twice the largest eigenvalue
+	// of the key matrix, which is all the rmsd needs. The
+	// rotation itself is only found if asked for.
 
-	for(i=0; i<c; i++)
-	{
-		for(j=0; j<3; j++)
-		{
-			r1[3*i+j] -= c1[j];
-			r2[3*i+j] -= c2[j];
-		}
-	}
+	key(X,K);
+	S->lambda=largest(X,K,0.5*(sumA+sumB));
 
-	rmsd = superpose(r1,r2,c,S->rotation);
+	rmsd = sumA + sumB - (double)2*S->lambda;
+	rmsd = sqrt(max(rmsd,0)/(double)c);
 
 	// Set the easy fields...
 
 	S->rmsd=rmsd;
 	S->rmsd100=rmsd/(1+0.5*log(c/100.));
 	S->upToDate=1;
-
-	memcpy(S->centre[0],c1,sizeof(double)*3);
-	memcpy(S->centre[1],c2,sizeof(double)*3);
-
-	// Free temporary memory.
-
-	free(r1);
-	free(r2);
+	S->rotated=0;
 }
 
 const double *Superposition_centroid(Superposition *S,int k)
@@ -228,7 +222,22 @@ const double *Superposition_centroid(Superposition *S,int k)
 
 const double *Superposition_rotation(Superposition *S)
 {
+	double K[16];
+	double q[4];
+
 	if(!S->upToDate) Superposition_compute(S);
+
+	if(!S->rotated)
+	{
+		if(S->count>1)
+		{
+			key(S->covariance,K);
+			quaternion(K,S->lambda,q);
+			rotation(q,S->rotation);
+		}
+		S->rotated=1;
+	}
+
 	return S->rotation;
 }
 
@@ -236,326 +245,199 @@ const double *Superposition_rotation(Superposition *S)
 // ==================================================================
 // The superposition algorithm stuff
 // ==================================================================
-
-static double min(double a, double b)
-{
-	return a<b ? a:b;
-}
+// This is the quaternion method (B.K.P. Horn, J. Opt. Soc. Am. A 4,
+// 629 (1987)), with the largest eigenvalue found as the largest root
+// of the characteristic polynomial of the key matrix by Newton's
+// method, as in QCP (D.L. Theobald, Acta Cryst. A61, 478 (2005)). The
+// unit quaternion q of its eigenvector gives the rotation taking the
+// first set of vectors onto the second; it is always proper, and is
+// well defined unless the vectors are all on one line.
+// ==================================================================
 
 static double max(double a, double b)
 {
 	return a>b ? a:b;
 }
 
-static const double PRECISION = 1e-12;
-
-static void rotate(double *W, double *P, int ip, int iq)
+static void key(const double *X, double *K)
 {
-	// Here we sacrifice some speed/precision in
-	// favour of simplicity. I dislike heuristic
-	// optimistations - and distrust them too.
-
-	double c,s;
-	double pp,qq,pq;
-	double t;
-	int k;
-
-	double colWp[3];
-	double colWq[3];
-	double colPp[3];
-	double colPq[3];
-
-	// Here we must "rotate" element (ip,iq).
-	// Rather than follow the formula given
-	// in NR/C, I'll do my own - probably
-	// very slow in comparison since it uses
-	// a trig function. But I understand it
-	// so that's all that matters...
-
-	// Thus, W -> R^T W R and P -> P R where
-	// R is an (ip,iq) rotation matrix.
-	// Below, c and s are the cosine and sine
-	// of the angle of rotation theta.
-
-	// Calculate the cos and sin required
-	// The new W(ip,iq) is given by...
-	//
-	//  W(ip,iq) -> (c*c-s*s)W(ip,iq)-sc(W(ip,ip)-W(iq,iq))
-	//
-	// so this is the thing we want to zero.
-	// Put A = W(ip,iq), B = (W(ip,ip)-W(iq,iq)),
-	// c = cos(t), s = sin(t) and we have
-	//
-	//  2cos(2t)A = sin(2t)B
-	//
-	// Now we can solve for 2t using atan2.
-
-	t = atan2(2*W[3*ip+iq],W[3*iq+iq]-W[3*ip+ip])/(double)2;
-
-	c = cos(t);
-	s = sin(t);
-
-	// So now we have c and s. We need to calculate
-	// the new values of the iqth and ipth columns of
-	// both W and of P.
-
-	for(k=0; k<3; k++)
-	{
-		colWp[k] = c*W[3*k+ip] - s*W[3*k+iq];
-		colWq[k] = c*W[3*k+iq] + s*W[3*k+ip];
-		colPp[k] = c*P[3*k+ip] - s*P[3*k+iq];
-		colPq[k] = s*P[3*k+ip] + c*P[3*k+iq];
-	}
-
-	// Some of the above are not correct. In particular
-	// whenever k=ip or k=iq we need a correction for
-	// the W matrix...
-    // Element 	W(ip,ip)
-
-	pp = c*c*W[3*ip+ip]+s*s*W[3*iq+iq]-(double)2*s*c*W[3*ip+iq];
-
-	// Element W(iq,iq)
-
-	qq = s*s*W[3*ip+ip]+c*c*W[3*iq+iq]+(double)2*s*c*W[3*ip+iq];
-
-	// Element W(ip,iq)
-
-	pq = (double)0; // = (c*c-s*s)*W(ip,iq) + s*c*(W(ip,ip)-W(iq,iq))  ;-)
-
-	// Put the new values into W and into P...
-
-	for(k=0; k<3; k++)
-	{
-		W[3*k+ip] = colWp[k];
-		W[3*ip+k] = colWp[k];
-    	W[3*k+iq] = colWq[k];
-		W[3*iq+k] = colWq[k];
-
-		P[3*k+ip] = colPp[k];
-		P[3*k+iq] = colPq[k];
-	}
-
-	W[3*ip+ip] = pp;
-	W[3*iq+iq] = qq;
-	W[3*ip+iq] = pq;
-	W[3*iq+ip] = pq;
+	// X[3*i+j] is the sum of x[i]*y[j] over the pairs.
+
+	K[0]  =  X[0]+X[4]+X[8];
+	K[1]  =  X[5]-X[7];
+	K[2]  =  X[6]-X[2];
+	K[3]  =  X[1]-X[3];
+	K[5]  =  X[0]-X[4]-X[8];
+	K[6]  =  X[1]+X[3];
+	K[7]  =  X[6]+X[2];
+	K[10] = -X[0]+X[4]-X[8];
+	K[11] =  X[5]+X[7];
+	K[15] = -X[0]-X[4]+X[8];
+
+	K[4]=K[1];
+	K[8]=K[2];
+	K[9]=K[6];
+	K[12]=K[3];
+	K[13]=K[7];
+	K[14]=K[11];
+}
 
-	// We're done, and ready for the next pass
+static double det3(const double *A, int n, const int *r, const int *c)
+{
+	return
+		+ A[n*r[0]+c[0]]*(A[n*r[1]+c[1]]*A[n*r[2]+c[2]]-A[n*r[1]+c[2]]*A[n*r[2]+c[1]])
+		- A[n*r[0]+c[1]]*(A[n*r[1]+c[0]]*A[n*r[2]+c[2]]-A[n*r[1]+c[2]]*A[n*r[2]+c[0]])
+		+ A[n*r[0]+c[2]]*(A[n*r[1]+c[0]]*A[n*r[2]+c[1]]-A[n*r[1]+c[1]]*A[n*r[2]+c[0]]);
 }
 
-static int jacobi(double *M, double *P, double *v)
+static double largest(const double *X, const double *K, double e)
 {
-	double W[9];
-	int iterationCount=0;
-	int done=0;
-	int i,j;
-	double sum;
+	static const int all[3] = { 0,1,2 };
+	static const int other[4][3] = { {1,2,3},{0,2,3},{0,1,3},{0,1,2} };
+	double c0,c1,c2;
+	double l,m,p,q,dp,d;
+	int i;
 
-	// W is a copy of M to be diagonlised, P is initially the
-	// identity matrix...
+	// The characteristic polynomial of K (which has trace
+	// 0) is l^4 + c2 l^2 + c1 l + c0.
 
-	memcpy(W,M,sizeof(W));
-	memset(P,0,sizeof(W));
-	P[0]=P[4]=P[8]=(double)1;
+	c2=0.0;
+	for(i=0; i<9; i++) c2 -= (double)2*X[i]*X[i];
 
-	// Loop until finished...
+	c1 = -(double)8*det3(X,3,all,all);
 
-	while(!done)
+	c0=0.0;
+	for(i=0; i<4; i++)
 	{
-		iterationCount++;
-
-		// Sum the absolute values of the off-diagonal
-		// elements of the working matrix...
-
-		sum=(double)0;
-
-		for(i=0; i<2; i++)
-		{
-			for(j=i+1; j<3; j++)
-			{
-				sum += fabs(W[3*i+j]);
-			}
-		}
+		d=K[i]*det3(K,4,other[0],other[i]);
+		c0 += i%2 ? -d:d;
+	}
 
-		// If the sum is small enough we are done. If
-		// not, we need to rotate all the off-diagonal
-		// elements...
+	// Newton's method from e, which is at least as large as
+	// the largest root, comes down to it monotonically. It
+	// stops when rounding leaves it no nearer (as it does
+	// short of a repeated root, where the polynomial only
+	// just touches zero).
 
-		if(sum<PRECISION)
-		{
-			done=1;
-		}
-  		else
-		{
-			// "Rotate" all the off-diagonal elements
-			// of the working matrix in conjunction with
-			// P. This is the guts of the algorithm.
+	l=e;
+	p=((l*l+c2)*l+c1)*l+c0;
 
-			for(i=0; i<2; i++)
-			{
-				for(j=i+1; j<3; j++)
-				{
-					rotate(W,P,i,j);
-				}
-			}
-		}
-	}
+	for(i=0; i<50; i++)
+	{
+		dp=((double)4*l*l+(double)2*c2)*l+c1;
+		if(dp<=0.0) break;
 
-	// Finally, copy the diagonal values of W to the
-	// vector of eigenvalues...
+		d=p/dp;
+		m=l-d;
+		q=((m*m+c2)*m+c1)*m+c0;
+		if(fabs(q)>=fabs(p)) break;
 
-	for(i=0; i<3; i++)
-	{
-		v[i]=W[4*i];
+		l=m;
+		p=q;
+		if(fabs(d)<=1e-11*fabs(l)) break;
 	}
 
-
-	return iterationCount;
+	return l;
 }
 
-
-static double superpose(double *a,double *b, int n, double *M)
+static void quaternion(const double *K, double l, double *q)
 {
-	double sumA=(double)0;
-	double sumB=(double)0;
-	double sumE=(double)0;
-	double detX;
-	double X[9];
-	double XX[9];
-	double P[9];
-	double Q[9];
-	double T[9];
-	double e[3];
-	double rmsd;
-	double factor;
-	int i,j,k;
-	int flag;
-
-	// Compute sum-of squares
-
-	for(i=0; i<3*n; i++)
+	static const int other[4][3] = { {1,2,3},{0,2,3},{0,1,3},{0,1,2} };
+	double A[16];
+	double B[4][4];
+	double v[4];
+	double best,norm,d;
+	int i,j,k,m;
+
+	memcpy(A,K,sizeof(A));
+	for(i=0; i<4; i++) A[5*i]-=l;
+
+	// A = K - l I has rank 3 when l is a simple eigenvalue,
+	// and then each column of its adjugate is a multiple of
+	// the eigenvector: take the longest.
+
+	best=0.0;
+	for(j=0; j<4; j++)
 	{
-		sumA += a[i]*a[i];
-		sumB += b[i]*b[i];
-	}
-
-	// Compute the "covariances" X
-
-	memset(X,0,sizeof(X));
-	memset(XX,0,sizeof(XX));
+		norm=0.0;
+		for(i=0; i<4; i++)
+		{
+			v[i]=det3(A,4,other[j],other[i]);
+			if((i+j)%2) v[i]=-v[i];
+			norm+=v[i]*v[i];
+		}
 
-	for(i=0; i<n; i++)
-	{
-		for(j=0; j<3; j++)
+		if(norm>best)
 		{
-			for(k=0; k<3; k++)
-			{
-				X[3*j+k] += a[3*i+j]*b[3*i+k];
-			}
+			best=norm;
+			memcpy(q,v,sizeof(v));
 		}
 	}
 
-	// And compute det(X)...
-
-	detX =
-		+ X[0]*(X[4]*X[8]-X[5]*X[7])
-		- X[1]*(X[3]*X[8]-X[5]*X[6])
-		+ X[2]*(X[3]*X[7]-X[4]*X[6]);
+	// If the adjugate vanishes (to rounding), l is repeated,
+	// i.e. the vectors are on a line (or a point) and any
+	// rotation about it is as good: take the unit vector
+	// furthest from the row space of A, projecting out an
+	// orthonormal basis B of the rows (Gram-Schmidt).
 
-	// Compute X^T.X (XX)
+	d=fabs(l);
+	for(i=0; i<16; i++) d=max(d,fabs(K[i]));
 
-	for(i=0; i<3; i++)
+	if(best<=1e-20*d*d*d*d*d*d)
 	{
-		for(j=0; j<3; j++)
+		m=0;
+		for(i=0; i<4; i++)
 		{
-			for(k=0; k<3; k++)
+			memcpy(v,&A[4*i],sizeof(v));
+			for(k=0; k<m; k++)
 			{
-				XX[3*i+j] += X[3*k+i]*X[3*k+j];
+				norm=v[0]*B[k][0]+v[1]*B[k][1]+v[2]*B[k][2]+v[3]*B[k][3];
+				for(j=0; j<4; j++) v[j]-=norm*B[k][j];
 			}
-		}
-	}
-
-	// Compute the diagonalisation of XX using
-	// the Jacobi algorithm...
 
-	jacobi(XX,P,e);
+			norm=sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]+v[3]*v[3]);
+			if(norm<=1e-8*d) continue;
 
-	e[0]=max(e[0],0);
-	e[1]=max(e[1],0);
-	e[2]=max(e[2],0);
-
-
-	sumE = sqrt(e[0]) + sqrt(e[1]) + sqrt(e[2]);
-
-	if(detX<1e-8)
-	{
-		sumE -= (double)2*sqrt(min(e[0],min(e[1],e[2])));
-		flag=1;
-	}
-	else
-	{
-		flag=0;
-	}
-
-	rmsd = sumA + sumB - (double)2*sumE;
-	rmsd = sqrt(max(rmsd,0)/(double)n);
-
-	// Compute the transform and return the rmsd.
-	// This will fail if XX has rank<3. I need to
-	// fix this...
+			for(j=0; j<4; j++) B[m][j]=v[j]/norm;
+			m++;
+		}
 
-	for(i=0; i<3; i++)
-	{
-		for(j=0; j<3; j++)
+		best=-1.0;
+		for(i=0; i<4; i++)
 		{
-			factor = sqrt(e[j]);
-			if(flag && j==0)
-			{
-				factor = -factor;
-			}
-
-			T[3*i+j]=0.0;
-			for(k=0; k<3; k++)
+			memset(v,0,sizeof(v));
+			v[i]=1.0;
+			for(k=0; k<m; k++)
 			{
-				T[3*i+j] += X[3*i+k]*P[3*k+j]/factor;
+				for(j=0; j<4; j++) v[j]-=B[k][i]*B[k][j];
 			}
-		}
-	}
 
-	for(i=0; i<3; i++)
-	{
-		for(j=0; j<3; j++)
-		{
-			M[3*i+j]=0.0;
-			for(k=0; k<3; k++)
+			norm=v[0]*v[0]+v[1]*v[1]+v[2]*v[2]+v[3]*v[3];
+			if(norm>best)
 			{
-				M[3*i+j] += P[3*i+k]*T[3*j+k];
+				best=norm;
+				memcpy(q,v,sizeof(v));
 			}
 		}
 	}
 
-	return rmsd;
-}
-
-// ==================================================================
-// Methods of type Node
-// ==================================================================
-
-static Node *Node_create(const double *x, const double *y)
-{
-	Node *n;
-	if(!x || !y) return NULL;
-
-	n=(Node*)malloc(sizeof(Node));
-	memcpy(n->data[0],x,sizeof(double)*3);
-	memcpy(n->data[1],y,sizeof(double)*3);
-	return n;
+	norm=sqrt(q[0]*q[0]+q[1]*q[1]+q[2]*q[2]+q[3]*q[3]);
+	for(i=0; i<4; i++) q[i]/=norm;
 }
 
-static void Node_free(Node *n)
+static void rotation(const double *q, double *M)
 {
-	if(n) free(n);
+	double a=q[0],b=q[1],c=q[2],d=q[3];
+
+	M[0] = a*a+b*b-c*c-d*d;
+	M[1] = (double)2*(b*c-a*d);
+	M[2] = (double)2*(b*d+a*c);
+	M[3] = (double)2*(b*c+a*d);
+	M[4] = a*a-b*b+c*c-d*d;
+	M[5] = (double)2*(c*d-a*b);
+	M[6] = (double)2*(b*d-a*c);
+	M[7] = (double)2*(c*d+a*b);
+	M[8] = a*a-b*b-c*c+d*d;
 }
 
 // ==================================================================
-
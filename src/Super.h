@@ -21,17 +21,27 @@ typedef struct _Superposition Superposition;
 // ==================================================================
 // create()				Create an empty superposition object
 // free(S)				Free superposition S and assocatited mem.
+// reset(S)				Empty S, to be used again
 // associate(x,y)		Associate vectors x and y in the superpsn.
+// alignAll(S,x,y,n)	Associate x[3i..3i+2] with y[3i..3i+2], i<n
+// remove(x,y)			Undo associate(x,y)
 // count(S)				Return number of associated vector pairs
 // rmsd(S)				Return the rmsd (computes if out-of-date)
 // rmsd100(S)			As above but computes rmsd100 (see code)
 // centroid(S,k)		Centroid of left or right set of points
 // rotation(S)			Returns rotation matrix (as 9 doubles)
 // ==================================================================
+// A superposition keeps only running sums of its pairs, so one
+// object may be reset and reused for any number of superpositions
+// with no allocation.
+// ==================================================================
 
 extern Superposition *Superposition_create(void);
 extern void Superposition_free(Superposition*);
+extern void Superposition_reset(Superposition*);
 extern void Superposition_align(Superposition*,const double*,const double*);
+extern void Superposition_alignAll(Superposition*,const double*,const double*,int);
+extern void Superposition_remove(Superposition*,const double*,const double*);
 extern int Superposition_count(const Superposition*);
 extern double Superposition_rmsd(Superposition*);
 extern double Superposition_rmsd100(Superposition*);
@@ -24,11 +24,16 @@ typedef struct _Template Template;
 // free(T)				Free memory associated with template T
 // count(T)				Return number of atoms in template
 // match(T,k,A)			True if A matches atom k of T
+// select(T,k,A,n,i)	Indices i[] of those of A[0..n-1] matching atom k
+//						of T; returns the number of them
 // range(T,i,j,a,b)		[*a,*b] <- range of |atom i - atom j|
 // check(T,A,k,ignore_chain)	Check n-ary rules on atom k-1 and 0,...,k-2
 // position(T,i)		Position of atom i (example position)
 // name(T)			Returns the symbolic name for the template
 // logE(T,x,n)			Provide an estimate of logE for a hit
+// distWeight(T,k)		Distance cutoff modifier of atom k
+// key(T,k)				Canonical match rule of atom k: atoms with equal
+//						keys (in any templates) match the same atoms
 // ==================================================================
 
 struct _Template
@@ -36,12 +41,14 @@ struct _Template
 	void (*free)(Template*);
 	int (*count)(const Template*);
 	int (*match)(const Template*,int,const Atom*);
+	int (*select)(const Template*,int,const Atom*,int,int*);
 	int (*range)(const Template*,int,int,double*,double*);
 	int (*check)(const Template*,Atom**,int,int);
 	const double *(*position)(const Template*,int);
 	const char *(*name)(const Template*);
 	double (*logE)(const Template*,double,int);
 	double (*distWeight)(const Template*,int);
+	const char *(*key)(const Template*,int);
 };
 
 // ==================================================================
@@ -22,8 +22,16 @@
 // chainID				The chain field
 // name[k]				kth atom name alternate
 // resName[k]			kth residue name alternate
+// nameId[k]			Id of name[k] (see Atom_id())
+// resNameId[k]			Id of resName[k]
 // pos[k]				kth coordinate of position of atom
 // distWeight[k]			kth atom distance threshold modifier (weight)
+// key					Canonical form of the match rule (see key())
+// need,forbid			Classes (ATOM_*) a match must be in / not be in
+// mask[b]				Bits of the name id which must agree with one
+//						of nameId[] (b = atom name starts with a blank)
+// names				Number of nameId[] to test (0: any name will do)
+// resNames				Number of resNameId[] to test (0: any residue)
 // ==================================================================
 
 struct _TessAtom
@@ -37,10 +45,30 @@ struct _TessAtom
 	//char chainID; 
 	char **name;
 	char **resName;
+	unsigned int *nameId;
+	unsigned int *resNameId;
 	double pos[3];
 	double distWeight;
+	char *key;
+	unsigned char need;
+	unsigned char forbid;
+	unsigned int mask[2];
+	int names;
+	int resNames;
 };
 
+// ==================================================================
+// Private methods of type TessAtom
+// ==================================================================
+// compile(A)			Compile the match rule of A (false if bad code)
+// test(A,B)			True if atom B matches A
+// setKey(A)			Fill in A->key from the match rule of A
+// ==================================================================
+
+static int TessAtom_compile(TessAtom*);
+static int TessAtom_test(const TessAtom*,const Atom*);
+static void TessAtom_setKey(TessAtom*);
+
 // ==================================================================
 // Methods of type TessAtom (ARGGH!!!)
 // ==================================================================
@@ -83,6 +111,7 @@ TessAtom *TessAtom_create(const char *s)
 {
 	TessAtom *A;
 	Atom a;
+	AtomInfo info;
 	int i,k,m;
 	int rc,ac;
 	int rc1,ac1;
@@ -96,7 +125,7 @@ TessAtom *TessAtom_create(const char *s)
 	// 0. Parse the record as a standard PDB atom. We must
 	// at least have all fields up to the last coord field.
 
-	if(strlen(s)<54 || !Atom_parse(&a,s))
+	if(strlen(s)<54 || !Atom_parse(&a,&info,s))
 	{
 		return NULL;
 	}
@@ -137,16 +166,18 @@ TessAtom *TessAtom_create(const char *s)
 	rq = sizeof(TessAtom);
 	rq += sizeof(char*)*(ac+rc);
 	rq += sizeof(char)*(5*ac+4*rc);
+	rq += sizeof(char)*(16+5*ac+4*rc);
+	rq += sizeof(unsigned int)*(ac+rc+1);
 	A = (TessAtom*)calloc(1,rq);
 
 	// Set up basic fields...
 
-	A->code = a.serial;
+	A->code = info.serial;
 	A->resSeq = a.resSeq;
 	A->pos[0] = a.x[0];
 	A->pos[1] = a.x[1];
 	A->pos[2] = a.x[2];
-	A->distWeight = a.tempFactor;
+	A->distWeight = info.tempFactor;
 	A->chainID1 = a.chainID1;
 	A->chainID2 = a.chainID2;
 	//A->chainID = a.chainID;
@@ -157,6 +188,9 @@ TessAtom *TessAtom_create(const char *s)
 	// residue name and atom name fields
 
 	p=&A[1];
+	A->nameId=p;
+	A->resNameId=&A->nameId[ac];
+	p+=sizeof(unsigned int)*(ac+rc+(ac+rc)%2);
 	A->name=p;
 	p+=sizeof(char*)*ac;
 	for(m=0; m<ac; m++)
@@ -173,11 +207,13 @@ TessAtom *TessAtom_create(const char *s)
 		p+=4;
 	}
 
+	A->key=p;
+
 	// Copy the name and resName fields into
 	// the arrays at index 0.
 
-	strncpy(A->name[0],a.name,4);
-	strncpy(A->resName[0],a.resName,3);
+	strncpy(A->name[0],info.name,4);
+	strncpy(A->resName[0],info.resName,3);
 
 	// Finally, get all the extra fields at the end
 	// of the PDB record...
@@ -252,8 +288,18 @@ TessAtom *TessAtom_create(const char *s)
 		}
 	}
 
-	// Sorted!
+	// Sorted! Matching compares names by id.
 
+	for(m=0; m<ac; m++) A->nameId[m]=Atom_id(A->name[m],4);
+	for(m=0; m<rc; m++) A->resNameId[m]=Atom_id(A->resName[m],3);
+
+	if(!TessAtom_compile(A))
+	{
+		free(A);
+		return NULL;
+	}
+
+	TessAtom_setKey(A);
 	return A;
 }
 
@@ -293,95 +339,30 @@ int TessAtom_resSeq(const TessAtom *A)
 	return A->resSeq;
 }
 
-static int TessAtom_isCarbon(const Atom *A)
-{
-	return A->name[0]=='_' && A->name[1]=='C' ? 1:0;
-}
-
-//Riziotis 
-static int TessAtom_isHydrogen(const Atom *A)
-{
-	return A->name[0]=='_' && A->name[1]=='H' ? 1:0;
-}
-
-static int TessAtom_isInSamePosition(const TessAtom *T, const Atom *A)
-{
-	int k;
-
-	for(k=0; k<T->nameCount; k++)
-	{
-		if(A->name[0]=='_')
-		{
-			if(A->name[2]==T->name[k][2]) return 1;
-		}
-		else
-		{
-			if(A->name[1]==T->name[k][1] && A->name[2]==T->name[k][2]) return 1;
-		}
-	}
-
-	return 0;
-}
-//End Riziotis
-
-static int TessAtom_isMainChain(const Atom *A)
+const char *TessAtom_key(const TessAtom *A)
 {
-	if(strcasecmp(A->name,"_CA_")==0) return 1;
-	if(strcasecmp(A->name,"_N__")==0) return 1;
-	if(strcasecmp(A->name,"_O__")==0) return 1;
-
-	return 0;
+	return A->key;
 }
 
-static int TessAtom_matchName(const TessAtom *T, const Atom *A)
-{
-	int k;
-
-	for(k=0; k<T->nameCount; k++)
-	{
-		if(strcasecmp(A->name,T->name[k])==0) return 1;
-	}
-
-	return 0;
-}
-
-static int TessAtom_matchResName(const TessAtom *T, const Atom *A)
-{
-	int k;
-
-	for(k=0; k<T->resNameCount; k++)
-	{
-		if(strcasecmp(A->resName,T->resName[k])==0) return 1;
-	}
-
-	return 0;
-}
+// ==================================================================
+// Private methods of type TessAtom (matching)
+// ==================================================================
 
-static int TessAtom_matchType(const TessAtom *T, const Atom *A)
+static int TessAtom_compile(TessAtom *T)
 {
-	// There may still be some problems with this matching routine.
-	// But I don't give a flying f**k.
+	// Turn the match code into the classes an atom must and
+	// must not be in, and the parts of the atom name (if any)
+	// and residue name (if any) that must agree. The part of
+	// the name depends on whether the atom's name starts with
+	// a blank, so there are two masks, indexed by ATOM_BLANK.
 
-	int k;
+	unsigned int exact[2] = { 0xffffffff,0xffffffff };
+	unsigned int type[2] = { 0x0000ffff,0x0000ff00 };
+	unsigned int place[2] = { 0x00ffff00,0x00ff0000 };
+	unsigned int *mask=NULL;
+	int res=1;
 
-	for(k=0; k<T->nameCount; k++)
-	{
-		if(A->name[0]=='_')
-		{
-			if(A->name[1]==T->name[k][1]) return 1;
-		}
-		else
-		{
-			if(A->name[0]==T->name[k][0] && A->name[1]==T->name[k][1]) return 1;
-		}
-	}
-
-	return 0;
-}
-
-int TessAtom_match(const TessAtom *T, const Atom *A)
-{
-	// Return true if A matches T...
+	T->need=T->forbid=0;
 
 	switch(T->code)
 	{
@@ -389,122 +370,242 @@ int TessAtom_match(const TessAtom *T, const Atom *A)
 	case 0:
 		// An exact match on both atom name and residue name.
 
-		if(!TessAtom_matchName(T,A)) return 0;
-		return TessAtom_matchResName(T,A);
+		mask=exact;
+		break;
 
 	case 1:
 		// An exact match on residue name and any non-carbon
 		// side-chain atom.
 
-		if(TessAtom_isCarbon(A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		if(TessAtom_isMainChain(A)) return 0;
-		return TessAtom_matchResName(T,A);
+		T->forbid=ATOM_CARBON|ATOM_HYDROGEN|ATOM_MAINCHAIN;
+		break;
 
 	case 2:
 		// Any non-carbon atom in the list of residues given...
 
-		if(TessAtom_isCarbon(A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		return TessAtom_matchResName(T,A);
+		T->forbid=ATOM_CARBON|ATOM_HYDROGEN;
+		break;
 
 	case 3:
 		// Atom type specified is residue(s) given
 
-		if(!TessAtom_matchType(T,A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		return TessAtom_matchResName(T,A);
+		T->forbid=ATOM_HYDROGEN;
+		mask=type;
+		break;
 
 	case 4:
 		// Non-carbon main-chain in given residue(s)
 
-		if(TessAtom_isCarbon(A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		if(!TessAtom_isMainChain(A)) return 0;
-		return TessAtom_matchResName(T,A);
+		T->need=ATOM_MAINCHAIN;
+		T->forbid=ATOM_CARBON|ATOM_HYDROGEN;
+		break;
 
 	case 5:
 		// Any main-chain atom in the given residue(s)
 
-		if(!TessAtom_isMainChain(A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		return TessAtom_matchResName(T,A);
+		T->need=ATOM_MAINCHAIN;
+		T->forbid=ATOM_HYDROGEN;
+		break;
 
 	case 6:
 		// Any side-chain atom in the given residue(s)
 
-		if(TessAtom_isMainChain(A)) return 0;
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		return TessAtom_matchResName(T,A);
+		T->forbid=ATOM_MAINCHAIN|ATOM_HYDROGEN;
+		break;
 
 	case 7:
 		// Any atom (in the specified resdiue)
 
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		return TessAtom_matchResName(T,A);
+		T->forbid=ATOM_HYDROGEN;
+		break;
 
 	//Riziotis options
 	case 8:
 		//Any atom in the same position in the given residue(s)
-		
-		if(TessAtom_isHydrogen(A)) return 0; // Riziotis - Only match heavy atoms
-		if(!TessAtom_isInSamePosition(T,A)) return 0;
-		return TessAtom_matchResName(T,A);
 
+		T->forbid=ATOM_HYDROGEN;
+		mask=place;
+		break;
 
-	// Gail's options follow (no residue specificity)
+	// Gail's options follow (no residue specificity). Note
+	// that hydrogens are not excluded from these.
 
 	case 100:
 		// name match
 
-		return TessAtom_matchName(T,A);
+		mask=exact;
+		res=0;
+		break;
 
 	case 101:
 		// any non-carbon side-chain atom.
 
-		if(TessAtom_isCarbon(A)) return 0;
-		if(TessAtom_isMainChain(A)) return 0;
-		return 1;
+		T->forbid=ATOM_CARBON|ATOM_MAINCHAIN;
+		res=0;
+		break;
 
 	case 102:
 		// Any non-carbon atom...
 
-		if(TessAtom_isCarbon(A)) return 0;
-		return 1;
+		T->forbid=ATOM_CARBON;
+		res=0;
+		break;
 
 	case 103:
 		// Atom type specified (no residue considered)
 
-		if(!TessAtom_matchType(T,A)) return 0;
-		return 1;
+		mask=type;
+		res=0;
+		break;
 
 	case 104:
 		// Non-carbon main-chain
 
-		if(TessAtom_isCarbon(A)) return 0;
-		if(!TessAtom_isMainChain(A)) return 0;
+		T->need=ATOM_MAINCHAIN;
+		T->forbid=ATOM_CARBON;
+		res=0;
+		break;
 
 	case 105:
-		// Any main-chain atom in the given residue(s)
+		// Any main-chain atom
 
-		return TessAtom_isMainChain(A);
+		T->need=ATOM_MAINCHAIN;
+		res=0;
+		break;
 
 	case 106:
-		// Any side-chain atom in the given residue(s)
+		// Any side-chain atom
 
-		if(TessAtom_isMainChain(A)) return 0;
-		return 1;
+		T->forbid=ATOM_MAINCHAIN;
+		res=0;
+		break;
 
 	case 107:
 		// Any atom AT ALL!!
 
-		return 1;
+		res=0;
+		break;
 
 	default:
-		fprintf(stderr,"TessAtom_match: unknown match code (%i)\n",T->code);
-		exit(-1);
+		fprintf(stderr,"TessAtom_create: unknown match code (%i)\n",T->code);
+		return 0;
+	}
+
+	T->names = mask ? T->nameCount:0;
+	T->resNames = res ? T->resNameCount:0;
+	if(mask)
+	{
+		T->mask[0]=mask[0];
+		T->mask[1]=mask[1];
+	}
+
+	return 1;
+}
+
+static int TessAtom_test(const TessAtom *T, const Atom *A)
+{
+	unsigned int mask = T->mask[A->flags&ATOM_BLANK];
+	int k,ok;
+
+	// The atom classes...
+
+	if((A->flags&T->need)!=T->need || (A->flags&T->forbid)) return 0;
+
+	// ...then the atom name...
+
+	ok = !T->names;
+	for(k=0; k<T->names; k++)
+	{
+		ok |= ((A->name^T->nameId[k])&mask)==0;
+	}
+
+	if(!ok) return 0;
+
+	// ...and the residue name.
+
+	ok = !T->resNames;
+	for(k=0; k<T->resNames; k++)
+	{
+		ok |= A->resName==T->resNameId[k];
 	}
+
+	return ok;
 }
 
 // ==================================================================
+// Methods of type TessAtom (matching)
+// ==================================================================
+
+int TessAtom_match(const TessAtom *T, const Atom *A)
+{
+	return TessAtom_test(T,A);
+}
+
+int TessAtom_select(const TessAtom *T, const Atom *A, int n, int *index)
+{
+	int m,count=0;
+
+	// One pass over the atoms with no branch on the result,
+	// so the loop runs at the same pace whatever matches.
 
+	for(m=0; m<n; m++)
+	{
+		index[count]=m;
+		count += TessAtom_test(T,&A[m]);
+	}
+
+	return count;
+}
+
+// ==================================================================
+// Private methods of type TessAtom (keys)
+// ==================================================================
+
+static int TessAtom_compareName(const void *a, const void *b)
+{
+	return strcmp(*(char* const*)a,*(char* const*)b);
+}
+
+static void TessAtom_appendNames(char *key, char **name, int n, int len)
+{
+	char **p;
+	int i,k;
+
+	// Upper case the names (they are matched without regard
+	// to case), sort them and append each distinct one.
+
+	p=(char**)malloc(n*sizeof(char*)+n*(len+1));
+	for(k=0; k<n; k++)
+	{
+		p[k]=(char*)&p[n]+k*(len+1);
+		for(i=0; i<len && name[k][i]; i++) p[k][i]=toupper(name[k][i]);
+		p[k][i]=0;
+	}
+
+	qsort(p,n,sizeof(char*),TessAtom_compareName);
+
+	for(k=0; k<n; k++)
+	{
+		if(k>0 && strcmp(p[k],p[k-1])==0) continue;
+		strcat(key,p[k]);
+		strcat(key,",");
+	}
+
+	free(p);
+}
+
+static void TessAtom_setKey(TessAtom *A)
+{
+	int code = A->code<0 ? 0:A->code;
+
+	// Two atoms whose keys are equal match exactly the same
+	// atoms. The key is the match code followed by the atom
+	// and residue name alternates the code pays attention to.
+
+	sprintf(A->key,"%i:",code);
+	if(A->names) TessAtom_appendNames(A->key,A->name,A->nameCount,4);
+	strcat(A->key,"/");
+	if(A->resNames) TessAtom_appendNames(A->key,A->resName,A->resNameCount,3);
+}
+
+// ==================================================================
@@ -25,7 +25,10 @@ typedef struct _TessAtom TessAtom;
 // free(J)				Free memory associated with J
 // position(J)			Return coordinates of J
 // match(J,A)			True if A matches J
+// select(J,A,n,i)		Indices i[] of those of A[0..n-1] matching J;
+//						returns the number of them
 // resSeq(A)			Return resSeq field of A
+// key(A)				Canonical match rule: equal keys match equal atoms
 // chainID(A)			Return the chain ID of A
 // ==================================================================
 
@@ -33,7 +36,9 @@ extern TessAtom *TessAtom_create(const char*);
 extern void TessAtom_free(TessAtom*);
 extern const double *TessAtom_position(const TessAtom*);
 extern int TessAtom_match(const TessAtom*,const Atom*);
+extern int TessAtom_select(const TessAtom*,const Atom*,int,int*);
 extern int TessAtom_resSeq(const TessAtom*);
+extern const char *TessAtom_key(const TessAtom*);
 //Riziotis edit
 extern char TessAtom_chainID1(const TessAtom*);
 extern char TessAtom_chainID2(const TessAtom*);
@@ -68,6 +68,12 @@ static int TessTemplate_match(const Template *T,int k,const Atom *A)
 	return TessAtom_match(J->atom[k],A);
 }
 
+static int TessTemplate_select(const Template *T,int k,const Atom *A,int n,int *index)
+{
+	const TessTemplate *J = (const TessTemplate*)&T[1];
+	return TessAtom_select(J->atom[k],A,n,index);
+}
+
 static int TessTemplate_range(const Template *T,int i,int j,double *a,double *b)
 {
 	const TessTemplate *J = (const TessTemplate*)&T[1];
@@ -87,6 +93,12 @@ static double TessTemplate_distWeight(const Template *T, int k)
 	return TessAtom_distWeight(J->atom[k]);
 }
 
+static const char *TessTemplate_key(const Template *T, int k)
+{
+	const TessTemplate *J=(const TessTemplate*)&T[1];
+	return TessAtom_key(J->atom[k]);
+}
+
 static int TessTemplate_check(const Template *T, Atom **A, int k, int ignore_chain)
 {
 	const TessTemplate *J = (const TessTemplate*)&T[1];
@@ -262,6 +274,7 @@ Template *TessTemplate_create(FILE *file,const char *sym)
 
 	T->free=TessTemplate_free;
 	T->match=TessTemplate_match;
+	T->select=TessTemplate_select;
 	T->position=TessTemplate_position;
 	T->count=TessTemplate_count;
 	T->range=TessTemplate_range;
@@ -269,6 +282,7 @@ Template *TessTemplate_create(FILE *file,const char *sym)
 	T->name=TessTemplate_name;
 	T->logE=TessTemplate_logE;
 	T->distWeight=TessTemplate_distWeight;
+	T->key=TessTemplate_key;
 
 	// Set up the data fields
 
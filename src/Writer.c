@@ -0,0 +1,238 @@
+// ==================================================================
+// Writer.c
+// ==================================================================
+// Implementation of type Writer.
+// ==================================================================
+
+#include "Writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// ==================================================================
+// WRITER_BLOCK			Size of the buffer of a writer to a file
+// WRITER_START			Starting size of the buffer of any other
+// ==================================================================
+
+#define WRITER_BLOCK 0x100000
+#define WRITER_START 0x1000
+
+// ==================================================================
+// type Writer
+// ==================================================================
+// file					The file written to (or NULL)
+// buffer[0..used-1]	What is written but not yet flushed or taken
+// room					Size of buffer
+// ==================================================================
+
+struct _Writer
+{
+	FILE *file;
+	char *buffer;
+	size_t used;
+	size_t room;
+};
+
+// ==================================================================
+// Private methods of type Writer
+// ==================================================================
+// reserve(W,n)			Make room for n more chars, flushing the buffer
+//						if need be, and point to where they go
+// pad(W,s,n,w,l)		Write s[0..n-1] as a field of width w (on the
+//						left of it if l)
+// ==================================================================
+
+static char *Writer_reserve(Writer*,size_t);
+static void Writer_pad(Writer*,const char*,int,int,int);
+
+// ==================================================================
+// Methods of type Writer
+// ==================================================================
+
+Writer *Writer_create(FILE *file)
+{
+	Writer *W;
+
+	W = (Writer*)calloc(1,sizeof(Writer));
+	W->file=file;
+
+	return W;
+}
+
+void Writer_free(Writer *W)
+{
+	if(W)
+	{
+		Writer_flush(W);
+		free(W->buffer);
+		free(W);
+	}
+}
+
+int Writer_flush(Writer *W)
+{
+	int ok=1;
+
+	if(W->file && W->used>0)
+	{
+		ok = fwrite(W->buffer,1,W->used,W->file)==W->used;
+		W->used=0;
+	}
+
+	return ok;
+}
+
+char *Writer_take(Writer *W, size_t *size)
+{
+	char *s = W->buffer;
+
+	*size=W->used;
+	W->buffer=NULL;
+	W->used=W->room=0;
+
+	return s;
+}
+
+void Writer_bytes(Writer *W, const void *d, size_t n)
+{
+	// (Nothing is written for no bytes, as d may then be
+	// NULL. A block or more goes straight out, rather than
+	// growing the buffer.)
+
+	if(n==0) return;
+
+	if(W->file && n>=WRITER_BLOCK)
+	{
+		Writer_flush(W);
+		fwrite(d,1,n,W->file);
+		return;
+	}
+
+	memcpy(Writer_reserve(W,n),d,n);
+	W->used+=n;
+}
+
+void Writer_string(Writer *W, const char *s)
+{
+	Writer_bytes(W,s,strlen(s));
+}
+
+void Writer_character(Writer *W, char c)
+{
+	*Writer_reserve(W,1)=c;
+	W->used++;
+}
+
+void Writer_field(Writer *W, const char *s, int width, int left)
+{
+	Writer_pad(W,s,strlen(s),width,left);
+}
+
+void Writer_integer(Writer *W, long x, int width)
+{
+	char d[24];
+	unsigned long n;
+	int k=sizeof(d);
+
+	n = x<0 ? -(unsigned long)x:(unsigned long)x;
+
+	do
+	{
+		d[--k]='0'+n%10;
+		n/=10;
+	}
+	while(n);
+
+	if(x<0) d[--k]='-';
+
+	Writer_pad(W,&d[k],sizeof(d)-k,width,0);
+}
+
+void Writer_fixed(Writer *W, double x, int width, int places)
+{
+	static const double scale[] = { 1,1e1,1e2,1e3,1e4,1e5,1e6 };
+	char d[24];
+	double y,f;
+	unsigned long n;
+	int i,k=sizeof(d),m;
+
+	// Scale x up to an integer and round it. Unless it is
+	// too large or too close to a tie for the error in the
+	// scaling (under 2^-23 below 2^30) to be ruled out, this
+	// rounds exactly as printf does.
+
+	if(places<0 || places>6) goto slow;
+
+	y=fabs(x)*scale[places];
+	if(!(y<1e9)) goto slow;
+
+	n=(unsigned long)y;
+	f=y-n;
+	if(fabs(f-0.5)<1e-6) goto slow;
+	if(f>0.5) n++;
+
+	for(i=0; i<places; i++)
+	{
+		d[--k]='0'+n%10;
+		n/=10;
+	}
+
+	if(places>0) d[--k]='.';
+
+	do
+	{
+		d[--k]='0'+n%10;
+		n/=10;
+	}
+	while(n);
+
+	// (As printf does, -0.001 to 3 places is "-0.000".)
+
+	if(signbit(x)) d[--k]='-';
+
+	Writer_pad(W,&d[k],sizeof(d)-k,width,0);
+	return;
+
+slow:
+	m=snprintf(NULL,0,"%*.*f",width,places,x);
+	snprintf(Writer_reserve(W,m+1),m+1,"%*.*f",width,places,x);
+	W->used+=m;
+}
+
+// ==================================================================
+// Private methods of type Writer
+// ==================================================================
+
+static char *Writer_reserve(Writer *W, size_t n)
+{
+	if(W->used+n>W->room && W->file) Writer_flush(W);
+
+	if(W->used+n>W->room)
+	{
+		if(!W->room) W->room = W->file ? WRITER_BLOCK:WRITER_START;
+		while(W->used+n>W->room) W->room*=2;
+
+		W->buffer=(char*)realloc(W->buffer,W->room);
+	}
+
+	return &W->buffer[W->used];
+}
+
+static void Writer_pad(Writer *W, const char *s, int n, int width, int left)
+{
+	int m = width>n ? width-n:0;
+	char *p = Writer_reserve(W,n+m);
+
+	if(!left)
+	{
+		memset(p,' ',m);
+		p+=m;
+	}
+
+	memcpy(p,s,n);
+	if(left) memset(p+n,' ',m);
+
+	W->used+=n+m;
+}
+
+// ==================================================================
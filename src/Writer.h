@@ -0,0 +1,58 @@
+// ==================================================================
+// Writer.h
+// ==================================================================
+// Declaration of type Writer and its methods (a large output buffer
+// with fast formatting of the fixed-width fields of hits).
+// ==================================================================
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+
+// ==================================================================
+// Forward declarations
+// ==================================================================
+// Writer				A buffer of output
+// ==================================================================
+
+typedef struct _Writer Writer;
+
+// ==================================================================
+// Methods of type Writer
+// ==================================================================
+// create(f)			Create a writer to f (or if f is NULL, one which
+//						keeps all that is written: see take())
+// free(W)				Write out what is left (see flush()) and free W
+// flush(W)				Write the buffer to the file; true=>success
+// take(W,n)			Hand over all that has been written (to be freed
+//						by the caller) and its size n, and empty W
+// bytes(W,d,n)			Write d[0..n-1]
+// string(W,s)			Write s
+// character(W,c)		Write c (even if it is zero)
+// field(W,s,w,l)		Write s as printf's %ws (or if l, %-ws)
+// integer(W,x,w)		Write x as printf's %wi
+// fixed(W,x,w,p)		Write x as printf's %w.pf
+// ==================================================================
+// Each writer is used by one thread at a time, so a thread of a
+// search writes its hits to a writer of its own. What is written to
+// f goes out a large block at a time, with no stdio formatting: the
+// numbers are formatted here, byte for byte as printf would, falling
+// back on it only for values (e.g. ties in rounding) where a short
+// cut might differ.
+// ==================================================================
+
+extern Writer *Writer_create(FILE*);
+extern void Writer_free(Writer*);
+extern int Writer_flush(Writer*);
+extern char *Writer_take(Writer*,size_t*);
+extern void Writer_bytes(Writer*,const void*,size_t);
+extern void Writer_string(Writer*,const char*);
+extern void Writer_character(Writer*,char);
+extern void Writer_field(Writer*,const char*,int,int);
+extern void Writer_integer(Writer*,long,int);
+extern void Writer_fixed(Writer*,double,int,int);
+
+// ==================================================================
+
+#endif
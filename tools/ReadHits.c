@@ -0,0 +1,74 @@
+// ==================================================================
+// ReadHits.c
+// ==================================================================
+// A reader of the binary hits written by jess --format binary, and
+// an example of reading them with Hit_check and Hit_read: writes
+// each hit in the files given (or stdin) as a line of the TSV that
+// jess --format tsv would have written.
+//
+// Usage: ReadHits [binary-hits...]
+// ==================================================================
+
+#include "Hit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ==================================================================
+// Local functions
+// ==================================================================
+
+static int readHits(FILE *file, const char *filename, Writer *out)
+{
+	Hit *H;
+	int error;
+
+	if(!Hit_check(file))
+	{
+		fprintf(stderr,"%s: not a file of hits from this build of Jess\n",filename);
+		return 0;
+	}
+
+	while((H=Hit_read(file,&error)))
+	{
+		Hit_tsv(H,out);
+		free(H);
+	}
+
+	if(error) fprintf(stderr,"%s: corrupt hit\n",filename);
+	return !error;
+}
+
+// ==================================================================
+// Entry point
+// ==================================================================
+
+int main(int argc, char **argv)
+{
+	FILE *file;
+	Writer *out;
+	int k,ok=1;
+
+	out=Writer_create(stdout);
+
+	if(argc<2) ok=readHits(stdin,"stdin",out);
+
+	for(k=1; k<argc; k++)
+	{
+		if(!(file=fopen(argv[k],"rb")))
+		{
+			perror(argv[k]);
+			ok=0;
+			continue;
+		}
+
+		if(!readHits(file,argv[k],out)) ok=0;
+		fclose(file);
+	}
+
+	Writer_free(out);
+
+	return ok ? 0:1;
+}
+
+// ==================================================================